@@ -0,0 +1,72 @@
+/* alias.c
+ * the alias table: name -> replacement text
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alias.h"
+#include "hash.h"
+#include "pcache.h"
+
+static HashTable *aliases;
+
+
+const char *alias_get(const char *name)
+{
+    return aliases ? hash_get(aliases, name) : NULL;
+}
+
+
+void alias_set(const char *name, const char *value)
+{
+    if (!aliases)
+        aliases = hash_new(free);
+
+    hash_put(aliases, name, strdup(value));
+
+    /* trees parsed with the old definition are stale */
+    pcache_clear();
+}
+
+
+int alias_unset(const char *name)
+{
+    if (!aliases || !hash_remove(aliases, name))
+        return 0;
+
+    pcache_clear();
+
+    return 1;
+}
+
+
+/* prints name='value' in a form that can be read back in */
+void alias_print(const char *name)
+{
+    const char *p = alias_get(name);
+
+    printf("%s='", name);
+    for (; *p; p++) {
+        if (*p == '\'')
+            printf("'\\''");
+        else
+            putchar(*p);
+    }
+    printf("'\n");
+}
+
+
+void alias_print_all(void)
+{
+    HashEntry *e;
+    size_t i;
+
+    if (!aliases)
+        return;
+
+    for (e = hash_first(aliases, &i); e; e = hash_next(aliases, e, &i))
+        alias_print(e->key);
+}
@@ -0,0 +1,12 @@
+#ifndef ALIAS_H
+#define ALIAS_H
+
+/* aliases, expanded by the parser in the command position of
+ * interactive input */
+const char *alias_get(const char *name);
+void alias_set(const char *name, const char *value);
+int alias_unset(const char *name);
+void alias_print(const char *name);
+void alias_print_all(void);
+
+#endif
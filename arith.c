@@ -0,0 +1,580 @@
+/* arith.c
+ * 64-bit integer expression evaluator for $(( ))
+ *
+ * A recursive descent / precedence climbing evaluator that works
+ * directly on the expression text: no tokens are allocated and no
+ * child process is involved, so a loop counter such as
+ *
+ *     ~$ i=$((i + 1))
+ *
+ * costs a few hundred nanoseconds.  Operators, from lowest to highest
+ * precedence:
+ *
+ *     ,                          sequence
+ *     = *= /= %= += -= <<= >>= &= ^= |=   assignment (right assoc)
+ *     ?:                         conditional
+ *     ||  &&                     logical (short-circuiting)
+ *     |  ^  &                    bitwise
+ *     ==  !=  <  <=  >  >=       comparison
+ *     <<  >>                     shift
+ *     +  -  *  /  %              arithmetic
+ *     **                         exponentiation (right assoc)
+ *     !  ~  -  +  ++id  --id     unary
+ *     id++  id--                 postfix
+ *
+ * Constants may be decimal, octal (0nn), hex (0xnn) or base#digits.
+ * Variables are referenced by name; unset or empty variables are 0
+ * and non-numeric values are themselves evaluated as expressions.
+ **********************************************************************/
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "arith.h"
+#include "vars.h"
+
+#define ARITH_MAX_NAME  256
+#define ARITH_MAX_DEPTH 32
+
+typedef struct {
+    const char *expr;   /* full expression, for diagnostics */
+    const char *p;      /* cursor */
+    int noeval;         /* > 0 inside a short-circuited operand */
+    int error;
+    int depth;          /* recursion through variable values */
+} Arith;
+
+typedef struct {
+    const char *op;
+    int prec;
+    int right;          /* right associative */
+} BinOp;
+
+/* longest operators first so that prefixes don't shadow them */
+static const BinOp binops[] = {
+    {"**", 11, 1},
+    {"<<",  8, 0}, {">>", 8, 0},
+    {"<=",  7, 0}, {">=", 7, 0},
+    {"==",  6, 0}, {"!=", 6, 0},
+    {"&&",  2, 0}, {"||", 1, 0},
+    {"*",  10, 0}, {"/", 10, 0}, {"%", 10, 0},
+    {"+",   9, 0}, {"-",  9, 0},
+    {"<",   7, 0}, {">",  7, 0},
+    {"&",   5, 0}, {"^",  4, 0}, {"|", 3, 0},
+    {NULL,  0, 0}
+};
+
+static const char *assignops[] = {
+    "<<=", ">>=", "*=", "/=", "%=", "+=", "-=", "&=", "^=", "|=", "=", NULL
+};
+
+static long long parse_comma(Arith *A);
+static long long parse_assign(Arith *A);
+static int eval_text(const char *expr, long long *result, int depth);
+
+
+static void arith_error(Arith *A, const char *msg)
+{
+    if (A->error)
+        return;
+
+    A->error = 1;
+
+    if (*A->p)
+        fprintf(stderr, "pssh: %s: %s (error token is \"%s\")\n",
+                A->expr, msg, A->p);
+    else
+        fprintf(stderr, "pssh: %s: %s\n", A->expr, msg);
+}
+
+
+static void skip_ws(Arith *A)
+{
+    while (isspace((unsigned char)*A->p))
+        A->p++;
+}
+
+
+static int is_name_start(char c)
+{
+    return isalpha((unsigned char)c) || c == '_';
+}
+
+
+static int is_name_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+
+/* reads an identifier at the cursor into name; returns its length */
+static size_t read_name(Arith *A, char *name)
+{
+    size_t n = 0;
+
+    while (is_name_char(A->p[n]))
+        n++;
+
+    if (n >= ARITH_MAX_NAME) {
+        arith_error(A, "variable name too long");
+        return 0;
+    }
+
+    memcpy(name, A->p, n);
+    name[n] = '\0';
+    A->p += n;
+
+    return n;
+}
+
+
+static int digit_value(char c, int base)
+{
+    if (isdigit((unsigned char)c))
+        return c - '0';
+    if (islower((unsigned char)c))
+        return c - 'a' + 10;
+    if (isupper((unsigned char)c))
+        return base <= 36 ? c - 'A' + 10 : c - 'A' + 36;
+    if (c == '@')
+        return 62;
+    if (c == '_')
+        return 63;
+
+    return 64;
+}
+
+
+/* parses an integer constant at *s; returns 0 on success */
+static int parse_number(const char **s, long long *result)
+{
+    const char *p = *s;
+    unsigned long long v = 0;
+    int base = 10, d, ndigits = 0;
+
+    if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+        base = 16;
+        p += 2;
+    } else if (p[0] == '0' && isdigit((unsigned char)p[1])) {
+        base = 8;
+        p++;
+    } else {
+        const char *q = p;
+
+        while (isdigit((unsigned char)*q))
+            q++;
+
+        if (*q == '#' && q > p) {
+            base = 0;
+            for (; p < q; p++)
+                base = base * 10 + (*p - '0');
+            p++;
+            if (base < 2 || base > 64)
+                return -1;
+        }
+    }
+
+    for (; isalnum((unsigned char)*p) || *p == '@' || *p == '_'; p++) {
+        d = digit_value(*p, base);
+        if (d >= base)
+            return -1;
+        v = v * base + d;
+        ndigits++;
+    }
+
+    if (!ndigits && base != 8)
+        return -1;
+
+    *result = (long long)v;
+    *s = p;
+
+    return 0;
+}
+
+
+static long long var_value(Arith *A, const char *name)
+{
+    const char *val = var_get(name);
+    const char *p;
+    long long n;
+
+    if (!val || !*val)
+        return 0;
+
+    p = val;
+    if (*p == '-' || *p == '+')
+        p++;
+
+    if (!parse_number(&p, &n) && !*p)
+        return val[0] == '-' ? (long long)(0 - (unsigned long long)n) : n;
+
+    if (A->depth >= ARITH_MAX_DEPTH) {
+        arith_error(A, "expression recursion level exceeded");
+        return 0;
+    }
+
+    if (eval_text(val, &n, A->depth + 1) < 0) {
+        A->error = 1;
+        return 0;
+    }
+
+    return n;
+}
+
+
+static void var_store(Arith *A, const char *name, long long value)
+{
+    if (!A->noeval)
+        var_set_int(name, value);
+}
+
+
+static long long int_pow(Arith *A, long long base, long long exp)
+{
+    unsigned long long r = 1, b = (unsigned long long)base;
+
+    if (exp < 0) {
+        if (!A->noeval)
+            arith_error(A, "exponent less than 0");
+        return 0;
+    }
+
+    while (exp) {
+        if (exp & 1)
+            r *= b;
+        b *= b;
+        exp >>= 1;
+    }
+
+    return (long long)r;
+}
+
+
+static long long apply_binop(Arith *A, const char *op, long long a, long long b)
+{
+    unsigned long long ua = (unsigned long long)a, ub = (unsigned long long)b;
+
+    switch (op[0]) {
+    case '+': return (long long)(ua + ub);
+    case '-': return (long long)(ua - ub);
+    case '*': return op[1] == '*' ? int_pow(A, a, b) : (long long)(ua * ub);
+    case '/':
+    case '%':
+        if (b == 0) {
+            if (!A->noeval)
+                arith_error(A, "division by 0");
+            return 0;
+        }
+        if (b == -1)
+            return op[0] == '/' ? (long long)(0 - ua) : 0;
+        return op[0] == '/' ? a / b : a % b;
+    case '<':
+        if (op[1] == '<') return (long long)(ua << (b & 63));
+        if (op[1] == '=') return a <= b;
+        return a < b;
+    case '>':
+        if (op[1] == '>') return a >> (b & 63);
+        if (op[1] == '=') return a >= b;
+        return a > b;
+    case '=': return a == b;
+    case '!': return a != b;
+    case '&': return op[1] == '&' ? (a && b) : (a & b);
+    case '|': return op[1] == '|' ? (a || b) : (a | b);
+    case '^': return a ^ b;
+    }
+
+    return 0;
+}
+
+
+static long long parse_unary(Arith *A);
+
+
+static long long parse_primary(Arith *A)
+{
+    char name[ARITH_MAX_NAME];
+    long long v;
+
+    skip_ws(A);
+
+    if (*A->p == '(') {
+        A->p++;
+        v = parse_comma(A);
+        skip_ws(A);
+        if (*A->p != ')') {
+            arith_error(A, "missing `)'");
+            return 0;
+        }
+        A->p++;
+        return v;
+    }
+
+    if (isdigit((unsigned char)*A->p)) {
+        if (parse_number(&A->p, &v) < 0) {
+            arith_error(A, "value too great for base");
+            return 0;
+        }
+        return v;
+    }
+
+    if (is_name_start(*A->p)) {
+        if (!read_name(A, name))
+            return 0;
+
+        v = var_value(A, name);
+
+        skip_ws(A);
+        if ((A->p[0] == '+' && A->p[1] == '+') ||
+            (A->p[0] == '-' && A->p[1] == '-')) {
+            var_store(A, name, A->p[0] == '+' ?
+                      (long long)((unsigned long long)v + 1) :
+                      (long long)((unsigned long long)v - 1));
+            A->p += 2;
+        }
+
+        return v;
+    }
+
+    arith_error(A, "syntax error: operand expected");
+
+    return 0;
+}
+
+
+static long long parse_unary(Arith *A)
+{
+    char name[ARITH_MAX_NAME];
+    long long v;
+    char c;
+
+    skip_ws(A);
+    c = *A->p;
+
+    if ((c == '+' || c == '-') && A->p[1] == c) {
+        const char *save = A->p;
+
+        A->p += 2;
+        skip_ws(A);
+        if (is_name_start(*A->p)) {
+            if (!read_name(A, name))
+                return 0;
+            v = var_value(A, name);
+            v = (long long)(c == '+' ? (unsigned long long)v + 1 :
+                                       (unsigned long long)v - 1);
+            var_store(A, name, v);
+            return v;
+        }
+        A->p = save;
+    }
+
+    switch (c) {
+    case '!':
+        A->p++;
+        return !parse_unary(A);
+    case '~':
+        A->p++;
+        return ~parse_unary(A);
+    case '-':
+        A->p++;
+        return (long long)(0 - (unsigned long long)parse_unary(A));
+    case '+':
+        A->p++;
+        return parse_unary(A);
+    }
+
+    return parse_primary(A);
+}
+
+
+static const BinOp *peek_binop(Arith *A)
+{
+    const BinOp *op;
+    size_t len;
+
+    skip_ws(A);
+
+    for (op=binops; op->op; op++) {
+        len = strlen(op->op);
+        if (strncmp(A->p, op->op, len))
+            continue;
+
+        /* "+=" and friends are assignments, handled by parse_assign() */
+        if (len == 1 && A->p[1] == '=')
+            return NULL;
+
+        return op;
+    }
+
+    return NULL;
+}
+
+
+static long long parse_binary(Arith *A, int min_prec)
+{
+    const BinOp *op;
+    long long lhs, rhs;
+    int short_circuit;
+
+    lhs = parse_unary(A);
+
+    while (!A->error) {
+        op = peek_binop(A);
+        if (!op || op->prec < min_prec)
+            break;
+
+        A->p += strlen(op->op);
+
+        short_circuit = (op->prec == 2 && !lhs) || (op->prec == 1 && lhs);
+        if (short_circuit)
+            A->noeval++;
+
+        rhs = parse_binary(A, op->right ? op->prec : op->prec + 1);
+
+        if (short_circuit)
+            A->noeval--;
+
+        lhs = apply_binop(A, op->op, lhs, rhs);
+    }
+
+    return lhs;
+}
+
+
+static long long parse_ternary(Arith *A)
+{
+    long long cond, a, b;
+
+    cond = parse_binary(A, 1);
+
+    skip_ws(A);
+    if (*A->p != '?')
+        return cond;
+    A->p++;
+
+    if (!cond)
+        A->noeval++;
+    a = parse_assign(A);
+    if (!cond)
+        A->noeval--;
+
+    skip_ws(A);
+    if (*A->p != ':') {
+        arith_error(A, "`:' expected for conditional expression");
+        return 0;
+    }
+    A->p++;
+
+    if (cond)
+        A->noeval++;
+    b = parse_ternary(A);
+    if (cond)
+        A->noeval--;
+
+    return cond ? a : b;
+}
+
+
+static long long parse_assign(Arith *A)
+{
+    char name[ARITH_MAX_NAME];
+    const char *save;
+    const char **op;
+    long long lhs, rhs;
+    size_t len;
+
+    skip_ws(A);
+
+    if (!is_name_start(*A->p))
+        return parse_ternary(A);
+
+    save = A->p;
+    if (!read_name(A, name))
+        return 0;
+    skip_ws(A);
+
+    for (op=assignops; *op; op++) {
+        len = strlen(*op);
+        if (!strncmp(A->p, *op, len) && !(len == 1 && A->p[1] == '='))
+            break;
+    }
+
+    if (!*op) {
+        A->p = save;
+        return parse_ternary(A);
+    }
+
+    A->p += len;
+    rhs = parse_assign(A);
+    if (A->error)
+        return 0;
+
+    if (len == 1) {
+        var_store(A, name, rhs);
+        return rhs;
+    }
+
+    /* "op=": evaluate as "name op rhs" */
+    {
+        char binop[3] = {0};
+
+        memcpy(binop, *op, len - 1);
+        lhs = var_value(A, name);
+        rhs = apply_binop(A, binop, lhs, rhs);
+    }
+
+    var_store(A, name, rhs);
+
+    return rhs;
+}
+
+
+static long long parse_comma(Arith *A)
+{
+    long long v = parse_assign(A);
+
+    for (skip_ws(A); *A->p == ',' && !A->error; skip_ws(A)) {
+        A->p++;
+        v = parse_assign(A);
+    }
+
+    return v;
+}
+
+
+static int eval_text(const char *expr, long long *result, int depth)
+{
+    Arith A;
+    long long v;
+
+    A.expr = expr;
+    A.p = expr;
+    A.noeval = 0;
+    A.error = 0;
+    A.depth = depth;
+
+    skip_ws(&A);
+    if (!*A.p) {
+        *result = 0;
+        return 0;
+    }
+
+    v = parse_comma(&A);
+
+    skip_ws(&A);
+    if (!A.error && *A.p)
+        arith_error(&A, "syntax error in expression");
+
+    if (A.error)
+        return -1;
+
+    *result = v;
+    return 0;
+}
+
+
+int arith_eval(const char *expr, long long *result)
+{
+    return eval_text(expr, result, 0);
+}
@@ -0,0 +1,12 @@
+#ifndef ARITH_H
+#define ARITH_H
+
+/* Evaluate a shell arithmetic expression, as found inside $(( )),
+ * using 64-bit signed integers.  Variable references may be bare
+ * names and assignment operators update the shell variable.
+ *
+ * Returns 0 and stores the value in *result on success, -1 (after
+ * printing a diagnostic) on error. */
+int arith_eval(const char *expr, long long *result);
+
+#endif
@@ -0,0 +1,263 @@
+/* batch.c
+ * runs a stream of commands as a single job with a bounded number in
+ * flight.  The whole set shares one process group and one entry in the
+ * job table, so jobs lists it and ^C or kill %n reach every command.
+ * The job stays open while commands are still to come.
+ *
+ * The SIGCHLD handler reaps the commands and tells the batch through
+ * the job's reaped() hook.  The batch waits in ppoll(), with SIGCHLD let
+ * through, so the output of captured commands is drained and finished
+ * commands are collected at the same point.  That is also where the
+ * next one is started, once a slot is free.
+ **********************************************************************/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "exec.h"
+#include "job_control.h"
+
+
+int batch_ncpus(void)
+{
+    static int ncpus;     /* glibc reads it from /sys each time */
+    long n;
+
+    if (!ncpus) {
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+        ncpus = n > 0 ? (int)n : 1;
+    }
+
+    return ncpus;
+}
+
+
+Batch *batch_new(const char *name, int max, int capture,
+                 void (*collect)(Batch *B, BatchProc *P), void *data)
+{
+    Batch *B = calloc(1, sizeof(*B));
+
+    B->name = strdup(name);
+    B->job_id = -1;
+    B->max = max > 0 ? max : 1;
+    B->capture = capture;
+    B->collect = collect;
+    B->data = data;
+
+    return B;
+}
+
+
+/* runs in the SIGCHLD handler */
+static void batch_reaped(Job *job, pid_t pid, int status)
+{
+    Batch *B = job->data;
+    int i;
+
+    for (i=0; i<B->nprocs; i++) {
+        if (B->procs[i]->pid == pid) {
+            B->procs[i]->status = status_to_exit_code(status);
+            B->procs[i]->done = 1;
+            B->running--;
+            return;
+        }
+    }
+}
+
+
+static void proc_read(BatchProc *P)
+{
+    ssize_t n;
+
+    if (P->cap - P->len < 4096) {
+        P->cap = P->cap ? P->cap * 2 : 8192;
+        P->buf = realloc(P->buf, P->cap);
+    }
+
+    n = read(P->out, P->buf + P->len, P->cap - P->len);
+    if (n > 0) {
+        P->len += n;
+    } else if (n == 0 || errno != EINTR) {
+        close(P->out);
+        P->out = -1;
+    }
+}
+
+
+/* hands the commands that are done to collect(), in the order they
+ * finished */
+static void batch_collect(Batch *B)
+{
+    BatchProc *P;
+    int i, j;
+
+    for (i=j=0; i<B->nprocs; i++) {
+        P = B->procs[i];
+        if (!P->done || P->out >= 0) {
+            B->procs[j++] = P;
+            continue;
+        }
+
+        if (B->collect)
+            B->collect(B, P);
+        free(P->buf);
+        free(P);
+    }
+
+    B->nprocs = j;
+}
+
+
+/* waits for something to happen: a command ending, or output */
+static void batch_wait(Batch *B)
+{
+    struct pollfd fds[B->nprocs + 1];
+    BatchProc *owner[B->nprocs + 1];
+    sigset_t waitmask;
+    Job *J;
+    int i, n = 0;
+
+    for (i=0; i<B->nprocs; i++) {
+        if (B->procs[i]->out >= 0) {
+            fds[n].fd = B->procs[i]->out;
+            fds[n].events = POLLIN;
+            owner[n++] = B->procs[i];
+        }
+    }
+
+    if (B->running > 0 || n > 0) {
+        sigprocmask(SIG_BLOCK, NULL, &waitmask);
+        sigdelset(&waitmask, SIGCHLD);
+
+        if (ppoll(fds, n, NULL, &waitmask) > 0)
+            for (i=0; i<n; i++)
+                if (fds[i].revents)
+                    proc_read(owner[i]);
+    }
+
+    batch_collect(B);
+
+    J = find_job_by_job_id(B->job_id);
+    if (job_interrupted || !J || J->status != FG)
+        B->stopped = 1;
+}
+
+
+int batch_run(Batch *B, char **argv)
+{
+    int out[2] = { -1, -1 }, devnull;
+    BatchProc *P;
+    pid_t pid;
+    Job *J;
+
+    while (!B->stopped && B->running >= B->max)
+        batch_wait(B);
+
+    if (B->stopped)
+        return -1;
+
+    if (B->capture && pipe2(out, O_CLOEXEC) < 0) {
+        perror("pipe");
+        return -1;
+    }
+
+    fflush(NULL);
+
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        if (B->capture) {
+            close(out[0]);
+            close(out[1]);
+        }
+        return -1;
+    }
+
+    if (pid == 0) {
+        if (job_control_active)
+            setpgid(0, B->pgid);
+
+        /* the input is the shell's (the list of items, usually) */
+        devnull = open("/dev/null", O_RDONLY);
+        dup2(devnull, STDIN_FILENO);
+        close(devnull);
+
+        if (B->capture)
+            dup2(out[1], STDOUT_FILENO);
+
+        exec_child(argv);
+    }
+
+    if (!B->pgid)
+        B->pgid = job_control_active ? pid : getpgrp();
+    if (job_control_active)
+        setpgid(pid, B->pgid);
+
+    if (B->job_id < 0) {
+        B->job_id = add_job(&pid, 1, B->pgid, B->name, FG);
+        if (B->job_id < 0) {
+            kill(pid, SIGKILL);
+            B->stopped = 1;
+        } else {
+            J = find_job_by_job_id(B->job_id);
+            J->open = 1;
+            J->reaped = batch_reaped;
+            J->data = B;
+        }
+    } else {
+        job_add_pid(find_job_by_job_id(B->job_id), pid);
+    }
+
+    P = calloc(1, sizeof(*P));
+    P->pid = pid;
+    P->seq = B->started++;
+    P->out = out[0];
+    if (B->capture)
+        close(out[1]);
+
+    B->procs = realloc(B->procs, (B->nprocs + 1) * sizeof(*B->procs));
+    B->procs[B->nprocs++] = P;
+    B->running++;
+
+    return 0;
+}
+
+
+void batch_finish(Batch *B)
+{
+    Job *J;
+    int i;
+
+    while (B->nprocs && (J = find_job_by_job_id(B->job_id)) && J->status == FG)
+        batch_wait(B);
+
+    J = find_job_by_job_id(B->job_id);
+    if (J) {
+        J->open = 0;
+        J->reaped = NULL;
+        J->data = NULL;
+
+        /* a suspended batch is left to fg and bg, as any other job */
+        if (J->status != STOPPED)
+            remove_job(B->job_id);
+    }
+
+    for (i=0; i<B->nprocs; i++) {
+        if (B->procs[i]->out >= 0)
+            close(B->procs[i]->out);
+        free(B->procs[i]->buf);
+        free(B->procs[i]);
+    }
+
+    free(B->procs);
+    free(B->name);
+    free(B);
+}
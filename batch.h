@@ -0,0 +1,50 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* a set of commands run as one job, at most max of them at a time; the
+ * scheduler behind xargs and parallel */
+
+typedef struct BatchProc {
+    pid_t pid;
+    int seq;             /* # of commands started before this one */
+    int out;             /* read end of its captured stdout, or -1 */
+    char *buf;           /* what it wrote there */
+    size_t len, cap;
+    int status;          /* exit code, once done */
+    int done;
+} BatchProc;
+
+typedef struct Batch {
+    char *name;          /* of the job */
+    int job_id;          /* -1 until the first command starts */
+    pid_t pgid;
+    int max;             /* # of commands in flight at most */
+    int running;
+    int started;
+    int capture;         /* collect the output of each command */
+    int stopped;         /* ^C or ^Z: start nothing more */
+    BatchProc **procs;   /* not collected yet */
+    int nprocs;
+
+    /* called for each command once it is done (and its output is
+     * complete); may take over P->buf by setting it to NULL */
+    void (*collect)(struct Batch *B, BatchProc *P);
+    void *data;          /* for collect() */
+} Batch;
+
+Batch *batch_new(const char *name, int max, int capture,
+                 void (*collect)(Batch *B, BatchProc *P), void *data);
+
+/* starts argv once there is room for it; -1 if the batch was stopped */
+int batch_run(Batch *B, char **argv);
+
+/* waits for the commands still running and frees B */
+void batch_finish(Batch *B);
+
+/* # of CPUs online, the usual default for max */
+int batch_ncpus(void);
+
+#endif
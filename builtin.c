@@ -1,63 +1,143 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
+#include "alias.h"
+#include "batch.h"
 #include "builtin.h"
+#include "deadline.h"
+#include "exec.h"
+#include "hash.h"
 #include "parse.h"
 #include "job_control.h"
+#include "jobserver.h"
+#include "pcache.h"
+#include "queue.h"
+#include "run.h"
+#include "vars.h"
 
-static char *builtin[] = {
-    "exit",   /* exits the shell */
-    "which",  /* displays full path to command */
-    "jobs",   /* list current jobs */
-    "fg",     /* bring job to foreground */
-    "bg",     /* continue job in background */
-    "kill",   /* send signal to job */
-    NULL
+typedef int (*BuiltinFn)(Task T);
+
+typedef struct {
+    const char *name;
+    BuiltinFn fn;
+    int in_subst;   /* may run inside the shell for a $( ) */
+} Builtin;
+
+static int builtin_exit(Task T);
+
+static Builtin builtins[] = {
+    { "exit",     builtin_exit,     0 },  /* exits the shell */
+    { "which",    builtin_which,    1 },  /* displays full path to command */
+    { "jobs",     builtin_jobs,     1 },  /* list current jobs */
+    { "fg",       builtin_fg,       0 },  /* bring job to foreground */
+    { "bg",       builtin_bg,       0 },  /* continue job in background */
+    { "kill",     builtin_kill,     1 },  /* send signal to job */
+    { "break",    builtin_break,    0 },  /* leave the enclosing loop(s) */
+    { "continue", builtin_break,    0 },  /* next pass of the enclosing loop(s) */
+    { "return",   builtin_return,   0 },  /* leave the current function */
+    { "alias",    builtin_alias,    1 },  /* define or list aliases */
+    { "unalias",  builtin_unalias,  0 },  /* remove aliases */
+    { "unset",    builtin_unset,    0 },  /* remove variables or functions */
+    { "set",      builtin_set,      0 },  /* shell options, positional params */
+    { "hash",     builtin_hash,     1 },  /* show or forget remembered paths */
+    { "pcache",   builtin_pcache,   1 },  /* parse cache statistics */
+    { "coproc",   builtin_coproc,   0 },  /* start a coprocess */
+    { "exec",     builtin_exec,     0 },  /* replace the shell, or redirect it */
+    { "xargs",    builtin_xargs,    0 },  /* build and run commands from input */
+    { "parallel", builtin_parallel, 0 },  /* run a command over many inputs */
+    { "jobserver", builtin_jobserver, 0 }, /* share cores with make -j */
+    { "queue",    builtin_queue,    0 },  /* run commands as slots free up */
+    { "timeout",  builtin_timeout,  0 },  /* run a command with a time limit */
+    { "wait",     builtin_wait,     0 },  /* wait for background jobs */
+    { "run",      builtin_run,      0 },  /* run a job in a cgroup, with limits */
+    { "renice",   builtin_renice,   0 },  /* reschedule a running job */
+    { "read",     builtin_read,     0 },  /* read a line into variables */
+    { "mapfile",  builtin_mapfile,  0 },  /* read lines into an array */
+    { "readarray", builtin_mapfile, 0 },  /* same as mapfile */
+    { "echo",     builtin_echo,     1 },  /* print arguments */
+    { "printf",   builtin_printf,   1 },  /* print arguments by a format */
+    { "true",     builtin_true,     1 },  /* succeed */
+    { "false",    builtin_false,    1 },  /* fail */
+    { "test",     builtin_test,     1 },  /* evaluate an expression */
+    { "[",        builtin_test,     1 },  /* same as test, up to a ] */
+    { "pwd",      builtin_pwd,      1 },  /* print the current directory */
+    { "basename", builtin_basename, 1 },  /* strip directory and suffix */
+    { "dirname",  builtin_dirname,  1 },  /* strip the last component */
+    { "sleep",    builtin_sleep,    1 },  /* wait for a while */
+    { "count",    builtin_count,    1 },  /* count lines, words, bytes */
+    { "fgrep",    builtin_fgrep,    1 },  /* lines with a fixed string */
+    { "head",     builtin_head,     1 },  /* the first lines of input */
+    { "tail",     builtin_tail,     1 },  /* the last lines of input */
+    { NULL, NULL, 0 }
 };
 
-int is_builtin(char *cmd)
+static HashTable *builtin_table;
+
+
+static Builtin *find_builtin(const char *cmd)
 {
     int i;
 
-    for (i=0; builtin[i]; i++) {
-        if (!strcmp(cmd, builtin[i]))
-            return 1;
+    if (!builtin_table) {
+        builtin_table = hash_new(NULL);
+        for (i=0; builtins[i].name; i++)
+            hash_put(builtin_table, builtins[i].name, &builtins[i]);
     }
 
-    return 0;
+    return hash_get(builtin_table, cmd);
 }
 
-void builtin_execute(Task T)
-{
-    if (!strcmp(T.cmd, "exit")) {
-        exit(EXIT_SUCCESS);
-    } else if (!strcmp(T.cmd, "which")) {
-        builtin_which(T);
-    } else if (!strcmp(T.cmd, "jobs")) {
-        builtin_jobs(T);
-    } else if (!strcmp(T.cmd, "fg")) {
-        builtin_fg(T);
-    } else if (!strcmp(T.cmd, "bg")) {
-        builtin_bg(T);
-    } else if (!strcmp(T.cmd, "kill")) {
-        builtin_kill(T);
-    } else {
+int is_builtin(char *cmd)
+{
+    return find_builtin(cmd) != NULL;
+}
+
+/* builtins that only print (and do not exit, return, or change what a
+ * subshell would throw away) can produce a $( ) without a fork */
+int is_subst_builtin(char *cmd)
+{
+    Builtin *B = find_builtin(cmd);
+
+    return B && B->in_subst;
+}
+
+int builtin_execute(Task T)
+{
+    Builtin *B = find_builtin(T.cmd);
+
+    if (!B) {
         printf("pssh: builtin command: %s (not implemented!)\n", T.cmd);
+        return 1;
     }
+
+    return B->fn(T);
+}
+
+static int builtin_exit(Task T)
+{
+    exit(T.argv[1] ? atoi(T.argv[1]) : last_status);
 }
 
 int builtin_jobs(Task T) {
-    (void)T;  // Mark parameter as intentionally unused
+    // -v: with pids, and what the job's cgroup has used
+    int verbose = T.argv[1] && !strcmp(T.argv[1], "-v");
     
     // Print active jobs
     int active_jobs = 0;
     for (int i = 0; i < num_jobs; i++) {
         if (jobs[i].status != TERM) {
-            print_job_status(&jobs[i], 0);
+            print_job_status(&jobs[i], verbose);
+            if (verbose)
+                run_print_usage(&jobs[i]);
             active_jobs++;
         }
     }
@@ -100,6 +180,11 @@ int builtin_fg(Task T) {
         printf("pssh: invalid job number: %s\n", T.argv[1]);
         return 1;
     }
+
+    if (job->status == QUEUED) {
+        printf("pssh: %s: job is queued\n", T.argv[1]);
+        return 1;
+    }
     
     put_job_in_foreground(job, 1);
     return 0;
@@ -122,6 +207,11 @@ int builtin_bg(Task T) {
         printf("pssh: invalid job number: %s\n", T.argv[1]);
         return 1;
     }
+
+    if (job->status == QUEUED) {
+        printf("pssh: %s: job is queued\n", T.argv[1]);
+        return 1;
+    }
     
     put_job_in_background(job, 1);
     return 0;
@@ -157,8 +247,14 @@ int builtin_kill(Task T) {
                 printf("pssh: invalid job number: %s\n", T.argv[i]);
                 continue;
             }
+
+            // a queued job has nothing to signal: it is cancelled
+            if (job->status == QUEUED) {
+                remove_job(job_id);
+                continue;
+            }
             
-            if (killpg(job->pgid, sig) < 0) {
+            if (job_kill(job, sig) < 0) {
                 perror("kill");
             }
         } else {
@@ -180,44 +276,1948 @@ int builtin_kill(Task T) {
 }
 
 /*
- * builtin_which - implements the built-in which command.
+ * builtin_break - implements break [n] and continue [n].  The loops
+ * notice the request once the current command returns.
  */
-int builtin_which(Task T)
+int builtin_break(Task T)
+{
+    int n = 1;
+
+    if (!loop_depth)
+        return 0;
+
+    if (T.argv[1]) {
+        n = atoi(T.argv[1]);
+        if (n < 1) {
+            printf("pssh: %s: %s: loop count out of range\n", T.cmd, T.argv[1]);
+            return 1;
+        }
+    }
+
+    if (n > loop_depth)
+        n = loop_depth;
+
+    if (!strcmp(T.cmd, "break"))
+        loop_break = n;
+    else
+        loop_continue = n;
+
+    return 0;
+}
+
+/*
+ * builtin_return - implements return [n]
+ */
+int builtin_return(Task T)
+{
+    if (!func_depth) {
+        printf("pssh: return: can only `return' from a function\n");
+        return 1;
+    }
+
+    func_return = 1;
+
+    return T.argv[1] ? atoi(T.argv[1]) : last_status;
+}
+
+/*
+ * builtin_alias - implements alias [name[=value] ...]
+ */
+int builtin_alias(Task T)
 {
+    char *eq, *name;
+    int i, ret = 0;
+
     if (!T.argv[1]) {
-         fprintf(stdout, "usage: which command\n");
-         return 1;
+        alias_print_all();
+        return 0;
     }
-    char *prog = T.argv[1];
 
-    if (strchr(prog, '/') != NULL) {
-         if (access(prog, X_OK) == 0)
-              printf("%s\n", prog);
-         return 0;
+    for (i=1; T.argv[i]; i++) {
+        eq = strchr(T.argv[i], '=');
+        if (!eq) {
+            if (alias_get(T.argv[i])) {
+                alias_print(T.argv[i]);
+            } else {
+                printf("pssh: alias: %s: not found\n", T.argv[i]);
+                ret = 1;
+            }
+            continue;
+        }
+
+        name = strndup(T.argv[i], eq - T.argv[i]);
+        alias_set(name, eq + 1);
+        free(name);
     }
 
-    for (int i = 0; builtin[i] != NULL; i++) {
-         if (!strcmp(prog, builtin[i])) {
-              printf("%s: shell built-in command\n", prog);
-              return 0;
-         }
+    return ret;
+}
+
+/*
+ * builtin_unalias - implements unalias name ...
+ */
+int builtin_unalias(Task T)
+{
+    int i, ret = 0;
+
+    if (!T.argv[1]) {
+        printf("Usage: unalias name [name ...]\n");
+        return 1;
     }
 
-    char *path_env = getenv("PATH");
-    if (!path_env)
-         return 1;
-    char *path_dup = strdup(path_env);
-    char *dir, *saveptr = NULL;
-    char fullpath[PATH_MAX];
-    for (dir = strtok_r(path_dup, ":", &saveptr); dir != NULL;
-         dir = strtok_r(NULL, ":", &saveptr)) {
-         snprintf(fullpath, sizeof(fullpath), "%s/%s", dir, prog);
-         if (access(fullpath, X_OK) == 0) {
-              printf("%s\n", fullpath);
-              free(path_dup);
-              return 0;
-         }
+    for (i=1; T.argv[i]; i++) {
+        if (!alias_unset(T.argv[i])) {
+            printf("pssh: unalias: %s: not found\n", T.argv[i]);
+            ret = 1;
+        }
     }
-    free(path_dup);
+
+    return ret;
+}
+
+/*
+ * builtin_unset - implements unset [-f | -v] name ...
+ */
+int builtin_unset(Task T)
+{
+    int i = 1, funcs = 0;
+
+    if (T.argv[1] && (!strcmp(T.argv[1], "-f") || !strcmp(T.argv[1], "-v"))) {
+        funcs = T.argv[1][1] == 'f';
+        i++;
+    }
+
+    for (; T.argv[i]; i++) {
+        if (funcs)
+            function_unset(T.argv[i]);
+        else
+            var_unset(T.argv[i]);
+    }
+
+    return 0;
+}
+
+/*
+ * builtin_set - implements
+ *   set [-x | +x] [-o option | +o option] ... [--] [arg ...]
+ *
+ * Turns shell options on (-) or off (+); set -o alone lists them.  Any
+ * args (all words after --) become the positional parameters.
+ */
+int builtin_set(Task T)
+{
+    static const struct { const char *name; char letter; int *flag; } options[] = {
+        { "optimize", 0,   &opt_optimize },
+        { "xtrace",   'x', &opt_xtrace },
+    };
+    int n = sizeof(options) / sizeof(options[0]);
+    int i, k, on;
+
+    for (i=1; T.argv[i]; i++) {
+        if (!strcmp(T.argv[i], "--")) {
+            i++;
+            break;
+        }
+        if ((T.argv[i][0] != '-' && T.argv[i][0] != '+') || !T.argv[i][1])
+            break;
+
+        on = T.argv[i][0] == '-';
+
+        if (!strcmp(T.argv[i] + 1, "o")) {
+            if (!T.argv[i+1]) {
+                for (k=0; k<n; k++)
+                    printf("%-10s %s\n", options[k].name, *options[k].flag ? "on" : "off");
+                return 0;
+            }
+            i++;
+            for (k=0; k<n && strcmp(T.argv[i], options[k].name); k++)
+                ;
+            if (k == n) {
+                printf("pssh: set: %s: invalid option name\n", T.argv[i]);
+                return 2;
+            }
+            *options[k].flag = on;
+            continue;
+        }
+
+        for (const char *c = T.argv[i] + 1; *c; c++) {
+            for (k=0; k<n && options[k].letter != *c; k++)
+                ;
+            if (k == n) {
+                printf("pssh: set: %c%c: invalid option\n", T.argv[i][0], *c);
+                printf("Usage: set [-x | +x] [-o option | +o option] [--] [arg ...]\n");
+                return 2;
+            }
+            *options[k].flag = on;
+        }
+    }
+
+    if (T.argv[i] || (i > 1 && !strcmp(T.argv[i-1], "--"))) {
+        for (k=i; T.argv[k]; k++)
+            ;
+        var_set_positional(T.argv + i, k - i);
+    }
+
+    return 0;
+}
+
+/*
+ * builtin_hash - implements hash [-r] [name ...]: lists the remembered
+ * command paths, forgets them all (-r) or looks names up ahead of time
+ */
+int builtin_hash(Task T)
+{
+    int i, ret = 0;
+
+    if (!T.argv[1]) {
+        path_cache_print();
+        return 0;
+    }
+
+    if (!strcmp(T.argv[1], "-r")) {
+        path_cache_clear();
+        return 0;
+    }
+
+    for (i=1; T.argv[i]; i++) {
+        if (!path_lookup(T.argv[i])) {
+            printf("pssh: hash: %s: not found\n", T.argv[i]);
+            ret = 1;
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * builtin_pcache - implements pcache [-r]: shows the hits and misses of
+ * the parse cache, or empties it (-r)
+ */
+int builtin_pcache(Task T)
+{
+    if (T.argv[1] && !strcmp(T.argv[1], "-r")) {
+        pcache_clear();
+        return 0;
+    }
+
+    if (T.argv[1]) {
+        printf("Usage: pcache [-r]\n");
+        return 1;
+    }
+
+    pcache_print();
+
+    return 0;
+}
+
+/*
+ * builtin_exec - implements exec [command [args ...]].  Its redirections
+ * have already been applied to the shell itself by execute_tasks().
+ */
+int builtin_exec(Task T)
+{
+    const char *path;
+
+    if (!T.argv[1])
+        return 0;
+
+    path = strchr(T.argv[1], '/') ? T.argv[1] : path_lookup(T.argv[1]);
+    if (!path) {
+        printf("pssh: exec: %s: not found\n", T.argv[1]);
+        return 127;
+    }
+
+    fflush(NULL);
+    child_reset_signals();
+    execv(path, T.argv + 1);
+
+    /* past the point of return: the shell's signal handling is gone */
+    fprintf(stderr, "pssh: exec: %s: %s\n", T.argv[1], strerror(errno));
+    exit(126);
+}
+
+/*
+ * builtin_coproc - implements coproc [NAME] command [args ...]
+ *
+ * The command runs as a background job connected to the shell by two
+ * pipes: ${NAME[0]} reads its output and ${NAME[1]} writes its input
+ * (e.g. read -u ${NAME[0]}), and NAME_PID holds its pid.  NAME is
+ * COPROC when the command is a single word; it is required otherwise.
+ */
+int builtin_coproc(Task T)
+{
+    const char *name = "COPROC";
+    char **argv = T.argv + 1, *elems[2], buf[2][16], *pidvar;
+    const char *old;
+    int fds[2], i;
+
+    if (!argv[0]) {
+        printf("Usage: coproc [NAME] command [args ...]\n");
+        return 1;
+    }
+
+    if (argv[1]) {
+        name = *argv++;
+        if (!var_name_valid(name, strlen(name))) {
+            printf("pssh: coproc: `%s': not a valid identifier\n", name);
+            return 1;
+        }
+    }
+
+    pidvar = malloc(strlen(name) + 5);
+    sprintf(pidvar, "%s_PID", name);
+
+    /* a coprocess started before under the same name is forgotten */
+    if (var_get(pidvar))
+        for (i=0; i<2; i++)
+            if ((old = var_get_elem(name, i)))
+                close(atoi(old));
+
+    if (coproc_start(argv, fds) < 0) {
+        free(pidvar);
+        return 1;
+    }
+
+    for (i=0; i<2; i++) {
+        snprintf(buf[i], sizeof(buf[i]), "%d", fds[i]);
+        elems[i] = buf[i];
+    }
+    var_set_array(name, elems, 2);
+    var_set_int(pidvar, last_bg_pid);
+    free(pidvar);
+
     return 0;
-}
\ No newline at end of file
+}
+
+/*
+ * Input of read and mapfile is buffered per fd, so that a loop over the
+ * lines of a file costs a memchr() per line rather than a read(2) per
+ * byte.  On a regular file the offset is put back to the end of the
+ * last line consumed, so whatever reads the file next (another command
+ * or a later redirection) starts in the right place, and the buffer is
+ * reused as long as nothing else moved the offset.  Nothing can be put
+ * back into a pipe, so there only what a record needs is taken: what
+ * the pipe holds is looked at with tee(2), which leaves it in place,
+ * and then just as much as reaches the delimiter is read.  Terminals and
+ * the like are read a byte at a time.  mapfile without a count, xargs
+ * and parallel, which take everything anyway, read ahead on any input.
+ */
+#define READ_CHUNK 65536
+
+typedef struct {
+    char *buf;
+    size_t pos, len, cap;   /* buf[pos..len) is still unread */
+    dev_t dev;
+    ino_t ino;
+    off_t off;              /* regular files: the offset of buf[pos] */
+} ReadBuf;
+
+static ReadBuf *readbufs;
+static int nreadbufs;
+
+
+/* the buffer for fd, emptied if fd no longer refers to what was read */
+static ReadBuf *readbuf_get(int fd)
+{
+    struct stat st;
+    ReadBuf *RB;
+    off_t off = -1;
+
+    if (fd < 0 || fstat(fd, &st) < 0)
+        return NULL;
+
+    if (fd >= nreadbufs) {
+        readbufs = realloc(readbufs, (fd + 1) * sizeof(*readbufs));
+        memset(readbufs + nreadbufs, 0, (fd + 1 - nreadbufs) * sizeof(*readbufs));
+        nreadbufs = fd + 1;
+    }
+
+    RB = &readbufs[fd];
+
+    if (S_ISREG(st.st_mode))
+        off = lseek(fd, 0, SEEK_CUR);
+
+    if (RB->dev != st.st_dev || RB->ino != st.st_ino || RB->off != off) {
+        RB->pos = RB->len = 0;
+        RB->dev = st.st_dev;
+        RB->ino = st.st_ino;
+        RB->off = off;
+    }
+
+    return RB;
+}
+
+
+/* takes what the next record needs from an fd that cannot seek, into
+ * buf (of room bytes); returns the # of bytes, 0 at end of input */
+static ssize_t read_exact(int fd, char delim, char *buf, size_t room)
+{
+    static int peek[2] = { -1, -1 };
+    size_t got = 0, want;
+    ssize_t n, r;
+    char *end;
+
+    if (peek[0] < 0 && pipe2(peek, O_CLOEXEC) < 0)
+        peek[0] = peek[1] = -1;
+
+    do
+        n = peek[1] < 0 ? -1 : tee(fd, peek[1], room, 0);
+    while (n < 0 && errno == EINTR);
+
+    /* not a pipe */
+    if (n < 0) {
+        do
+            n = read(fd, buf, 1);
+        while (n < 0 && errno == EINTR);
+        return n;
+    }
+
+    while (got < (size_t)n) {
+        r = read(peek[0], buf + got, n - got);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            break;
+        got += r;
+    }
+
+    /* what could not be taken back out would spoil the next look */
+    if (got < (size_t)n) {
+        close(peek[0]);
+        close(peek[1]);
+        peek[0] = peek[1] = -1;
+    }
+
+    end = memchr(buf, delim, got);
+    want = end ? (size_t)(end + 1 - buf) : got;
+
+    /* the same bytes again, this time out of the pipe for good */
+    for (got = 0; got < want; got += r) {
+        r = read(fd, buf + got, want - got);
+        if (r < 0 && errno == EINTR)
+            r = 0;
+        else if (r <= 0)
+            return got ? (ssize_t)got : r;
+    }
+
+    return got;
+}
+
+
+/* reads another chunk, or with exact only up to the next delim if fd
+ * cannot seek; returns 0 at end of input, -1 on error */
+static ssize_t readbuf_fill(ReadBuf *RB, int fd, char delim, int exact)
+{
+    ssize_t n;
+
+    if (RB->pos) {
+        memmove(RB->buf, RB->buf + RB->pos, RB->len - RB->pos);
+        RB->len -= RB->pos;
+        RB->pos = 0;
+    }
+
+    if (RB->cap - RB->len < READ_CHUNK) {
+        RB->cap = RB->cap ? RB->cap * 2 : READ_CHUNK;
+        RB->buf = realloc(RB->buf, RB->cap);
+    }
+
+    if (RB->off >= 0)
+        lseek(fd, RB->off + RB->len, SEEK_SET);
+
+    if (exact && RB->off < 0)
+        n = read_exact(fd, delim, RB->buf + RB->len, RB->cap - RB->len);
+    else
+        do
+            n = read(fd, RB->buf + RB->len, RB->cap - RB->len);
+        while (n < 0 && errno == EINTR);
+
+    if (n > 0)
+        RB->len += n;
+
+    return n;
+}
+
+
+/* the next record ending in delim, at *rec with its length (without
+ * the delimiter) in *len; returns 1 if it ended in delim, 0 if input
+ * ended first (*len may still be nonzero) and -1 on a read error.
+ * exact: nothing past the record is taken from a pipe (see above) */
+static int readbuf_record(ReadBuf *RB, int fd, char delim, int exact,
+                          char **rec, size_t *len)
+{
+    size_t scanned = 0;
+    char *end;
+    ssize_t n;
+
+    for (;;) {
+        end = memchr(RB->buf + RB->pos + scanned, delim, RB->len - RB->pos - scanned);
+        if (end) {
+            *rec = RB->buf + RB->pos;
+            *len = end - *rec;
+            RB->pos += *len + 1;
+            if (RB->off >= 0)
+                RB->off += *len + 1;
+            return 1;
+        }
+
+        scanned = RB->len - RB->pos;
+        n = readbuf_fill(RB, fd, delim, exact);
+        if (n <= 0) {
+            *rec = RB->buf + RB->pos;
+            *len = scanned;
+            RB->pos = RB->len;
+            if (RB->off >= 0)
+                RB->off += scanned;
+            return n < 0 ? -1 : 0;
+        }
+    }
+}
+
+
+/* puts the offset of a regular file back to the end of what was used */
+static void readbuf_sync(ReadBuf *RB, int fd)
+{
+    if (RB->off >= 0)
+        lseek(fd, RB->off, SEEK_SET);
+}
+
+
+/* removes backslashes, keeping the characters they escape */
+static void unescape(char *s)
+{
+    char *p = s;
+
+    for (; *s; s++) {
+        if (*s == '\\' && s[1])
+            s++;
+        *p++ = *s;
+    }
+    *p = '\0';
+}
+
+
+/* splits line at the characters of ifs among names, the last of them
+ * taking the rest of the line; or into the elements of array */
+static void read_assign(char *line, char **names, const char *array, const char *ifs)
+{
+    char **fields = NULL, *p = line, *end;
+    int n = 0, last;
+
+#define IS_IFS_WS(c) ((c) && strchr(ifs, (c)) && isspace((unsigned char)(c)))
+
+    while (IS_IFS_WS(*p))
+        p++;
+
+    for (;;) {
+        last = !array && (!names[n] || !names[n+1]);
+        if (!*p && (array || names[n]))
+            break;
+
+        if (last) {
+            end = p + strlen(p);
+            while (end > p && IS_IFS_WS(end[-1]))
+                end--;
+        } else {
+            end = p;
+            while (*end && !strchr(ifs, *end))
+                end++;
+        }
+
+        fields = realloc(fields, (n + 1) * sizeof(*fields));
+        fields[n++] = strndup(p, end - p);
+
+        if (last || !*end)
+            break;
+
+        /* one separator, with the IFS whitespace around it */
+        p = end;
+        while (IS_IFS_WS(*p))
+            p++;
+        if (*p && strchr(ifs, *p) && !isspace((unsigned char)*p))
+            for (p++; IS_IFS_WS(*p); p++);
+    }
+
+#undef IS_IFS_WS
+
+    if (array) {
+        var_set_array(array, fields, n);
+    } else {
+        for (last=0; names[last]; last++)
+            var_set(names[last], last < n ? fields[last] : "");
+    }
+
+    while (n--)
+        free(fields[n]);
+    free(fields);
+}
+
+
+/* the value of a single-character option such as -d x or -dx */
+static const char *opt_arg(Task T, int *i)
+{
+    if (T.argv[*i][2])
+        return &T.argv[*i][2];
+
+    if (!T.argv[*i + 1]) {
+        printf("pssh: %s: %s: option requires an argument\n", T.cmd, T.argv[*i]);
+        return NULL;
+    }
+
+    return T.argv[++*i];
+}
+
+
+/*
+ * builtin_read - implements
+ *   read [-r] [-a array] [-d delim] [-p prompt] [-u fd] [name ...]
+ */
+int builtin_read(Task T)
+{
+    const char *array = NULL, *prompt = NULL, *arg, *ifs;
+    char *names_default[] = { "REPLY", NULL };
+    char **names, *rec, *line = NULL, delim = '\n', opt;
+    size_t len, total = 0;
+    int i, fd = STDIN_FILENO, raw = 0, ret;
+    ReadBuf *RB;
+
+    for (i=1; T.argv[i] && T.argv[i][0] == '-' && T.argv[i][1]; i++) {
+        if (!strcmp(T.argv[i], "--")) {
+            i++;
+            break;
+        }
+
+        opt = T.argv[i][1];
+        if (opt == 'r') {
+            raw = 1;
+            continue;
+        }
+
+        if (!strchr("adpu", opt)) {
+            printf("pssh: read: %s: invalid option\n", T.argv[i]);
+            return 2;
+        }
+
+        if (!(arg = opt_arg(T, &i)))
+            return 2;
+
+        switch (opt) {
+        case 'a':
+            array = arg;
+            break;
+        case 'd':
+            delim = *arg;
+            break;
+        case 'p':
+            prompt = arg;
+            break;
+        case 'u':
+            fd = atoi(arg);
+            break;
+        }
+    }
+
+    names = T.argv[i] ? &T.argv[i] : names_default;
+    for (; T.argv[i]; i++) {
+        if (!var_name_valid(T.argv[i], strlen(T.argv[i]))) {
+            printf("pssh: read: `%s': not a valid identifier\n", T.argv[i]);
+            return 1;
+        }
+    }
+
+    RB = readbuf_get(fd);
+    if (!RB) {
+        printf("pssh: read: %d: invalid file descriptor\n", fd);
+        return 1;
+    }
+
+    if (prompt && isatty(fd)) {
+        fputs(prompt, stderr);
+        fflush(stderr);
+    }
+
+    /* without -r, a backslash before the delimiter continues the line */
+    for (;;) {
+        ret = readbuf_record(RB, fd, delim, 1, &rec, &len);
+        line = realloc(line, total + len + 1);
+        memcpy(line + total, rec, len);
+        total += len;
+        line[total] = '\0';
+
+        if (raw || ret != 1 || !total || line[total-1] != '\\')
+            break;
+        line[--total] = '\0';
+    }
+
+    readbuf_sync(RB, fd);
+
+    if (ret < 0) {
+        printf("pssh: read: %s\n", strerror(errno));
+        free(line);
+        return 1;
+    }
+
+    if (!raw)
+        unescape(line);
+
+    ifs = var_get("IFS");
+    if (!ifs)
+        ifs = " \t\n";
+
+    if (names == names_default && !array)
+        var_set("REPLY", line);
+    else
+        read_assign(line, names, array, ifs);
+
+    free(line);
+
+    /* end of input is failure even if a last, unterminated line was read */
+    return ret == 1 ? 0 : 1;
+}
+
+
+/*
+ * builtin_mapfile - implements
+ *   mapfile [-t] [-d delim] [-n count] [-s count] [-u fd] [array]
+ */
+int builtin_mapfile(Task T)
+{
+    const char *array = "MAPFILE", *arg;
+    char **elems = NULL, *rec, delim = '\n', opt;
+    long count = 0, skip = 0, n = 0;
+    int i, fd = STDIN_FILENO, trim = 0, ret;
+    size_t len;
+    ReadBuf *RB;
+
+    for (i=1; T.argv[i] && T.argv[i][0] == '-' && T.argv[i][1]; i++) {
+        opt = T.argv[i][1];
+        if (opt == 't') {
+            trim = 1;
+            continue;
+        }
+
+        if (!strchr("dnsu", opt)) {
+            printf("pssh: %s: %s: invalid option\n", T.cmd, T.argv[i]);
+            return 2;
+        }
+
+        if (!(arg = opt_arg(T, &i)))
+            return 2;
+
+        switch (opt) {
+        case 'd':
+            delim = *arg;
+            break;
+        case 'n':
+            count = atol(arg);
+            break;
+        case 's':
+            skip = atol(arg);
+            break;
+        case 'u':
+            fd = atoi(arg);
+            break;
+        }
+    }
+
+    if (T.argv[i]) {
+        array = T.argv[i];
+        if (!var_name_valid(array, strlen(array))) {
+            printf("pssh: %s: `%s': not a valid identifier\n", T.cmd, array);
+            return 1;
+        }
+    }
+
+    RB = readbuf_get(fd);
+    if (!RB) {
+        printf("pssh: %s: %d: invalid file descriptor\n", T.cmd, fd);
+        return 1;
+    }
+
+    while (!count || n < count) {
+        ret = readbuf_record(RB, fd, delim, count > 0, &rec, &len);
+        if (ret < 0 || (ret == 0 && !len))
+            break;
+
+        if (skip > 0) {
+            skip--;
+            continue;
+        }
+
+        elems = realloc(elems, (n + 1) * sizeof(*elems));
+        elems[n] = malloc(len + 2);
+        memcpy(elems[n], rec, len);
+        if (!trim && ret == 1)
+            elems[n][len++] = delim;
+        elems[n][len] = '\0';
+        n++;
+
+        if (ret == 0)
+            break;
+    }
+
+    readbuf_sync(RB, fd);
+    var_set_array(array, elems, n);
+
+    while (n--)
+        free(elems[n]);
+    free(elems);
+
+    return 0;
+}
+
+
+/*
+ * builtin_which - implements the built-in which command.
+ */
+int builtin_which(Task T)
+{
+    if (!T.argv[1]) {
+         fprintf(stdout, "usage: which command\n");
+         return 1;
+    }
+    char *prog = T.argv[1];
+
+    if (strchr(prog, '/') != NULL) {
+         if (access(prog, X_OK) == 0)
+              printf("%s\n", prog);
+         return 0;
+    }
+
+    if (alias_get(prog)) {
+         printf("%s: aliased to %s\n", prog, alias_get(prog));
+         return 0;
+    }
+
+    if (function_get(prog)) {
+         printf("%s: shell function\n", prog);
+         return 0;
+    }
+
+    if (is_builtin(prog)) {
+         printf("%s: shell built-in command\n", prog);
+         return 0;
+    }
+
+    char *path_env = getenv("PATH");
+    if (!path_env)
+         return 1;
+    char *path_dup = strdup(path_env);
+    char *dir, *saveptr = NULL;
+    char fullpath[PATH_MAX];
+    for (dir = strtok_r(path_dup, ":", &saveptr); dir != NULL;
+         dir = strtok_r(NULL, ":", &saveptr)) {
+         snprintf(fullpath, sizeof(fullpath), "%s/%s", dir, prog);
+         if (access(fullpath, X_OK) == 0) {
+              printf("%s\n", fullpath);
+              free(path_dup);
+              return 0;
+         }
+    }
+    free(path_dup);
+    return 0;
+}
+
+/* argv joined by spaces, e.g. to name a job */
+static char *join_args(char **argv)
+{
+    size_t len = 1;
+    char *s;
+    int i;
+
+    for (i=0; argv[i]; i++)
+        len += strlen(argv[i]) + 1;
+
+    s = malloc(len);
+    s[0] = '\0';
+    for (i=0; argv[i]; i++) {
+        if (i)
+            strcat(s, " ");
+        strcat(s, argv[i]);
+    }
+
+    return s;
+}
+
+/* the command of queue, timeout and run as shell text: -e text, on its
+ * own; NULL if the command is given as words */
+static const char *shell_text(char **argv)
+{
+    return argv[0] && !strcmp(argv[0], "-e") && argv[1] && !argv[2] ? argv[1] : NULL;
+}
+
+int builtin_job(Task T)
+{
+    char *text;
+    int status;
+
+    /* in a job already (a pipeline stage, a subshell), or with stdout
+     * held in memory for a $( ) */
+    if (!job_control_active || fileno(stdout) != STDOUT_FILENO)
+        return -1;
+
+    text = join_args(T.argv);
+    status = execute_argv(T.argv, text, 0);
+    free(text);
+
+    return status;
+}
+
+int builtin_program(Task T)
+{
+    const char *path = path_lookup(T.argv[0]);
+    char **argv, *text, buf[8192];
+    int i, status, saved = -1, mem = -1;
+    ssize_t n;
+
+    if (!path)
+        return -1;
+
+    /* by its full name, so that it is not taken for the builtin again */
+    for (i=0; T.argv[i]; i++)
+        ;
+    argv = malloc((i + 1) * sizeof(char *));
+    memcpy(argv, T.argv, (i + 1) * sizeof(char *));
+    argv[0] = (char *)path;
+
+    /* a stage of its own: the program takes the process over, so that
+     * killing the job kills it */
+    if (builtin_stage && fileno(stdout) == STDOUT_FILENO) {
+        fflush(stdout);
+        child_reset_signals();
+        execv(path, argv);
+    }
+
+    /* in a $( ), stdout is held in memory: the program's output is
+     * caught in a file, and copied there after */
+    fflush(stdout);
+    if (fileno(stdout) != STDOUT_FILENO &&
+        (mem = memfd_create("pssh-subst", 0)) >= 0) {
+        saved = dup(STDOUT_FILENO);
+        dup2(mem, STDOUT_FILENO);
+    }
+
+    text = join_args(T.argv);
+    status = execute_argv(argv, text, 0);
+    free(text);
+    free(argv);
+
+    if (mem >= 0) {
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+        lseek(mem, 0, SEEK_SET);
+        while ((n = read(mem, buf, sizeof buf)) > 0)
+            fwrite(buf, 1, n, stdout);
+        close(mem);
+    }
+
+    return status;
+}
+
+/* room for arguments in an exec: ARG_MAX less what the environment
+ * takes, and the customary 2K of headroom */
+static size_t arg_space(void)
+{
+    extern char **environ;
+    long max = sysconf(_SC_ARG_MAX);
+    size_t env = 0;
+    char **e;
+
+    if (max <= 0)
+        max = 131072;
+
+    for (e=environ; *e; e++)
+        env += strlen(*e) + 1 + sizeof(char *);
+
+    return (size_t)max > env + 4096 ? max - env - 2048 : 2048;
+}
+
+/* xargs status: 123 if any command failed, 124 if one exited with 255
+ * (which stops the run), 125 if one was killed */
+static void xargs_collect(Batch *B, BatchProc *P)
+{
+    int *ret = B->data;
+
+    if (P->status == 255) {
+        *ret = 124;
+        B->stopped = 1;
+    } else if (P->status > 128 && *ret < 125) {
+        *ret = 125;
+    } else if (P->status && *ret < 123) {
+        *ret = 123;
+    }
+}
+
+/* substitutes item for every occurrence of repl in the words */
+static char **xargs_replace(char **words, int n, const char *repl, const char *item)
+{
+    char **argv = malloc((n + 1) * sizeof(*argv)), *p, *hit;
+    size_t rlen = strlen(repl), ilen = strlen(item), len;
+    int i, k;
+
+    for (i=0; i<n; i++) {
+        for (k=0, p=words[i]; (hit = strstr(p, repl)); p=hit+rlen)
+            k++;
+        len = strlen(words[i]) + k * ilen + 1;
+        argv[i] = malloc(len);
+        argv[i][0] = '\0';
+        for (p=words[i]; (hit = strstr(p, repl)); p=hit+rlen) {
+            strncat(argv[i], p, hit - p);
+            strcat(argv[i], item);
+        }
+        strcat(argv[i], p);
+    }
+    argv[n] = NULL;
+
+    return argv;
+}
+
+/*
+ * builtin_xargs - implements
+ *   xargs [-0] [-d delim] [-a file] [-n max-args] [-P procs] [-I repl]
+ *         [command [initial-args ...]]
+ *
+ * Items are separated by blanks and newlines (quotes have no meaning),
+ * by NULs with -0 or by delim with -d.  They are packed into as few
+ * commands as ARG_MAX allows, less the environment, unless -n or -I
+ * says otherwise.  Up to procs of them run at once (-P 0: one per CPU),
+ * all as a single job.
+ */
+int builtin_xargs(Task T)
+{
+    const char *repl = NULL, *file = NULL, *arg;
+    char *default_cmd[] = { "echo", NULL }, **cmd, **argv, **run;
+    char *rec, delim = '\n', opt;
+    int i, k, ncmd, nargs = 0, maxargs = 0, procs = 1, blanks = 1, fd = STDIN_FILENO;
+    int ret = 0, more = 1, r;
+    size_t space, used, base = 0, len, pos, end;
+    ReadBuf *RB;
+    Batch *B;
+    char *name;
+
+    for (i=1; T.argv[i] && T.argv[i][0] == '-' && T.argv[i][1]; i++) {
+        opt = T.argv[i][1];
+        if (opt == '-') {
+            i++;
+            break;
+        }
+
+        if (opt == '0') {
+            delim = '\0';
+            blanks = 0;
+            continue;
+        }
+
+        if (!strchr("danPI", opt)) {
+            printf("pssh: xargs: %s: invalid option\n", T.argv[i]);
+            return 2;
+        }
+
+        if (!(arg = opt_arg(T, &i)))
+            return 2;
+
+        switch (opt) {
+        case 'd':
+            delim = *arg;
+            blanks = 0;
+            break;
+        case 'a':
+            file = arg;
+            break;
+        case 'n':
+            maxargs = atoi(arg);
+            break;
+        case 'P':
+            procs = atoi(arg) > 0 ? atoi(arg) : batch_ncpus();
+            break;
+        case 'I':
+            repl = arg;
+            break;
+        }
+    }
+
+    cmd = T.argv[i] ? &T.argv[i] : default_cmd;
+    for (ncmd=0; cmd[ncmd]; ncmd++);
+
+    if (!function_get(cmd[0]) && !command_found(cmd[0])) {
+        printf("pssh: xargs: %s: command not found\n", cmd[0]);
+        return 127;
+    }
+
+    if (file && (fd = open(file, O_RDONLY | O_CLOEXEC)) < 0) {
+        printf("pssh: xargs: %s: %s\n", file, strerror(errno));
+        return 1;
+    }
+
+    RB = readbuf_get(fd);
+    if (!RB) {
+        printf("pssh: xargs: %d: invalid file descriptor\n", fd);
+        return 1;
+    }
+
+    space = arg_space();
+    for (k=0; k<ncmd; k++)
+        base += strlen(cmd[k]) + 1 + sizeof(char *);
+
+    name = join_args(T.argv);
+    B = batch_new(name, procs, 0, xargs_collect, &ret);
+    free(name);
+
+    argv = malloc((ncmd + 1) * sizeof(*argv));
+    memcpy(argv, cmd, ncmd * sizeof(*argv));
+    used = base;
+
+    while (more && !B->stopped) {
+        r = readbuf_record(RB, fd, delim, 0, &rec, &len);
+        if (r < 0 || (r == 0 && !len))
+            more = 0;
+
+        /* each record holds one item, or several separated by blanks */
+        for (pos=0; more && pos<len; pos=end) {
+            if (blanks) {
+                while (pos < len && (rec[pos] == ' ' || rec[pos] == '\t'))
+                    pos++;
+                if (pos == len)
+                    break;
+                for (end=pos; end<len && rec[end] != ' ' && rec[end] != '\t'; end++);
+                if (repl)
+                    end = len;  /* -I takes whole lines */
+            } else {
+                end = len;
+            }
+
+            if (repl) {
+                char *item = strndup(rec + pos, end - pos);
+
+                run = xargs_replace(cmd, ncmd, repl, item);
+                free(item);
+                batch_run(B, run);
+                for (k=0; k<ncmd; k++)
+                    free(run[k]);
+                free(run);
+                break;
+            }
+
+            /* the batch so far goes first if this item does not fit */
+            if (nargs && (used + (end - pos) + 1 + sizeof(char *) > space ||
+                          (maxargs && nargs >= maxargs))) {
+                argv[ncmd + nargs] = NULL;
+                batch_run(B, argv);
+                for (k=0; k<nargs; k++)
+                    free(argv[ncmd + k]);
+                nargs = 0;
+                used = base;
+            }
+
+            argv = realloc(argv, (ncmd + nargs + 2) * sizeof(*argv));
+            argv[ncmd + nargs++] = strndup(rec + pos, end - pos);
+            used += (end - pos) + 1 + sizeof(char *);
+
+            if (!blanks)
+                break;
+        }
+
+        if (r != 1)
+            more = 0;
+    }
+
+    if (nargs && !B->stopped) {
+        argv[ncmd + nargs] = NULL;
+        batch_run(B, argv);
+    }
+    for (k=0; k<nargs; k++)
+        free(argv[ncmd + k]);
+    free(argv);
+
+    readbuf_sync(RB, fd);
+    if (file) {
+        RB->pos = RB->len = 0;
+        close(fd);
+    }
+
+    batch_finish(B);
+
+    return job_interrupted ? 130 : ret;
+}
+
+
+/* parallel's state, kept for its collect callback */
+typedef struct {
+    char **inputs;
+    int ninputs;
+    int tag;              /* --tag: each line of output after its input */
+    int keep;             /* --keep-order: output in the order of inputs */
+    char **outs;          /* --keep-order: output held back, by seq */
+    size_t *lens;
+    int *status;          /* exit code of each input's command, or -1 */
+    int next;             /* next output due with --keep-order */
+} Parallel;
+
+
+static void parallel_emit(Parallel *Par, int seq, const char *buf, size_t len)
+{
+    const char *line, *nl;
+
+    if (!Par->tag) {
+        fwrite(buf, 1, len, stdout);
+    } else {
+        for (line=buf; line<buf+len; line=nl+1) {
+            nl = memchr(line, '\n', buf + len - line);
+            if (!nl)
+                nl = buf + len;
+            printf("%s\t%.*s\n", Par->inputs[seq], (int)(nl - line), line);
+        }
+    }
+
+    fflush(stdout);
+}
+
+
+static void parallel_collect(Batch *B, BatchProc *P)
+{
+    Parallel *Par = B->data;
+
+    Par->status[P->seq] = P->status;
+
+    if (!Par->keep) {
+        parallel_emit(Par, P->seq, P->buf, P->len);
+        return;
+    }
+
+    Par->outs[P->seq] = P->buf;
+    Par->lens[P->seq] = P->len;
+    P->buf = NULL;
+
+    while (Par->next < Par->ninputs && Par->status[Par->next] >= 0) {
+        parallel_emit(Par, Par->next, Par->outs[Par->next], Par->lens[Par->next]);
+        free(Par->outs[Par->next]);
+        Par->outs[Par->next++] = NULL;
+    }
+}
+
+
+/*
+ * builtin_parallel - implements
+ *   parallel [-j N] [--tag] [-k|--keep-order] command [args ...] [::: inputs ...]
+ *
+ * Runs the command once per input, with {} in its arguments replaced by
+ * the input (or the input added at the end if there is no {}), at most
+ * N at a time (default: one per CPU).  Without :::, the inputs are the
+ * lines of stdin.  The output of each command is passed on whole once
+ * it is done.  The status is the number of inputs that failed, up to
+ * 101, and those are listed on stderr.
+ */
+int builtin_parallel(Task T)
+{
+    Parallel Par = { 0 };
+    char **argv, **run, *rec, *name;
+    int i, k, ncmd = 0, nwords, procs = 0, braces = 0, failed = 0, r, cap = 0;
+    size_t len;
+    ReadBuf *RB;
+    Batch *B;
+
+    for (i=1; T.argv[i] && T.argv[i][0] == '-' && T.argv[i][1]; i++) {
+        if (!strcmp(T.argv[i], "--")) {
+            i++;
+            break;
+        } else if (!strcmp(T.argv[i], "--tag")) {
+            Par.tag = 1;
+        } else if (!strcmp(T.argv[i], "-k") || !strcmp(T.argv[i], "--keep-order")) {
+            Par.keep = 1;
+        } else if (!strcmp(T.argv[i], "-j")) {
+            const char *arg = opt_arg(T, &i);
+            if (!arg)
+                return 2;
+            procs = atoi(arg);
+        } else {
+            printf("pssh: parallel: %s: invalid option\n", T.argv[i]);
+            return 2;
+        }
+    }
+
+    argv = &T.argv[i];
+    while (argv[ncmd] && strcmp(argv[ncmd], ":::"))
+        ncmd++;
+
+    if (!ncmd) {
+        printf("Usage: parallel [-j N] [--tag] [--keep-order] command [args ...] [::: inputs ...]\n");
+        return 2;
+    }
+
+    if (!function_get(argv[0]) && !command_found(argv[0])) {
+        printf("pssh: parallel: %s: command not found\n", argv[0]);
+        return 127;
+    }
+
+    if (argv[ncmd]) {
+        Par.inputs = &argv[ncmd + 1];
+        while (Par.inputs[Par.ninputs])
+            Par.ninputs++;
+        Par.inputs = memcpy(malloc((Par.ninputs + 1) * sizeof(char *)), Par.inputs,
+                            (Par.ninputs + 1) * sizeof(char *));
+        for (k=0; k<Par.ninputs; k++)
+            Par.inputs[k] = strdup(Par.inputs[k]);
+    } else {
+        RB = readbuf_get(STDIN_FILENO);
+        if (!RB) {
+            printf("pssh: parallel: 0: invalid file descriptor\n");
+            return 1;
+        }
+        do {
+            r = readbuf_record(RB, STDIN_FILENO, '\n', 0, &rec, &len);
+            if (r < 0 || (r == 0 && !len))
+                break;
+            if (Par.ninputs + 1 >= cap) {
+                cap = cap ? cap * 2 : 64;
+                Par.inputs = realloc(Par.inputs, cap * sizeof(char *));
+            }
+            Par.inputs[Par.ninputs++] = strndup(rec, len);
+        } while (r == 1);
+        readbuf_sync(RB, STDIN_FILENO);
+    }
+
+    for (k=0; k<ncmd; k++)
+        if (strstr(argv[k], "{}"))
+            braces = 1;
+    nwords = braces ? ncmd : ncmd + 1;
+
+    Par.status = malloc((Par.ninputs + 1) * sizeof(int));
+    for (k=0; k<Par.ninputs; k++)
+        Par.status[k] = -1;
+    if (Par.keep) {
+        Par.outs = calloc(Par.ninputs + 1, sizeof(char *));
+        Par.lens = calloc(Par.ninputs + 1, sizeof(size_t));
+    }
+
+    name = join_args(T.argv);
+    B = batch_new(name, procs > 0 ? procs : batch_ncpus(), 1, parallel_collect, &Par);
+    free(name);
+
+    for (k=0; k<Par.ninputs; k++) {
+        run = xargs_replace(argv, ncmd, "{}", Par.inputs[k]);
+        if (!braces) {
+            run = realloc(run, (nwords + 1) * sizeof(char *));
+            run[ncmd] = strdup(Par.inputs[k]);
+            run[nwords] = NULL;
+        }
+
+        r = batch_run(B, run);
+
+        for (i=0; i<nwords; i++)
+            free(run[i]);
+        free(run);
+
+        if (r < 0)
+            break;
+    }
+
+    batch_finish(B);
+
+    for (k=0; k<Par.ninputs; k++) {
+        if (Par.status[k] > 0) {
+            fprintf(stderr, "pssh: parallel: %s: exit %d\n", Par.inputs[k], Par.status[k]);
+            failed++;
+        }
+        if (Par.keep)
+            free(Par.outs[k]);
+        free(Par.inputs[k]);
+    }
+
+    free(Par.inputs);
+    free(Par.status);
+    free(Par.outs);
+    free(Par.lens);
+
+    if (job_interrupted)
+        return 130;
+
+    return failed > 101 ? 101 : failed;
+}
+
+
+/*
+ * builtin_jobserver - implements
+ *   jobserver [N | off]
+ *
+ * Makes the shell a make jobserver with N tokens (0: one per CPU); each
+ * background job holds one while it runs, and makes (or ninjas) in them
+ * draw the rest of their parallelism from the same pool.  Without an
+ * argument, shows the pool.
+ */
+int builtin_jobserver(Task T)
+{
+    int n;
+
+    if (!T.argv[1]) {
+        if (jobserver_size())
+            printf("jobserver: %d tokens at %s\n", jobserver_size(), jobserver_path());
+        else
+            printf("jobserver: off\n");
+        return 0;
+    }
+
+    if (!strcmp(T.argv[1], "off")) {
+        jobserver_stop();
+        return 0;
+    }
+
+    n = atoi(T.argv[1]);
+    if (n < 0 || (!n && strcmp(T.argv[1], "0"))) {
+        printf("Usage: jobserver [N | off]\n");
+        return 2;
+    }
+
+    return jobserver_start(n ? n : batch_ncpus()) < 0;
+}
+
+
+/* the queued job named by arg (%n), or NULL after saying why not */
+static Job *queued_job(const char *arg)
+{
+    int job_id = parse_job_number(arg);
+    Job *job = job_id < 0 ? NULL : find_job_by_job_id(job_id);
+
+    if (!job || job->status != QUEUED) {
+        printf("pssh: queue: %s: no such queued job\n", arg ? arg : "");
+        return NULL;
+    }
+
+    return job;
+}
+
+
+/*
+ * builtin_queue - implements
+ *   queue [-p prio] command ...     queue a command (higher prio first)
+ *   queue [-p prio] -e text         queue shell text
+ *   queue [-j N] [-l load] [-m MB]  at most N at once (0: one per CPU),
+ *                                   none started above load or below MB
+ *                                   of available memory (0: no limit)
+ *   queue -r %n prio                change the priority of a queued job
+ *   queue -c %n ...                 cancel queued jobs (as does kill %n)
+ *   queue -w                        wait for the queue to run dry
+ *   queue                           show the queue and its limits
+ *
+ * The command runs with its words as they were expanded when it was
+ * queued, once there is a slot.  Shell text is given with -e, so that
+ * `queue -e 'a | b > log'` queues the whole pipeline.
+ */
+int builtin_queue(Task T)
+{
+    int i, prio = 0, job_id, max = -1, limits = 0;
+    double load = -1;
+    long mem = -1;
+    const char *arg;
+    char *text, opt;
+    Job *job;
+
+    for (i=1; T.argv[i] && T.argv[i][0] == '-' && T.argv[i][1]; i++) {
+        if (!strcmp(T.argv[i], "--")) {
+            i++;
+            break;
+        }
+
+        if (!strcmp(T.argv[i], "-w"))
+            return queue_wait();
+
+        if (shell_text(&T.argv[i]))
+            break;
+
+        if (!strcmp(T.argv[i], "-c")) {
+            if (!T.argv[i+1]) {
+                printf("Usage: queue -c %%<job> ...\n");
+                return 2;
+            }
+            for (i++; T.argv[i]; i++) {
+                if (!(job = queued_job(T.argv[i])))
+                    return 1;
+                remove_job(job->job_id);
+            }
+            return 0;
+        }
+
+        if (!strcmp(T.argv[i], "-r")) {
+            if (!T.argv[i+1] || !T.argv[i+2]) {
+                printf("Usage: queue -r %%<job> <prio>\n");
+                return 2;
+            }
+            if (!(job = queued_job(T.argv[i+1])))
+                return 1;
+            job->prio = atoi(T.argv[i+2]);
+            return 0;
+        }
+
+        opt = T.argv[i][1];
+        if (!strchr("pjlm", opt)) {
+            printf("pssh: queue: %s: invalid option\n", T.argv[i]);
+            return 2;
+        }
+
+        if (!(arg = opt_arg(T, &i)))
+            return 2;
+
+        switch (opt) {
+        case 'p':
+            prio = atoi(arg);
+            break;
+        case 'j':
+            max = atoi(arg);
+            limits = 1;
+            break;
+        case 'l':
+            load = atof(arg);
+            limits = 1;
+            break;
+        case 'm':
+            mem = atol(arg);
+            limits = 1;
+            break;
+        }
+    }
+
+    if (limits)
+        queue_set_limits(max, load, mem);
+
+    if (!T.argv[i]) {
+        if (!limits)
+            queue_print();
+        return 0;
+    }
+
+    if (shell_text(&T.argv[i])) {
+        job_id = queue_add(T.argv[i+1], NULL, prio);
+    } else {
+        text = join_args(&T.argv[i]);
+        job_id = queue_add(text, &T.argv[i], prio);
+        free(text);
+    }
+
+    if (job_id < 0)
+        return 1;
+
+    printf("[%d] queued\n", job_id);
+    queue_drain();
+
+    return 0;
+}
+
+
+/* a signal given by number or name, with or without SIG; -1 if unknown */
+static int signal_number(const char *s)
+{
+    static const struct { const char *name; int sig; } names[] = {
+        { "HUP", SIGHUP },   { "INT", SIGINT },   { "QUIT", SIGQUIT },
+        { "KILL", SIGKILL }, { "USR1", SIGUSR1 }, { "USR2", SIGUSR2 },
+        { "ALRM", SIGALRM }, { "TERM", SIGTERM }, { "CONT", SIGCONT },
+        { "STOP", SIGSTOP }, { "TSTP", SIGTSTP },
+    };
+    char *end;
+    long n;
+
+    n = strtol(s, &end, 10);
+    if (*s && !*end)
+        return n > 0 && n < NSIG ? (int)n : -1;
+
+    if (!strncmp(s, "SIG", 3))
+        s += 3;
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+        if (!strcmp(s, names[i].name))
+            return names[i].sig;
+
+    return -1;
+}
+
+
+/* a duration such as 10, 1.5 or 2m (s, m, h or d); -1 if invalid */
+static double duration(const char *s)
+{
+    char *end;
+    double secs = strtod(s, &end);
+
+    if (end == s || secs < 0)
+        return -1;
+
+    switch (*end) {
+    case '\0': case 's': break;
+    case 'm': secs *= 60; break;
+    case 'h': secs *= 3600; break;
+    case 'd': secs *= 86400; break;
+    default: return -1;
+    }
+
+    return *end && end[1] ? -1 : secs;
+}
+
+
+/*
+ * builtin_timeout - implements
+ *   timeout [-s signal] [-k duration] duration command ...
+ *   timeout [-s signal] [-k duration] duration -e text
+ *
+ * Runs the command, with its words as they are, or the shell text of
+ * -e, as a job that is sent signal (TERM by default) once duration has
+ * passed, and KILL duration of -k later if it is still there.  The
+ * shell keeps the deadline itself, so the job stays under job control
+ * like any other; with a trailing & in the text it runs in the
+ * background and the deadline still holds.  As with GNU timeout, the
+ * status is 124 if the time ran out, or 137 if KILL (from -s or -k)
+ * ended the job.
+ */
+int builtin_timeout(Task T)
+{
+    volatile sig_atomic_t fired = 0;
+    double secs, kill_after = 0;
+    int i, sig = SIGTERM, status;
+    const char *sh;
+    char *text;
+    Node *N = NULL;
+
+    for (i=1; T.argv[i] && T.argv[i][0] == '-' && T.argv[i+1]; i++) {
+        if (!strcmp(T.argv[i], "--")) {
+            i++;
+            break;
+        } else if (!strcmp(T.argv[i], "-s")) {
+            if ((sig = signal_number(T.argv[++i])) < 0) {
+                printf("pssh: timeout: %s: invalid signal\n", T.argv[i]);
+                return 125;
+            }
+        } else if (!strcmp(T.argv[i], "-k")) {
+            if ((kill_after = duration(T.argv[++i])) < 0) {
+                printf("pssh: timeout: %s: invalid duration\n", T.argv[i]);
+                return 125;
+            }
+        } else {
+            break;
+        }
+    }
+
+    if (!T.argv[i] || !T.argv[i+1]) {
+        printf("Usage: timeout [-s signal] [-k duration] duration command ...\n");
+        return 125;
+    }
+
+    if ((secs = duration(T.argv[i])) < 0) {
+        printf("pssh: timeout: %s: invalid duration\n", T.argv[i]);
+        return 125;
+    }
+
+    if ((sh = shell_text(&T.argv[i+1])) && !(N = parse_job(sh, 0))) {
+        printf("pssh: timeout: invalid syntax\n");
+        return 125;
+    }
+
+    /* the job launched next takes the deadline */
+    deadline_next(sig, secs, kill_after, &fired);
+    if (N) {
+        status = exec_node(N);
+    } else {
+        text = join_args(&T.argv[i+1]);
+        status = execute_argv(&T.argv[i+1], text, 0);
+        free(text);
+    }
+    deadline_clear();
+    deadline_detach(&fired);
+    node_destroy(&N);
+
+    /* a job stopped by our own -s INT is no ^C from the user */
+    if (fired)
+        job_interrupted = 0;
+
+    if (fired && status == 128 + SIGKILL)
+        return status;
+    return fired ? 124 : status;
+}
+
+
+/* the job (%n) or process (pid) is still in the job table */
+static int wait_target_running(int job_id, pid_t pid)
+{
+    if (pid <= 0)
+        return find_job_by_job_id(job_id) != NULL;
+
+    for (int i = 0; i < num_jobs; i++) {
+        if (jobs[i].last_pid == pid)
+            return 1;
+        for (unsigned int j = 0; j < jobs[i].npids; j++)
+            if (jobs[i].pids[j] == pid)
+                return 1;
+    }
+
+    return 0;
+}
+
+
+/* some job is running in the background, or queued to */
+static int background_jobs(void)
+{
+    for (int i = 0; i < num_jobs; i++)
+        if (jobs[i].status == BG || jobs[i].status == QUEUED)
+            return 1;
+
+    return 0;
+}
+
+
+/*
+ * builtin_wait - implements
+ *   wait [-n] [-t duration] [%job | pid ...]
+ *
+ * Waits for the jobs given, or for every background (and queued) job,
+ * and returns the exit status of the last one.  With -n it waits for
+ * the first of them to end and returns that one's status.  -t gives up
+ * after duration with status 124.  The shell sleeps until a child exits;
+ * nothing is polled.
+ */
+int builtin_wait(Task T)
+{
+    struct timespec until, *deadline = NULL;
+    int i, k, first = 0, ntargets, status = 0, r;
+    unsigned long done_before = jobs_done();
+    double secs;
+
+    for (i=1; T.argv[i] && T.argv[i][0] == '-' && T.argv[i][1]; i++) {
+        if (!strcmp(T.argv[i], "--")) {
+            i++;
+            break;
+        } else if (!strcmp(T.argv[i], "-n")) {
+            first = 1;
+        } else if (!strcmp(T.argv[i], "-t") && T.argv[i+1] &&
+                   (secs = duration(T.argv[i+1])) >= 0) {
+            clock_gettime(CLOCK_MONOTONIC, &until);
+            until.tv_sec += (time_t)secs;
+            until.tv_nsec += (long)((secs - (time_t)secs) * 1e9);
+            if (until.tv_nsec >= 1000000000) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000;
+            }
+            deadline = &until;
+            i++;
+        } else {
+            printf("Usage: wait [-n] [-t duration] [%%job | pid ...]\n");
+            return 2;
+        }
+    }
+
+    ntargets = 0;
+    while (T.argv[i + ntargets])
+        ntargets++;
+
+    int job_ids[ntargets + 1];
+    pid_t pids[ntargets + 1];
+
+    for (k=0; k<ntargets; k++) {
+        const char *arg = T.argv[i + k];
+        char *end;
+
+        job_ids[k] = -1;
+        pids[k] = 0;
+        if (arg[0] == '%') {
+            job_ids[k] = parse_job_number(arg);
+        } else {
+            pids[k] = strtol(arg, &end, 10);
+            if (*end || pids[k] <= 0)
+                pids[k] = -1;
+        }
+
+        if (job_ids[k] < 0 && pids[k] <= 0) {
+            printf("pssh: wait: %s: not a job or pid\n", arg);
+            return 2;
+        }
+    }
+
+    for (;;) {
+        queue_drain();
+
+        if (!ntargets) {
+            if (first && jobs_done() != done_before)
+                return job_last_done_status();
+            if (!background_jobs())
+                return first ? 127 : 0;
+        } else {
+            int running = 0;
+
+            for (k=0; k<ntargets; k++) {
+                if (wait_target_running(job_ids[k], pids[k])) {
+                    running++;
+                    continue;
+                }
+
+                status = job_done_status(job_ids[k], pids[k]);
+                if (status < 0)
+                    status = 127;   /* not a child of ours, or long gone */
+                if (first)
+                    return status;
+            }
+
+            /* all done: the status is that of the last one given */
+            if (!running) {
+                status = job_done_status(job_ids[ntargets-1], pids[ntargets-1]);
+                return status < 0 ? 127 : status;
+            }
+        }
+
+        r = wait_for_child_event(deadline);
+        if (r > 0)
+            return 124;
+        if (r < 0)
+            return 130;
+    }
+}
+
+
+/*
+ * builtin_run - implements
+ *   run [--mem size] [--cpu n] [--cpus list] [--nice n]
+ *       [--sched other|batch|idle] [--ionice class[:level]]
+ *       [--pipe-size size|max|auto] [--packet] command ... | -e text
+ *
+ * Runs the command, with its words as they are, or the shell text of
+ * -e (& and all), as a job in a cgroup of its own, which jobs -v reports on.  --mem
+ * caps its memory and --cpu its CPU time to n CPUs' worth; see run.c
+ * for what happens where cgroups cannot do it.  --cpus pins it to a
+ * CPU list such as 0-3,8, and --nice, --sched and --ionice set its
+ * nice value, scheduling policy and I/O class (idle, be or rt, the
+ * latter two with a level of 0 to 7).  --pipe-size and --packet size
+ * its pipes, as $PSSH_PIPESIZE and $PSSH_PIPEPACKET do for all jobs.
+ */
+int builtin_run(Task T)
+{
+    RunOpts R;
+    const char *sh;
+    char *text;
+    Node *N = NULL;
+    int i, status;
+
+    run_opts_init(&R);
+
+    for (i=1; T.argv[i] && T.argv[i][0] == '-'; i++) {
+        if (!strcmp(T.argv[i], "--")) {
+            i++;
+            break;
+        }
+        if (shell_text(&T.argv[i]))
+            break;
+        if (!run_parse_flag(&R, T.argv[i]))
+            continue;
+
+        status = T.argv[i+1] ? run_parse_opt(&R, T.argv[i], T.argv[i+1]) : 1;
+        if (status > 0) {
+            printf("pssh: run: %s: invalid option\n", T.argv[i]);
+            return 2;
+        }
+        if (status < 0) {
+            printf("pssh: run: %s: invalid argument to %s\n", T.argv[i+1], T.argv[i]);
+            return 2;
+        }
+        i++;
+    }
+
+    if (!T.argv[i]) {
+        printf("Usage: run [--mem size] [--cpu n] [--cpus list] [--nice n]\n"
+               "           [--sched policy] [--ionice class[:level]]\n"
+               "           [--pipe-size size|max|auto] [--packet] command ... | -e text\n");
+        return 2;
+    }
+
+    if ((sh = shell_text(&T.argv[i])) && !(N = parse_job(sh, 0))) {
+        printf("pssh: run: invalid syntax\n");
+        return 2;
+    }
+
+    if (run_next(&R) < 0) {
+        node_destroy(&N);
+        return 1;
+    }
+
+    if (N) {
+        status = exec_node(N);
+    } else {
+        text = join_args(&T.argv[i]);
+        status = execute_argv(&T.argv[i], text, 0);
+        free(text);
+    }
+    run_clear();
+    node_destroy(&N);
+
+    return status;
+}
+
+
+/*
+ * builtin_renice - implements
+ *   renice [n] [run options] %job|pid ...
+ *
+ * Applies the options of run to jobs or processes that already run,
+ * every thread of them; a leading n is short for --nice n.  --mem and
+ * --cpu only apply to jobs that have a cgroup.
+ */
+int builtin_renice(Task T)
+{
+    RunOpts R;
+    char *end;
+    int i = 1, status = 0, r;
+
+    run_opts_init(&R);
+
+    /* as with renice(1), a first number is the nice value, not a pid */
+    if (T.argv[i] && T.argv[i+1] && (strtol(T.argv[i], &end, 10), end != T.argv[i] && !*end)) {
+        if (run_parse_opt(&R, "--nice", T.argv[i]) < 0) {
+            printf("pssh: renice: %s: invalid nice value\n", T.argv[i]);
+            return 2;
+        }
+        i++;
+    }
+
+    for (; T.argv[i] && T.argv[i][0] == '-' && T.argv[i][1] == '-'; i++) {
+        if (!strcmp(T.argv[i], "--")) {
+            i++;
+            break;
+        }
+
+        r = T.argv[i+1] ? run_parse_opt(&R, T.argv[i], T.argv[i+1]) : 1;
+        if (r > 0 || R.pipe_size) {
+            printf("pssh: renice: %s: invalid option\n", T.argv[i]);
+            return 2;
+        }
+        if (r < 0) {
+            printf("pssh: renice: %s: invalid argument to %s\n", T.argv[i+1], T.argv[i]);
+            return 2;
+        }
+        i++;
+    }
+
+    if (!T.argv[i]) {
+        printf("Usage: renice [n] [run options] %%job|pid ...\n");
+        return 2;
+    }
+
+    for (; T.argv[i]; i++) {
+        if (T.argv[i][0] == '%') {
+            int job_id = parse_job_number(T.argv[i]);
+            Job *job = job_id < 0 ? NULL : find_job_by_job_id(job_id);
+
+            if (!job) {
+                printf("pssh: renice: %s: no such job\n", T.argv[i]);
+                status = 1;
+            } else if (job->status == QUEUED) {
+                printf("pssh: renice: %s: job is queued\n", T.argv[i]);
+                status = 1;
+            } else if (run_apply_job(&R, job) < 0) {
+                printf("pssh: renice: %s: %s\n", T.argv[i], strerror(errno));
+                status = 1;
+            }
+        } else {
+            pid_t pid = strtol(T.argv[i], &end, 10);
+
+            if (*end || end == T.argv[i] || pid <= 0) {
+                printf("pssh: renice: %s: not a job or pid\n", T.argv[i]);
+                status = 1;
+            } else if (run_apply_pid(&R, pid) < 0) {
+                printf("pssh: renice: %s: %s\n", T.argv[i], strerror(errno));
+                status = 1;
+            }
+        }
+    }
+
+    return status;
+}
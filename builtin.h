@@ -4,11 +4,59 @@
 #include "parse.h"
 
 int is_builtin(char *cmd);
-void builtin_execute(Task T);
+int is_subst_builtin(char *cmd);
+int builtin_execute(Task T);
 int builtin_which(Task T); 
 int builtin_jobs(Task T);
 int builtin_fg(Task T);
 int builtin_bg(Task T);
 int builtin_kill(Task T);
+int builtin_break(Task T);
+int builtin_return(Task T);
+int builtin_alias(Task T);
+int builtin_unalias(Task T);
+int builtin_unset(Task T);
+int builtin_set(Task T);
+int builtin_hash(Task T);
+int builtin_pcache(Task T);
+int builtin_coproc(Task T);
+int builtin_exec(Task T);
+int builtin_read(Task T);
+int builtin_mapfile(Task T);
+int builtin_xargs(Task T);
+int builtin_parallel(Task T);
+int builtin_jobserver(Task T);
+int builtin_queue(Task T);
+int builtin_timeout(Task T);
+int builtin_wait(Task T);
+int builtin_run(Task T);
+int builtin_renice(Task T);
+
+/* for builtins that can run for long: at an interactive prompt they run
+ * as a foreground job of their own instead, so that ^Z stops them; the
+ * job's status, or -1 if the builtin is to run here and now */
+int builtin_job(Task T);
+
+/* for builtins that stand in for a program (head, tail, fgrep) but
+ * don't have all its options: runs the program of that name in PATH
+ * with the same words; its status, or -1 if there is no such program */
+int builtin_program(Task T);
+
+/* utils.c */
+int builtin_echo(Task T);
+int builtin_printf(Task T);
+int builtin_true(Task T);
+int builtin_false(Task T);
+int builtin_test(Task T);
+int builtin_pwd(Task T);
+int builtin_basename(Task T);
+int builtin_dirname(Task T);
+int builtin_sleep(Task T);
+
+/* textutil.c */
+int builtin_count(Task T);
+int builtin_fgrep(Task T);
+int builtin_head(Task T);
+int builtin_tail(Task T);
 
 #endif
\ No newline at end of file
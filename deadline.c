@@ -0,0 +1,246 @@
+/* deadline.c
+ * deadlines of jobs, for timeout.  They are kept in a binary min-heap
+ * ordered by expiry, with a single ITIMER_REAL armed for the earliest.
+ * SIGALRM then sends the signals and rearms.  A waiting shell may be in
+ * sigsuspend(), ppoll() or readline, and a signal wakes it in all of
+ * them.  Deadlines cost no wakeups until they expire, however many jobs
+ * have one.
+ *
+ * The heap is changed by the main line (with SIGALRM blocked) and by the
+ * handlers of SIGALRM and SIGCHLD, which block each other.
+ **********************************************************************/
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "deadline.h"
+
+typedef struct {
+    struct timespec at;         /* CLOCK_MONOTONIC */
+    int job_id;
+    pid_t pgid;
+    int sig;
+    double kill_after;          /* then SIGKILL, if > 0 */
+    volatile sig_atomic_t *fired;
+} Deadline;
+
+static Deadline *heap;
+static int nheap, heap_cap;
+
+static Deadline pending;
+static int has_pending;
+
+
+static void block_alarm(sigset_t *prev)
+{
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGALRM);
+    sigprocmask(SIG_BLOCK, &mask, prev);
+}
+
+
+static int before(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec < b->tv_sec ||
+           (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+
+static void add_secs(struct timespec *t, double secs)
+{
+    long ns;
+
+    t->tv_sec += (time_t)secs;
+    ns = t->tv_nsec + (long)((secs - (time_t)secs) * 1e9);
+    t->tv_sec += ns / 1000000000;
+    t->tv_nsec = ns % 1000000000;
+}
+
+
+static void sift_up(int i)
+{
+    Deadline d = heap[i];
+
+    while (i > 0 && before(&d.at, &heap[(i-1)/2].at)) {
+        heap[i] = heap[(i-1)/2];
+        i = (i-1)/2;
+    }
+    heap[i] = d;
+}
+
+
+static void sift_down(int i)
+{
+    Deadline d = heap[i];
+    int c;
+
+    while ((c = 2*i + 1) < nheap) {
+        if (c + 1 < nheap && before(&heap[c+1].at, &heap[c].at))
+            c++;
+        if (!before(&heap[c].at, &d.at))
+            break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = d;
+}
+
+
+static void heap_remove(int i)
+{
+    heap[i] = heap[--nheap];
+    if (i < nheap) {
+        sift_down(i);
+        sift_up(i);
+    }
+}
+
+
+/* the timer goes off at the earliest deadline, or not at all */
+static void rearm(void)
+{
+    struct itimerval it = { { 0, 0 }, { 0, 0 } };
+    struct timespec now;
+    long long us;
+
+    if (nheap) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        us = (heap[0].at.tv_sec - now.tv_sec) * 1000000LL +
+             (heap[0].at.tv_nsec - now.tv_nsec) / 1000;
+        if (us < 1)
+            us = 1;     /* 0 would disarm it */
+        it.it_value.tv_sec = us / 1000000;
+        it.it_value.tv_usec = us % 1000000;
+    }
+
+    setitimer(ITIMER_REAL, &it, NULL);
+}
+
+
+static void sigalrm_handler(int sig)
+{
+    struct timespec now;
+    Deadline *d;
+
+    (void)sig;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    while (nheap && !before(&now, &heap[0].at)) {
+        d = &heap[0];
+        killpg(d->pgid, d->sig);
+        if (d->fired)
+            *d->fired = 1;
+
+        /* a second deadline for those that would not go */
+        if (d->kill_after > 0) {
+            d->at = now;
+            add_secs(&d->at, d->kill_after);
+            d->sig = SIGKILL;
+            d->kill_after = 0;
+            sift_down(0);
+        } else {
+            heap_remove(0);
+        }
+    }
+
+    rearm();
+}
+
+
+void deadline_next(int sig, double secs, double kill_after,
+                   volatile sig_atomic_t *fired)
+{
+    clock_gettime(CLOCK_MONOTONIC, &pending.at);
+    add_secs(&pending.at, secs);
+    pending.sig = sig;
+    pending.kill_after = kill_after;
+    pending.fired = fired;
+    has_pending = 1;
+}
+
+
+int deadline_pending(void)
+{
+    return has_pending;
+}
+
+
+void deadline_clear(void)
+{
+    has_pending = 0;
+}
+
+
+void deadline_start(int job_id, pid_t pgid)
+{
+    static int installed;
+    struct sigaction sa;
+    sigset_t prev;
+
+    if (!has_pending)
+        return;
+    has_pending = 0;
+
+    if (!installed) {
+        sa.sa_handler = sigalrm_handler;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaddset(&sa.sa_mask, SIGCHLD);
+        sigaction(SIGALRM, &sa, NULL);
+        installed = 1;
+    }
+
+    block_alarm(&prev);
+
+    if (nheap == heap_cap) {
+        heap_cap = heap_cap ? heap_cap * 2 : 16;
+        heap = realloc(heap, heap_cap * sizeof(*heap));
+    }
+
+    pending.job_id = job_id;
+    pending.pgid = pgid;
+    heap[nheap++] = pending;
+    sift_up(nheap - 1);
+    rearm();
+
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+}
+
+
+void deadline_detach(volatile sig_atomic_t *fired)
+{
+    sigset_t prev;
+
+    block_alarm(&prev);
+    for (int i = 0; i < nheap; i++)
+        if (heap[i].fired == fired)
+            heap[i].fired = NULL;
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+}
+
+
+void deadline_cancel(int job_id)
+{
+    sigset_t prev;
+    int removed = 0;
+
+    if (!nheap)
+        return;
+
+    block_alarm(&prev);
+    for (int i = nheap - 1; i >= 0; i--) {
+        if (heap[i].job_id == job_id) {
+            heap_remove(i);
+            removed = 1;
+        }
+    }
+    if (removed)
+        rearm();
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+}
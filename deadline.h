@@ -0,0 +1,29 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <signal.h>
+#include <sys/types.h>
+
+/* deadlines on jobs: when one passes, its signal is sent to the job's
+ * process group (and, with a kill_after, SIGKILL later on) */
+
+/* makes the next job launched get a deadline secs from its start; the
+ * job then has a process group of its own even in scripts.  *fired is
+ * set once the signal is sent, as long as the caller keeps it alive */
+void deadline_next(int sig, double secs, double kill_after,
+                   volatile sig_atomic_t *fired);
+int deadline_pending(void);
+
+/* called by the launch of a job: gives it the pending deadline */
+void deadline_start(int job_id, pid_t pgid);
+
+/* drops what is pending if no job was launched to take it */
+void deadline_clear(void);
+
+/* stops reporting into fired (its owner is going away) */
+void deadline_detach(volatile sig_atomic_t *fired);
+
+/* drops the deadlines of a job that is gone; signal safe */
+void deadline_cancel(int job_id);
+
+#endif
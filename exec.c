@@ -0,0 +1,1636 @@
+/* exec.c
+ * runs the command tree built by the parser: lists, and-or lists,
+ * the compound commands and, at the leaves, pipelines of processes
+ *
+ * The tree is never modified here, so loop bodies are simply walked
+ * again on every iteration; only the words are expanded anew.
+ **********************************************************************/
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "arith.h"
+#include "builtin.h"
+#include "deadline.h"
+#include "exec.h"
+#include "expand.h"
+#include "hash.h"
+#include "job_control.h"
+#include "jobserver.h"
+#include "optimize.h"
+#include "pcache.h"
+#include "queue.h"
+#include "run.h"
+#include "tee.h"
+#include "vars.h"
+
+int last_status;
+pid_t last_bg_pid;
+pid_t shell_pid;
+
+int loop_depth;
+int loop_break;
+int loop_continue;
+
+int func_depth;
+int func_return;
+
+int builtin_stage;
+
+int opt_xtrace;
+int opt_optimize = 1;
+
+static int subst_ran;           /* a $( ) ran while expanding the command */
+
+static HashTable *functions;    /* name -> body (a compound command) */
+
+static HashTable *path_cache;   /* command -> full path */
+static char *path_cache_PATH;   /* the $PATH it was filled from */
+
+typedef struct {
+    int *fd;                    /* the fds redirected in the shell */
+    int *saved;                 /* a copy of each from before, or -1 */
+    int n;
+    pid_t *tees;                /* helpers of |>, waited for when done */
+    int ntees;
+} SavedFds;
+
+/* <( ) and >( ) seen while expanding a command; they are started
+ * together with it */
+typedef struct {
+    Node *N;
+    int fd;                     /* its end of the pipe */
+    int path_fd;                /* the end named by /dev/fd/N */
+    int reads;                  /* >( ): N reads what is written */
+} ProcSubst;
+
+static ProcSubst *procsubs;
+static int nprocsubs;
+
+
+static void function_free(void *p)
+{
+    Node *N = p;
+
+    node_destroy(&N);
+}
+
+
+Node *function_get(const char *name)
+{
+    return functions ? hash_get(functions, name) : NULL;
+}
+
+
+int function_unset(const char *name)
+{
+    return functions ? hash_remove(functions, name) : 0;
+}
+
+
+static int function_define(Node *N)
+{
+    const char *p;
+
+    for (p=N->word; *p; p++) {
+        if (!isalnum((unsigned char)*p) && !strchr("_-.:", *p)) {
+            fprintf(stderr, "pssh: `%s': not a valid function name\n", N->word);
+            return 1;
+        }
+    }
+
+    if (!functions)
+        functions = hash_new(function_free);
+
+    hash_put(functions, N->word, node_ref(N->body));
+
+    return 0;
+}
+
+
+/* runs a function in the current shell with argv[1..] as its
+ * positional parameters */
+static int run_function(Node *body, char **argv)
+{
+    char **args;
+    int n, i, status;
+    int saved_depth = loop_depth;
+
+    for (n=0; argv[n+1]; n++);
+    args = malloc((n + 1) * sizeof(*args));
+    for (i=0; i<n; i++)
+        args[i] = strdup(argv[i+1]);
+    args[n] = NULL;
+
+    /* the body stays alive even if the function redefines itself */
+    node_ref(body);
+    var_swap_positional(&args, &n);
+    loop_depth = 0;
+    func_depth++;
+
+    status = exec_node(body);
+
+    func_depth--;
+    func_return = 0;
+    loop_depth = saved_depth;
+    loop_break = loop_continue = 0;
+    var_swap_positional(&args, &n);
+    node_destroy(&body);
+
+    for (i=0; i<n; i++)
+        free(args[i]);
+    free(args);
+
+    return status;
+}
+
+
+/* full path of cmd as found in $PATH, or NULL.  Hits are remembered
+ * until $PATH changes (or hash -r), misses are not. */
+const char *path_lookup(const char *cmd)
+{
+    const char *PATH = getenv("PATH");
+    char *dir, *tmp, *copy, *state, *found = NULL;
+    char probe[PATH_MAX];
+
+    if (!PATH || !*cmd)
+        return NULL;
+
+    if (!path_cache)
+        path_cache = hash_new(free);
+
+    if (!path_cache_PATH || strcmp(path_cache_PATH, PATH)) {
+        hash_clear(path_cache);
+        free(path_cache_PATH);
+        path_cache_PATH = strdup(PATH);
+    }
+
+    if ((found = hash_get(path_cache, cmd)))
+        return found;
+
+    copy = strdup(PATH);
+
+    for (tmp=copy; ; tmp=NULL) {
+        dir = strtok_r(tmp, ":", &state);
+        if (!dir)
+            break;
+
+        snprintf(probe, sizeof(probe), "%s/%s", dir, cmd);
+
+        if (access(probe, X_OK) == 0) {
+            found = strdup(probe);
+            hash_put(path_cache, cmd, found);
+            break;
+        }
+    }
+
+    free(copy);
+    return found;
+}
+
+
+void path_cache_clear(void)
+{
+    if (path_cache)
+        hash_clear(path_cache);
+}
+
+
+void path_cache_print(void)
+{
+    HashEntry *e;
+    size_t i;
+
+    if (!path_cache)
+        return;
+
+    for (e = hash_first(path_cache, &i); e; e = hash_next(path_cache, e, &i))
+        printf("%s\t%s\n", e->key, (char *)e->value);
+}
+
+
+/* return true if command is found, either:
+ *   - a path (containing a '/') to an executable file was supplied
+ *   - the executable file was found in the system's PATH
+ * false is returned otherwise */
+int command_found(const char *cmd)
+{
+    if (strchr(cmd, '/'))
+        return access(cmd, X_OK) == 0;
+
+    return path_lookup(cmd) != NULL;
+}
+
+
+/* returns the number of leading NAME=value words */
+static int count_assignments(char **words)
+{
+    int n;
+
+    for (n=0; words[n] && is_assignment(words[n]); n++);
+
+    return n;
+}
+
+
+/* performs NAME=value assignments: as shell variables or, in a
+ * child that is about to exec, in its environment */
+static int do_assignments(char **words, int n, int to_env)
+{
+    char *name, *value;
+    size_t eq;
+    int i;
+
+    for (i=0; i<n; i++) {
+        eq = is_assignment(words[i]);
+        value = expand_word(words[i] + eq + 1);
+        if (!value)
+            return -1;
+
+        name = strndup(words[i], eq);
+        if (to_env)
+            setenv(name, value, 1);
+        else
+            var_set(name, value);
+
+        free(name);
+        free(value);
+    }
+
+    return 0;
+}
+
+
+/* Sets up <( cmd ), or >( cmd ) if reads is set, and returns the
+ * /dev/fd path of the pipe, or NULL if cmd does not parse.  cmd only
+ * starts with the command whose expansion this is. */
+char *proc_subst(const char *cmd, int reads)
+{
+    ParseStatus pstatus;
+    ProcSubst *S;
+    char path[32];
+    int fds[2];
+    Node *N;
+
+    N = pcache_parse(cmd, &pstatus);
+    if (pstatus != PARSE_OK) {
+        printf("pssh: invalid syntax in process substitution: %s\n", cmd);
+        return NULL;
+    }
+
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        perror("pipe");
+        node_destroy(&N);
+        return NULL;
+    }
+
+    procsubs = realloc(procsubs, (nprocsubs + 1) * sizeof(*procsubs));
+    S = &procsubs[nprocsubs++];
+    S->N = N;
+    S->reads = reads;
+    S->fd = reads ? fds[0] : fds[1];
+    S->path_fd = reads ? fds[1] : fds[0];
+
+    /* the outer command opens it after exec */
+    fcntl(S->path_fd, F_SETFD, 0);
+
+    snprintf(path, sizeof(path), "/dev/fd/%d", S->path_fd);
+
+    return strdup(path);
+}
+
+
+/* forks the process substitutions from index base on.  With pgid they
+ * join that process group (0: the first one starts it) and their pids
+ * are stored in pids.  Returns how many were started. */
+static int procsub_start(int base, pid_t *pids, pid_t *pgid)
+{
+    int k, j, n = 0;
+    pid_t pid;
+
+    fflush(NULL);
+
+    for (k=base; k<nprocsubs; k++) {
+        pid = run_fork();
+        if (pid < 0) {
+            perror("fork");
+            exit(EXIT_FAILURE);
+        }
+
+        if (pid == 0) {
+            if (pgid && (job_control_active || deadline_pending()))
+                setpgid(0, *pgid);
+            run_child();
+
+            dup2(procsubs[k].fd, procsubs[k].reads ? STDIN_FILENO : STDOUT_FILENO);
+            for (j=0; j<nprocsubs; j++) {
+                if (procsubs[j].fd >= 0)
+                    close(procsubs[j].fd);
+                close(procsubs[j].path_fd);
+            }
+
+            enter_subshell();
+            loop_depth = loop_break = loop_continue = 0;
+            func_depth = func_return = 0;
+            exit(exec_node(procsubs[k].N));
+        }
+
+        if (pgid && (job_control_active || deadline_pending())) {
+            if (!*pgid)
+                *pgid = pid;
+            setpgid(pid, *pgid);
+        }
+
+        if (pids)
+            pids[n] = pid;
+        n++;
+
+        close(procsubs[k].fd);
+        procsubs[k].fd = -1;
+    }
+
+    return n;
+}
+
+
+/* the command is under way (or failed): drops the process
+ * substitutions from index base on */
+static void procsub_finish(int base)
+{
+    while (nprocsubs > base) {
+        nprocsubs--;
+        if (procsubs[nprocsubs].fd >= 0)
+            close(procsubs[nprocsubs].fd);
+        close(procsubs[nprocsubs].path_fd);
+        node_destroy(&procsubs[nprocsubs].N);
+    }
+}
+
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len) {
+        n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+
+/* an fd to read text from: a pipe if it fits in the pipe's buffer, so
+ * that the write cannot block, and a memfd otherwise.  Nothing is ever
+ * written to a temporary file. */
+static int heredoc_fd(const char *text)
+{
+    size_t len = strlen(text);
+    int p[2], fd = -1, piped = 0;
+
+    if (pipe(p) == 0) {
+        if ((long)len <= fcntl(p[1], F_GETPIPE_SZ)) {
+            piped = 1;
+            fd = write_all(p[1], text, len) < 0 ? -1 : p[0];
+            close(p[1]);
+            if (fd < 0)
+                close(p[0]);
+        } else {
+            close(p[0]);
+            close(p[1]);
+        }
+    }
+
+    /* too big for a pipe, or no pipe to be had */
+    if (!piped) {
+        fd = memfd_create("pssh-heredoc", MFD_CLOEXEC);
+        if (fd >= 0 && write_all(fd, text, len) < 0) {
+            close(fd);
+            fd = -1;
+        }
+        if (fd >= 0)
+            lseek(fd, 0, SEEK_SET);
+    }
+
+    if (fd < 0)
+        fprintf(stderr, "pssh: here-document: %s\n", strerror(errno));
+
+    return fd;
+}
+
+
+/* a copy of the redirections R with their words expanded, in *out;
+ * returns -1 if an expansion failed */
+static int expand_redirs(Redir *R, Redir **out)
+{
+    Redir **tail = out;
+    char *w;
+
+    *out = NULL;
+
+    for (; R; R=R->next) {
+        switch (R->type) {
+        case REDIR_HEREDOC:
+            w = R->quoted ? strdup(R->word) : expand_heredoc(R->word);
+            break;
+        case REDIR_HERESTRING:
+            w = expand_word(R->word);
+            if (w) {
+                w = realloc(w, strlen(w) + 2);
+                strcat(w, "\n");
+            }
+            break;
+        default:
+            w = expand_word(R->word);
+        }
+
+        if (!w) {
+            redir_destroy(out);
+            return -1;
+        }
+
+        *tail = malloc(sizeof(**tail));
+        **tail = *R;
+        (*tail)->word = w;
+        (*tail)->delim = NULL;
+        (*tail)->next = NULL;
+        tail = &(*tail)->next;
+    }
+
+    return 0;
+}
+
+
+/* the fd to be dup'd onto R->fd */
+static int redir_open(Redir *R)
+{
+    int fd;
+
+    switch (R->type) {
+    case REDIR_HEREDOC:
+    case REDIR_HERESTRING:
+        return heredoc_fd(R->word);
+    case REDIR_OUT:
+    case REDIR_TEE:
+        fd = open(R->word, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        break;
+    case REDIR_APPEND:
+        fd = open(R->word, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        break;
+    default:
+        fd = open(R->word, O_RDONLY);
+    }
+
+    if (fd < 0)
+        fprintf(stderr, "pssh: %s: %s\n", R->word, strerror(errno));
+
+    return fd;
+}
+
+
+/* [n]|> file ...: the run of tees of fd n from *Rp on, *Rp is left at
+ * the last.  From now on n is a pipe to a helper that copies all that
+ * comes through to the files and to what n was before.  In a child
+ * that is to become the command (no S) the helper is that process
+ * itself and the command a child of it, so the job only ends once all
+ * is copied; in the shell it is a child, waited for by redirect_pop() */
+static int tee_start(Redir **Rp, SavedFds *S)
+{
+    Redir *R = *Rp;
+    int files[64], n = 0, fds[2], status, k;
+    pid_t pid;
+
+    for (;; R=R->next) {
+        if ((files[n] = redir_open(R)) < 0)
+            goto fail;
+        n++;
+        if (!R->next || R->next->type != REDIR_TEE || R->next->fd != (*Rp)->fd || n == 64)
+            break;
+    }
+
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        goto fail;
+    }
+
+    fflush(NULL);
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        goto fail;
+    }
+
+    if ((pid == 0) == (S != NULL)) {
+        child_reset_signals();
+        close(fds[1]);
+        tee_copy(fds[0], R->fd, files, n);
+        if (S)
+            _exit(EXIT_SUCCESS);
+
+        // and leave as the command did
+        close(R->fd);
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+        if (WIFSIGNALED(status)) {
+            signal(WTERMSIG(status), SIG_DFL);
+            raise(WTERMSIG(status));
+        }
+        _exit(WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE);
+    }
+
+    if (S) {
+        S->tees = realloc(S->tees, (S->ntees + 1) * sizeof(*S->tees));
+        S->tees[S->ntees++] = pid;
+    }
+
+    for (k=0; k<n; k++)
+        close(files[k]);
+    close(fds[0]);
+    dup2(fds[1], R->fd);
+    close(fds[1]);
+    *Rp = R;
+
+    return 0;
+
+fail:
+    for (k=0; k<n; k++)
+        close(files[k]);
+    return -1;
+}
+
+
+/* applies the (expanded) redirections in order; with S, the fds they
+ * replace are kept so that redirect_pop() can put them back */
+static int redirect_apply(Redir *R, SavedFds *S)
+{
+    int fd;
+
+    for (; R; R=R->next) {
+        if (S) {
+            S->fd = realloc(S->fd, (S->n + 1) * sizeof(*S->fd));
+            S->saved = realloc(S->saved, (S->n + 1) * sizeof(*S->saved));
+            S->fd[S->n] = R->fd;
+            S->saved[S->n] = fcntl(R->fd, F_DUPFD_CLOEXEC, 10);
+            S->n++;
+        }
+
+        if (R->type == REDIR_TEE) {
+            if (tee_start(&R, S) < 0)
+                return -1;
+            continue;
+        }
+
+        if (R->type == REDIR_DUP) {
+            if (!strcmp(R->word, "-")) {
+                close(R->fd);
+                continue;
+            }
+
+            if (!*R->word || strspn(R->word, "0123456789") != strlen(R->word)) {
+                fprintf(stderr, "pssh: %s: ambiguous redirect\n", R->word);
+                return -1;
+            }
+
+            fd = atoi(R->word);
+            if (fcntl(fd, F_GETFD) < 0) {
+                fprintf(stderr, "pssh: %d: %s\n", fd, strerror(errno));
+                return -1;
+            }
+
+            if (fd != R->fd)
+                dup2(fd, R->fd);
+            continue;
+        }
+
+        fd = redir_open(R);
+        if (fd < 0)
+            return -1;
+
+        if (fd != R->fd) {
+            dup2(fd, R->fd);
+            close(fd);
+        }
+    }
+
+    return 0;
+}
+
+
+static void restore_fd(int saved, int fd)
+{
+    if (saved < 0) {
+        close(fd);
+        return;
+    }
+
+    dup2(saved, fd);
+    close(saved);
+}
+
+
+static void redirect_pop(SavedFds *S)
+{
+    if (S->n)
+        fflush(stdout);
+
+    while (S->n-- > 0)
+        restore_fd(S->saved[S->n], S->fd[S->n]);
+
+    // the last of the output is through once the helpers are done
+    while (S->ntees-- > 0)
+        while (waitpid(S->tees[S->ntees], NULL, 0) < 0 && errno == EINTR);
+
+    free(S->fd);
+    free(S->saved);
+    free(S->tees);
+}
+
+
+/* applies the redirections of something that runs in the shell
+ * itself (a compound command, a function, a builtin) */
+static int redirect_push(Redir *R, SavedFds *S)
+{
+    S->fd = S->saved = NULL;
+    S->n = 0;
+    S->tees = NULL;
+    S->ntees = 0;
+
+    if (!R)
+        return 0;
+
+    fflush(stdout);
+
+    if (redirect_apply(R, S) < 0) {
+        redirect_pop(S);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* forks every stage of the (expanded) pipeline, wiring up the pipes
+ * and redirections, and hands the result to job control.  Stages that
+ * are compound commands are run by a subshell copy of pssh, builtins
+ * by a plain copy.  Process substitutions from procsub_base on become
+ * part of the same job.  With lastpipe, the output of the last stage
+ * goes to a pipe whose read end is left there, and the job id is
+ * returned at once rather than the job waited for. */
+static int launch_pipeline(Parse *P, char ***argv, int *nassign,
+                           Redir **redirs, int procsub_base, int *lastpipe)
+{
+    // Prepare for job creation
+    pid_t pids[P->ntasks + nprocsubs - procsub_base];
+    int num_pids = 0;
+    // a job with a deadline is signalled as a group, so it needs one of
+    // its own even where there is no job control
+    int grouped = job_control_active || deadline_pending();
+    pid_t pgid = grouped ? 0 : getpgrp();
+    int is_background = P->background;
+    int status = 0, token = 0;
+    const char *path;
+    Node *fn;
+
+    // with a jobserver, a background job waits for a token first
+    if (is_background && (token = jobserver_acquire()) < 0)
+         return 130;
+
+    // the job's cgroup (and limits), if it is to have one
+    run_prepare(P->text);
+
+    // started first, so that they hold none of the pipeline's pipes
+    // (and the job's last pid stays that of the last stage)
+    num_pids = procsub_start(procsub_base, pids, &pgid);
+
+    // pipeline execution for multiple commands | | |
+    int num_tasks = P->ntasks;
+    int num_pipes = num_tasks - 1 + (lastpipe != NULL);
+    int pipefds[2 * num_pipes];
+
+    for (int i = 0; i < num_pipes; i++) {
+         if (run_pipe(pipefds + i*2) < 0) {
+              perror("pipe");
+              exit(EXIT_FAILURE);
+         }
+    }
+
+    // nothing buffered may be written twice by the children
+    fflush(NULL);
+
+    for (int i = 0; i < num_tasks; i++) {
+         pid_t pid = run_fork();
+         if (pid < 0) {
+              perror("fork");
+              exit(EXIT_FAILURE);
+         }
+
+         if (pid == 0) {
+              // Child process
+
+              // Join the job's process group (or start it)
+              if (grouped)
+                   setpgid(0, pgid);
+              run_child();
+
+              // Set up pipes
+              if (i > 0) {
+                   if (dup2(pipefds[(i-1)*2], STDIN_FILENO) < 0) {
+                        perror("dup2");
+                        exit(EXIT_FAILURE);
+                   }
+              }
+              if (i < num_pipes) {
+                   if (dup2(pipefds[i*2 + 1], STDOUT_FILENO) < 0) {
+                        perror("dup2");
+                        exit(EXIT_FAILURE);
+                   }
+              }
+
+              // Close all pipe fds in child
+              for (int j = 0; j < 2 * num_pipes; j++)
+                   close(pipefds[j]);
+
+              // then the stage's own redirections, which win over the pipes
+              if (redirect_apply(redirs[i], NULL) < 0)
+                   exit(EXIT_FAILURE);
+
+              if (P->tasks[i].body) {
+                   enter_subshell();
+                   loop_depth = loop_break = loop_continue = 0;
+                   exit(exec_node(P->tasks[i].body));
+              }
+
+              if (argv[i][0] && (fn = function_get(argv[i][0]))) {
+                   enter_subshell();
+                   loop_depth = loop_break = loop_continue = 0;
+                   if (do_assignments(P->tasks[i].argv, nassign[i], 0) < 0)
+                        exit(EXIT_FAILURE);
+                   exit(run_function(fn, argv[i]));
+              }
+
+              // a builtin is called as in the shell; jobs alone still
+              // sees the shell's jobs, to list them
+              if (argv[i][0] && is_builtin(argv[i][0])) {
+                   Task T = { argv[i][0], argv[i], NULL, NULL };
+
+                   if (strcmp(argv[i][0], "jobs"))
+                        enter_subshell();
+                   loop_depth = loop_break = loop_continue = 0;
+                   if (do_assignments(P->tasks[i].argv, nassign[i], 0) < 0)
+                        exit(EXIT_FAILURE);
+                   builtin_stage = 1;
+                   exit(builtin_execute(T));
+              }
+
+              // Reset signal handlers to default in child
+              child_reset_signals();
+
+              if (do_assignments(P->tasks[i].argv, nassign[i], 1) < 0)
+                   exit(EXIT_FAILURE);
+
+              if (!argv[i][0])
+                   exit(EXIT_SUCCESS);
+
+              // the parent has already looked the command up
+              if (!strchr(argv[i][0], '/') && (path = path_lookup(argv[i][0])))
+                   execv(path, argv[i]);
+              execvp(argv[i][0], argv[i]);
+              perror(argv[i][0]);
+              exit(126);
+         } else {
+              // Parent process
+              pids[num_pids++] = pid;
+
+              // Set up process group for first process
+              if (grouped) {
+                   if (!pgid)
+                        pgid = pid;
+                   setpgid(pid, pgid);
+              }
+         }
+    }
+
+    // Close all pipe fds in parent
+    for (int i = 0; i < 2 * num_pipes; i++)
+         if (!lastpipe || i != 2 * num_pipes - 2)
+              close(pipefds[i]);
+    procsub_finish(procsub_base);
+
+    // Create new job
+    int job_id = add_job(pids, num_pids, pgid, P->text, is_background ? BG : FG);
+
+    if (job_id < 0) {
+         // Failed to create job, kill all processes
+         for (int i = 0; i < num_pids; i++) {
+              kill(pids[i], SIGKILL);
+         }
+         if (token)
+              jobserver_release();
+         run_abort();
+         if (lastpipe)
+              close(pipefds[2 * num_pipes - 2]);
+         return lastpipe ? -1 : 1;
+    }
+
+    Job* job = find_job_by_job_id(job_id);
+    job->token = token;
+    deadline_start(job_id, pgid);
+    run_started(job);
+
+    if (lastpipe) {
+         *lastpipe = pipefds[2 * num_pipes - 2];
+         fcntl(*lastpipe, F_SETFD, FD_CLOEXEC);
+         return job_id;
+    }
+
+    if (!is_background) {
+         // Put job in foreground
+         status = put_job_in_foreground(job, 0);
+    } else {
+         // Put job in background
+         last_bg_pid = pids[num_pids - 1];
+         put_job_in_background(job, 0);
+    }
+
+    return status;
+}
+
+
+/* for queue and timeout, which take a command as text and need it to
+ * be one job of its own: a lone pipeline of programs is used as is,
+ * anything else (several commands, builtins, functions) is put in a
+ * ( ) subshell */
+Node *parse_job(const char *text, int background)
+{
+    ParseStatus status;
+    size_t len = strlen(text) + 8;
+    char *buf = malloc(len);
+    const char *cmd;
+    Node *N;
+    int lone;
+
+    N = pcache_parse(text, &status);
+    if (status != PARSE_OK || !N) {
+        node_destroy(&N);
+        free(buf);
+        return NULL;
+    }
+
+    lone = N->type == NODE_PIPELINE && !N->next && !N->negate;
+    if (lone && N->P->ntasks == 1) {
+        cmd = N->P->tasks[0].argv ? N->P->tasks[0].argv[0] : NULL;
+        lone = !N->P->tasks[0].body && cmd &&
+               !function_get(cmd) && !is_builtin((char *)cmd);
+    }
+
+    if (lone && (N->P->background || !background)) {
+        free(buf);
+        return N;
+    }
+    node_destroy(&N);
+
+    if (lone)
+        snprintf(buf, len, "%s &", text);
+    else
+        snprintf(buf, len, "(%s\n)%s", text, background ? " &" : "");
+
+    N = pcache_parse(buf, &status);
+    free(buf);
+    if (status != PARSE_OK)
+        node_destroy(&N);
+
+    return N;
+}
+
+
+/* for queue, timeout and run given the words of a command: runs argv,
+ * already expanded, as a job of its own named text.  A function or
+ * builtin is forked like a stage of a pipeline, so that it too is a job */
+int execute_argv(char **argv, const char *text, int background)
+{
+    Task T = { argv[0], argv, NULL, NULL };
+    Parse P = { &T, 1, background, (char *)text };
+    Redir *redirs = NULL;
+    int nassign = 0;
+
+    if (!function_get(argv[0]) && !is_builtin(argv[0]) && !command_found(argv[0])) {
+         printf("pssh: command not found: %s\n", argv[0]);
+         return 127;
+    }
+
+    return launch_pipeline(&P, &argv, &nassign, &redirs, nprocsubs, NULL);
+}
+
+
+/* in a forked child: runs the (expanded) command argv, a function or
+ * a program, and exits with its status */
+void exec_child(char **argv)
+{
+    const char *path;
+    Node *fn;
+
+    if ((fn = function_get(argv[0]))) {
+        enter_subshell();
+        loop_depth = loop_break = loop_continue = 0;
+        exit(run_function(fn, argv));
+    }
+
+    child_reset_signals();
+    if (!strchr(argv[0], '/') && (path = path_lookup(argv[0])))
+        execv(path, argv);
+    execvp(argv[0], argv);
+    perror(argv[0]);
+    exit(126);
+}
+
+
+/* starts the (expanded) command argv as a coprocess: a background job
+ * whose stdin and stdout are pipes to the shell.  fds[0] reads what it
+ * writes and fds[1] writes to it; both are close-on-exec so that no
+ * other command holds them.  Returns the job id, or -1. */
+int coproc_start(char **argv, int fds[2])
+{
+    int to[2], from[2], job_id;
+    pid_t pid, pgid;
+    char *text;
+    size_t len;
+    int i;
+
+    if (!function_get(argv[0]) && !command_found(argv[0])) {
+        printf("pssh: command not found: %s\n", argv[0]);
+        return -1;
+    }
+
+    if (pipe2(to, O_CLOEXEC) < 0) {
+        perror("pipe");
+        return -1;
+    }
+    if (pipe2(from, O_CLOEXEC) < 0) {
+        perror("pipe");
+        close(to[0]);
+        close(to[1]);
+        return -1;
+    }
+
+    fflush(NULL);
+
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(to[0]);
+        close(to[1]);
+        close(from[0]);
+        close(from[1]);
+        return -1;
+    }
+
+    /* a group of its own even without job control, so that kill %n
+     * cannot hit the shell; it never needs the terminal anyway */
+    if (pid == 0) {
+        setpgid(0, 0);
+
+        dup2(to[0], STDIN_FILENO);
+        dup2(from[1], STDOUT_FILENO);
+
+        exec_child(argv);
+    }
+
+    pgid = pid;
+    setpgid(pid, pgid);
+
+    close(to[0]);
+    close(from[1]);
+    fds[0] = from[0];
+    fds[1] = to[1];
+
+    /* the job is named after the command, as for any other */
+    len = strlen("coproc") + 1;
+    for (i=0; argv[i]; i++)
+        len += strlen(argv[i]) + 1;
+    text = malloc(len);
+    strcpy(text, "coproc");
+    for (i=0; argv[i]; i++) {
+        strcat(text, " ");
+        strcat(text, argv[i]);
+    }
+
+    job_id = add_job(&pid, 1, pgid, text, BG);
+    free(text);
+
+    if (job_id < 0) {
+        kill(pid, SIGKILL);
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    last_bg_pid = pid;
+    put_job_in_background(find_job_by_job_id(job_id), 0);
+
+    return job_id;
+}
+
+
+/* set -x: the command as it is about to run */
+static void trace_pipeline(Parse *P, char ***argv, int *nassign)
+{
+    int i, j;
+
+    fprintf(stderr, "+");
+    for (i = 0; i < P->ntasks; i++) {
+         if (i)
+              fprintf(stderr, " |");
+         if (P->tasks[i].body)
+              fprintf(stderr, " (...)");
+         for (j = 0; j < nassign[i]; j++)
+              fprintf(stderr, " %s", P->tasks[i].argv[j]);
+         for (j = 0; argv[i] && argv[i][j]; j++)
+              fprintf(stderr, " %s", argv[i][j]);
+    }
+    fprintf(stderr, "%s\n", P->background ? " &" : "");
+}
+
+
+/* a builtin at the end of a pipeline, run in the shell itself (as
+ * bash's lastpipe does, and like it only without job control): the
+ * stages before it are started as a job and it reads their output */
+static int run_lastpipe(Parse *P, char ***argv, int *nassign, Redir **redirs,
+                        int procsub_base)
+{
+    int last = P->ntasks - 1;
+    Task T = { argv[last][0], argv[last], NULL, NULL };
+    Parse front = *P;
+    SavedFds saved;
+    pid_t pgid, last_pid;
+    int fd, stdin_copy, job_id, status = 1;
+    Job *job;
+
+    if (do_assignments(P->tasks[last].argv, nassign[last], 0) < 0)
+         return 1;
+
+    front.ntasks--;
+    job_id = launch_pipeline(&front, argv, nassign, redirs, procsub_base, &fd);
+    if (job_id < 0)
+         return 1;
+    job = find_job_by_job_id(job_id);
+    pgid = job->pgid;
+    last_pid = job->last_pid;
+
+    fflush(stdout);
+    stdin_copy = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+    dup2(fd, STDIN_FILENO);
+    close(fd);
+
+    // the builtin's own redirections win over the pipe
+    if (redirect_push(redirs[last], &saved) == 0) {
+         status = builtin_execute(T);
+         redirect_pop(&saved);
+    }
+
+    // the pipe closes with this, as if the last stage had exited
+    restore_fd(stdin_copy, STDIN_FILENO);
+
+    // the builtin may have waited for children itself, the job's too
+    job = find_job_by_job_id(job_id);
+    if (job && job->pgid == pgid && job->last_pid == last_pid)
+         put_job_in_foreground(job, 0);
+
+    return status;
+}
+
+
+/* runs a pipeline whose words and redirections are expanded */
+static int run_expanded(Parse *P, char ***argv, int *nassign, Redir **redirs,
+                        int procsub_base)
+{
+    int status;
+    SavedFds saved;
+    Node *fn = NULL;
+
+    // a lone compound command runs in the shell, so that loops can
+    // update variables and use builtins without a fork
+    if (P->ntasks == 1 && P->tasks[0].body && !P->background &&
+        P->tasks[0].body->type != NODE_SUBSHELL) {
+         procsub_start(procsub_base, NULL, NULL);
+         if (redirect_push(redirs[0], &saved) < 0)
+              return 1;
+         status = exec_node(P->tasks[0].body);
+         redirect_pop(&saved);
+         return status;
+    }
+
+    // nothing but assignments (or words that expanded to nothing);
+    // the status is that of the last command substitution, if any
+    if (P->ntasks == 1 && argv[0] && !argv[0][0]) {
+         if (do_assignments(P->tasks[0].argv, nassign[0], 0) < 0)
+              return 1;
+         return subst_ran ? last_status : 0;
+    }
+
+    // functions, then builtins, run directly in the shell unless they
+    // are part of a pipeline or put in the background
+    if (P->ntasks == 1 && argv[0] && !P->background &&
+        ((fn = function_get(argv[0][0])) || is_builtin(argv[0][0]))) {
+         Task T = { argv[0][0], argv[0], NULL, NULL };
+
+         if (do_assignments(P->tasks[0].argv, nassign[0], 0) < 0)
+              return 1;
+
+         procsub_start(procsub_base, NULL, NULL);
+
+         // exec's redirections are not undone: they stay in effect for
+         // the rest of the shell (or are what the new program starts with)
+         if (!fn && !strcmp(argv[0][0], "exec")) {
+              fflush(stdout);
+              if (redirect_apply(redirs[0], NULL) < 0)
+                   return 1;
+              return builtin_execute(T);
+         }
+
+         if (redirect_push(redirs[0], &saved) < 0)
+              return 1;
+         status = fn ? run_function(fn, argv[0]) : builtin_execute(T);
+         redirect_pop(&saved);
+         return status;
+    }
+
+    for (int i = 0; i < P->ntasks; i++) {
+         if (argv[i] && argv[i][0] && !function_get(argv[i][0]) &&
+             !is_builtin(argv[i][0]) && !command_found(argv[i][0])) {
+              printf("pssh: command not found: %s\n", argv[i][0]);
+              return 127;
+         }
+    }
+
+    // a lone cat A > B needs no process at all
+    if (nprocsubs == procsub_base &&
+        (status = optimize_cat_copy(P, argv, nassign, redirs)) >= 0)
+         return status;
+
+    if (P->ntasks > 1 && !P->background && !job_control_active && argv[P->ntasks - 1] &&
+        argv[P->ntasks - 1][0] && !function_get(argv[P->ntasks - 1][0]) &&
+        is_builtin(argv[P->ntasks - 1][0]))
+         return run_lastpipe(P, argv, nassign, redirs, procsub_base);
+
+    return launch_pipeline(P, argv, nassign, redirs, procsub_base, NULL);
+}
+
+
+/* Called upon receiving a successful parse.
+ * This function is responsible for cycling through the
+ * tasks, and forking, executing, etc as necessary to get
+ * the job done! */
+int execute_tasks(Parse *P)
+{
+    if (P->ntasks <= 0)
+        return 0;
+
+    // queued jobs start as slots free up
+    queue_drain();
+
+    subst_ran = 0;
+
+    // expand every stage before anything is started
+    char **argv[P->ntasks];
+    int nassign[P->ntasks];
+    Redir *redirs[P->ntasks];
+    int expand_failed = 0;
+    int status = 1;
+    int procsub_base = nprocsubs;
+    Parse rest;
+    int skip;
+
+    for (int i = 0; i < P->ntasks; i++) {
+         nassign[i] = count_assignments(P->tasks[i].argv);
+         argv[i] = NULL;
+         redirs[i] = NULL;
+         if (expand_failed)
+              continue;
+         if (expand_redirs(P->tasks[i].redirs, &redirs[i]) < 0)
+              expand_failed = 1;
+         if (P->tasks[i].body || expand_failed)
+              continue;
+         argv[i] = expand_argv(P->tasks[i].argv + nassign[i]);
+         if (!argv[i])
+              expand_failed = 1;
+    }
+
+    if (expand_failed)
+         goto out;
+
+    if (opt_xtrace)
+         trace_pipeline(P, argv, nassign);
+
+    // cat FILE | ... loses its first stage; the job keeps its text
+    skip = optimize_cat_pipe(P, argv, nassign, redirs);
+    rest = *P;
+    rest.tasks += skip;
+    rest.ntasks -= skip;
+
+    status = run_expanded(&rest, argv + skip, nassign + skip, redirs + skip, procsub_base);
+
+out:
+    procsub_finish(procsub_base);
+    for (int i = 0; i < P->ntasks; i++) {
+         argv_free(argv[i]);
+         redir_destroy(&redirs[i]);
+    }
+
+    return status;
+}
+
+
+/* reads fd to the end into a buffer on the heap */
+static char *read_all(int fd, size_t *len)
+{
+    size_t cap = 65536;
+    char *buf = malloc(cap);
+    ssize_t n;
+
+    *len = 0;
+
+    for (;;) {
+        if (cap - *len < 65536) {
+            cap *= 2;
+            buf = realloc(buf, cap);
+        }
+
+        n = read(fd, buf + *len, cap - *len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+
+        *len += n;
+    }
+
+    return buf;
+}
+
+
+/* the pipeline of a $( ) that can run in the shell itself: a lone call
+ * of a builtin that leaves the shell alone.  A function could set
+ * variables or exit, which a subshell must keep to itself, so it forks */
+static Parse *subst_in_shell(Node *N)
+{
+    Parse *P = N->P;
+    const char *cmd;
+
+    if (N->type != NODE_PIPELINE || N->next || N->negate)
+        return NULL;
+
+    if (P->ntasks != 1 || P->background || P->tasks[0].redirs ||
+        P->tasks[0].body)
+        return NULL;
+
+    /* a plain word, so that it is the same after expansion */
+    cmd = P->tasks[0].argv[0];
+    if (strpbrk(cmd, "\"'\\$`=~"))
+        return NULL;
+
+    return !function_get(cmd) && is_subst_builtin((char *)cmd) ? P : NULL;
+}
+
+
+/* builtins print with stdio, so their output goes straight into a
+ * memory stream standing in for stdout */
+static char *subst_builtin(char **argv, size_t *len)
+{
+    Task T = { argv[0], argv, NULL, NULL };
+    FILE *saved = stdout;
+    char *buf = NULL;
+
+    fflush(stdout);
+    stdout = open_memstream(&buf, len);
+
+    last_status = builtin_execute(T);
+
+    fclose(stdout);
+    stdout = saved;
+
+    return buf;
+}
+
+
+/* anything else runs in a subshell writing into a pipe */
+static char *subst_fork(Node *N, size_t *len)
+{
+    int fds[2], status;
+    pid_t pid;
+    char *buf;
+
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        *len = 0;
+        return strdup("");
+    }
+
+    fflush(NULL);
+
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+
+    if (pid == 0) {
+        close(fds[0]);
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[1]);
+
+        enter_subshell();
+        loop_depth = loop_break = loop_continue = 0;
+        func_depth = func_return = 0;
+        exit(exec_node(N));
+    }
+
+    close(fds[1]);
+    buf = read_all(fds[0], len);
+    close(fds[0]);
+
+    /* SIGCHLD is blocked, so the handler cannot reap it first */
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+    last_status = status_to_exit_code(status);
+
+    return buf;
+}
+
+
+/* Runs the command of a $( ) or ` ` and returns its output, less any
+ * trailing newlines, or NULL if it does not parse.  $? is left at its
+ * exit status. */
+char *command_subst(const char *cmd)
+{
+    ParseStatus pstatus;
+    Node *N;
+    Parse *P;
+    char *buf, **argv;
+    size_t len = 0, i, j;
+
+    N = pcache_parse(cmd, &pstatus);
+    if (pstatus != PARSE_OK) {
+        printf("pssh: invalid syntax in command substitution: %s\n", cmd);
+        return NULL;
+    }
+
+    if (!N)
+        return strdup("");
+
+    if ((P = subst_in_shell(N))) {
+        argv = expand_argv(P->tasks[0].argv);
+        if (!argv) {
+            node_destroy(&N);
+            return NULL;
+        }
+
+        buf = subst_builtin(argv, &len);
+
+        argv_free(argv);
+    } else {
+        buf = subst_fork(N, &len);
+    }
+
+    node_destroy(&N);
+    subst_ran = 1;
+
+    /* NUL bytes cannot be part of a word */
+    for (i=j=0; i<len; i++)
+        if (buf[i])
+            buf[j++] = buf[i];
+
+    while (j > 0 && buf[j-1] == '\n')
+        j--;
+
+    buf = realloc(buf, j + 1);
+    buf[j] = '\0';
+
+    return buf;
+}
+
+
+/* true while a break, continue, return or ^C is unwinding the
+ * command tree */
+static int exec_unwinding(void)
+{
+    return loop_break || loop_continue || func_return || job_interrupted;
+}
+
+
+/* called by a loop after each pass; consumes a pending break or
+ * continue aimed at this loop and returns 1 if the loop must end */
+static int loop_should_stop(void)
+{
+    if (job_interrupted || func_return)
+        return 1;
+
+    if (loop_break) {
+        loop_break--;
+        return 1;
+    }
+
+    if (loop_continue)
+        return --loop_continue > 0;
+
+    return 0;
+}
+
+
+static int exec_loop(Node *N)
+{
+    int status = 0, cond;
+
+    loop_depth++;
+
+    for (;;) {
+        cond = exec_node(N->cond);
+        if (loop_should_stop())
+            break;
+
+        if ((cond == 0) != (N->type == NODE_WHILE))
+            break;
+
+        status = exec_node(N->body);
+        if (loop_should_stop())
+            break;
+    }
+
+    loop_depth--;
+
+    return status;
+}
+
+
+static int exec_for(Node *N)
+{
+    char **words;
+    int i, n, status = 0;
+
+    if (!var_name_valid(N->word, strlen(N->word))) {
+        fprintf(stderr, "pssh: for: `%s': not a valid identifier\n", N->word);
+        return 1;
+    }
+
+    if (N->words) {
+        words = expand_argv(N->words);
+        if (!words)
+            return 1;
+    } else {
+        n = var_npositional();
+        words = malloc((n + 1) * sizeof(*words));
+        for (i=0; i<n; i++)
+            words[i] = strdup(var_positional(i + 1));
+        words[n] = NULL;
+    }
+
+    loop_depth++;
+
+    for (i=0; words[i]; i++) {
+        var_set(N->word, words[i]);
+        status = exec_node(N->body);
+        if (loop_should_stop())
+            break;
+    }
+
+    loop_depth--;
+    argv_free(words);
+
+    return status;
+}
+
+
+static int exec_case(Node *N)
+{
+    CaseItem *C;
+    char *subject, *pattern;
+    int i, match;
+
+    subject = expand_word(N->word);
+    if (!subject)
+        return 1;
+
+    for (C=N->items; C; C=C->next) {
+        for (i=0; C->patterns[i]; i++) {
+            pattern = expand_pattern(C->patterns[i]);
+            match = pattern && !fnmatch(pattern, subject, 0);
+            free(pattern);
+
+            if (match) {
+                free(subject);
+                return C->body ? exec_node(C->body) : 0;
+            }
+        }
+    }
+
+    free(subject);
+
+    return 0;
+}
+
+
+static int exec_arith(Node *N)
+{
+    char *text;
+    long long v;
+    int ret;
+
+    text = expand_word(N->word);
+    if (!text)
+        return 1;
+
+    ret = arith_eval(text, &v);
+    free(text);
+
+    if (ret < 0)
+        return 1;
+
+    return v == 0;
+}
+
+
+static int exec_command(Node *N)
+{
+    int status = 0;
+
+    switch (N->type) {
+    case NODE_PIPELINE:
+        status = execute_tasks(N->P);
+        break;
+
+    case NODE_AND:
+    case NODE_OR:
+        status = exec_node(N->cond);
+        if (!exec_unwinding() && (status == 0) == (N->type == NODE_AND))
+            status = exec_node(N->body);
+        break;
+
+    case NODE_IF:
+        status = exec_node(N->cond);
+        if (exec_unwinding())
+            break;
+
+        if (status == 0)
+            status = exec_node(N->body);
+        else if (N->alt)
+            status = exec_node(N->alt);
+        else
+            status = 0;
+        break;
+
+    case NODE_WHILE:
+    case NODE_UNTIL:
+        status = exec_loop(N);
+        break;
+
+    case NODE_FOR:
+        status = exec_for(N);
+        break;
+
+    case NODE_CASE:
+        status = exec_case(N);
+        break;
+
+    case NODE_GROUP:
+    case NODE_SUBSHELL:     /* already forked by execute_tasks() */
+        status = exec_node(N->body);
+        break;
+
+    case NODE_ARITH:
+        status = exec_arith(N);
+        break;
+
+    case NODE_FUNCDEF:
+        status = function_define(N);
+        break;
+    }
+
+    if (N->negate)
+        status = !status;
+
+    return status;
+}
+
+
+int exec_node(Node *N)
+{
+    for (; N && !exec_unwinding(); N=N->next)
+        last_status = exec_command(N);
+
+    return last_status;
+}
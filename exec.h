@@ -0,0 +1,61 @@
+#ifndef EXEC_H
+#define EXEC_H
+
+#include <sys/types.h>
+
+#include "parse.h"
+
+extern int last_status;      /* $? */
+extern pid_t last_bg_pid;    /* $! (0 until a job is put in the background) */
+extern pid_t shell_pid;      /* $$ */
+
+/* loop state for break and continue */
+extern int loop_depth;
+extern int loop_break;       /* # of enclosing loops left to break out of */
+extern int loop_continue;    /* likewise, the last of them is continued */
+
+/* function call state for return */
+extern int func_depth;
+extern int func_return;      /* return was run; unwind to the caller */
+
+/* a builtin is running as a pipeline stage: its process ends with it */
+extern int builtin_stage;
+
+/* shell options, see set */
+extern int opt_xtrace;       /* -x: commands are shown on stderr as run */
+extern int opt_optimize;     /* -o optimize: pipelines are rewritten */
+
+Node *function_get(const char *name);
+int function_unset(const char *name);
+
+const char *path_lookup(const char *cmd);
+void path_cache_clear(void);
+void path_cache_print(void);
+
+/* output of the command of a $( ), without trailing newlines */
+char *command_subst(const char *cmd);
+
+/* <( cmd ) / >( cmd ): the /dev/fd path to substitute */
+char *proc_subst(const char *cmd, int reads);
+
+/* for commands started outside of a pipeline */
+int command_found(const char *cmd);
+void exec_child(char **argv) __attribute__((noreturn));
+
+/* shell text as the tree of a single job (with & if background), or
+ * NULL if it is not valid */
+Node *parse_job(const char *text, int background);
+
+/* runs the expanded words argv as a job of its own, named text */
+int execute_argv(char **argv, const char *text, int background);
+
+/* starts argv as a coprocess; see exec.c */
+int coproc_start(char **argv, int fds[2]);
+
+/* runs a list of commands and returns the status of the last one */
+int exec_node(Node *N);
+
+/* runs one pipeline and returns its exit status */
+int execute_tasks(Parse *P);
+
+#endif
@@ -0,0 +1,830 @@
+/* expand.c
+ * word expansion, done each time a command runs
+ *
+ * The parser stores words exactly as they were typed.  Before a
+ * command is executed each of its words is expanded here:
+ *
+ *   $name ${name}           parameter expansion
+ *   ${#name}                length of the value
+ *   ${name:-word} ${name:=word} ${name:+word}
+ *   $1 .. $9 ${10} $# $@ $* positional parameters
+ *   $? $$ $!                last exit status, shell pid, last background pid
+ *   $(( expression ))       arithmetic expansion (see arith.c)
+ *   $( command ) ` command ` command substitution (see exec.c)
+ *   <( command ) >( command ) process substitution, a /dev/fd/N path
+ *
+ * The results of unquoted expansions are split into fields on $IFS
+ * and finally quotes are removed.
+ **********************************************************************/
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arith.h"
+#include "exec.h"
+#include "expand.h"
+#include "parse.h"
+#include "vars.h"
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+} StrBuf;
+
+typedef struct {
+    char **fields;
+    int nfields;
+    int cap;
+    StrBuf cur;     /* field being built */
+    int have;       /* cur is a field, even if empty ("" was seen) */
+    int split;      /* split unquoted expansions into fields */
+    int pattern;    /* escape quoted glob characters (case patterns) */
+    int error;
+} Expander;
+
+static void expand_into(Expander *E, const char *s);
+
+
+static void sb_addn(StrBuf *sb, const char *s, size_t n)
+{
+    if (sb->len + n + 1 > sb->cap) {
+        sb->cap = (sb->len + n + 1) * 2;
+        sb->buf = realloc(sb->buf, sb->cap);
+    }
+
+    memcpy(sb->buf + sb->len, s, n);
+    sb->len += n;
+    sb->buf[sb->len] = '\0';
+}
+
+
+static void field_end(Expander *E)
+{
+    if (!E->have)
+        return;
+
+    if (E->nfields + 2 > E->cap) {
+        E->cap = E->cap ? E->cap * 2 : 8;
+        E->fields = realloc(E->fields, E->cap * sizeof(*E->fields));
+    }
+
+    E->fields[E->nfields++] = E->cur.buf ? E->cur.buf : strdup("");
+    E->fields[E->nfields] = NULL;
+
+    E->cur.buf = NULL;
+    E->cur.len = E->cur.cap = 0;
+    E->have = 0;
+}
+
+
+static void add_literal(Expander *E, const char *s, size_t n)
+{
+    sb_addn(&E->cur, s, n);
+    E->have = 1;
+}
+
+
+/* quoted text: literal even when building a pattern */
+static void add_quoted(Expander *E, const char *s, size_t n)
+{
+    size_t i;
+
+    if (!E->pattern) {
+        add_literal(E, s, n);
+        return;
+    }
+
+    for (i=0; i<n; i++) {
+        if (strchr("*?[]\\", s[i]))
+            sb_addn(&E->cur, "\\", 1);
+        sb_addn(&E->cur, &s[i], 1);
+    }
+
+    E->have = 1;
+}
+
+
+/* appends the result of an expansion, splitting it into fields on $IFS
+ * unless it was quoted */
+static void add_expansion(Expander *E, const char *val, int quoted)
+{
+    const char *ifs;
+
+    if (quoted) {
+        add_quoted(E, val, strlen(val));
+        return;
+    }
+
+    if (!E->split) {
+        add_literal(E, val, strlen(val));
+        return;
+    }
+
+    ifs = var_get("IFS");
+    if (!ifs)
+        ifs = " \t\n";
+
+    for (; *val; val++) {
+        if (strchr(ifs, *val))
+            field_end(E);
+        else
+            add_literal(E, val, 1);
+    }
+}
+
+
+static void expander_init(Expander *E, int split)
+{
+    E->fields = NULL;
+    E->nfields = E->cap = 0;
+    E->cur.buf = NULL;
+    E->cur.len = E->cur.cap = 0;
+    E->have = 0;
+    E->split = split;
+    E->pattern = 0;
+    E->error = 0;
+}
+
+
+static void expander_free(Expander *E)
+{
+    int i;
+
+    for (i=0; i<E->nfields; i++)
+        free(E->fields[i]);
+
+    free(E->fields);
+    free(E->cur.buf);
+}
+
+
+/* $* and $@ outside of "$@": the parameters joined by sep */
+static char *join_positional(char sep)
+{
+    StrBuf sb = {NULL, 0, 0};
+    int i, n = var_npositional();
+
+    sb_addn(&sb, "", 0);
+    for (i=1; i<=n; i++) {
+        if (i > 1 && sep)
+            sb_addn(&sb, &sep, 1);
+        sb_addn(&sb, var_positional(i), strlen(var_positional(i)));
+    }
+
+    return sb.buf;
+}
+
+
+/* value of the parameter name[0..len), or NULL if it is unset; *tmp
+ * receives any storage that must be freed by the caller */
+static const char *param_value(const char *name, size_t len, char **tmp)
+{
+    char buf[32], *n;
+    const char *val;
+
+    *tmp = NULL;
+
+    if (isdigit((unsigned char)name[0]))
+        return var_positional(atoi(name));
+
+    if (len == 1) {
+        switch (name[0]) {
+        case '$':
+            snprintf(buf, sizeof(buf), "%d", (int)shell_pid);
+            return *tmp = strdup(buf);
+        case '?':
+            snprintf(buf, sizeof(buf), "%d", last_status);
+            return *tmp = strdup(buf);
+        case '#':
+            snprintf(buf, sizeof(buf), "%d", var_npositional());
+            return *tmp = strdup(buf);
+        case '!':
+            if (!last_bg_pid)
+                return NULL;
+            snprintf(buf, sizeof(buf), "%d", (int)last_bg_pid);
+            return *tmp = strdup(buf);
+        case '@':
+        case '*':
+            return *tmp = join_positional(' ');
+        }
+    }
+
+    n = strndup(name, len);
+    val = var_get(n);
+    free(n);
+
+    return val;
+}
+
+
+/* length of the parameter name at s: an identifier, a digit or one of
+ * the special parameters; 0 if there is none */
+static size_t name_len(const char *s)
+{
+    size_t n = 0;
+
+    if (isdigit((unsigned char)s[0]))
+        return 1;
+
+    if (s[0] && strchr("$?#!@*", s[0]))
+        return 1;
+
+    while (isalnum((unsigned char)s[n]) || s[n] == '_')
+        n++;
+
+    return n;
+}
+
+
+/* as name_len(), but ${10} and up may have several digits */
+static size_t brace_name_len(const char *s)
+{
+    size_t n = 0;
+
+    if (!isdigit((unsigned char)s[0]))
+        return name_len(s);
+
+    while (isdigit((unsigned char)s[n]))
+        n++;
+
+    return n;
+}
+
+
+/* $@ and $*: every positional parameter becomes a field of its own,
+ * except in "$*" where they are joined into one */
+static void expand_positional(Expander *E, char c, int quoted)
+{
+    const char *ifs;
+    char *joined;
+    int i, n = var_npositional();
+
+    if (quoted && c == '*') {
+        ifs = var_get("IFS");
+        joined = join_positional(ifs ? ifs[0] : ' ');
+        add_quoted(E, joined, strlen(joined));
+        free(joined);
+        return;
+    }
+
+    /* "$@" with no parameters produces no field at all */
+    if (quoted && !n && !E->cur.len)
+        E->have = 0;
+
+    for (i=1; i<=n; i++) {
+        if (i > 1)
+            field_end(E);
+        add_expansion(E, var_positional(i), quoted);
+    }
+}
+
+
+/* ${name[@]} and ${name[*]}: as $@ and $* for the array's elements */
+static void expand_array(Expander *E, const char *name, char c, int quoted)
+{
+    StrBuf sb = {NULL, 0, 0};
+    const char *ifs;
+    char sep, **elems;
+    int i, n;
+
+    elems = var_get_array(name, &n);
+
+    if (quoted && c == '*') {
+        ifs = var_get("IFS");
+        sep = ifs ? ifs[0] : ' ';
+        sb_addn(&sb, "", 0);
+        for (i=0; i<n; i++) {
+            if (i && sep)
+                sb_addn(&sb, &sep, 1);
+            sb_addn(&sb, elems[i], strlen(elems[i]));
+        }
+        add_quoted(E, sb.buf, sb.len);
+        free(sb.buf);
+        return;
+    }
+
+    if (quoted && !n && !E->cur.len)
+        E->have = 0;
+
+    for (i=0; i<n; i++) {
+        if (i)
+            field_end(E);
+        add_expansion(E, elems[i], quoted);
+    }
+}
+
+
+/* [subscript] after the name of a ${ }: returns its end, with the
+ * (arithmetic) index in *index, or with *all set for [@] and [*];
+ * NULL if it is malformed */
+static const char *subscript(const char *s, int *index, char *all)
+{
+    const char *close = strchr(s, ']');
+    char *expr, *text;
+    long long v;
+
+    if (!close)
+        return NULL;
+
+    if (close == s + 2 && (s[1] == '@' || s[1] == '*')) {
+        *all = s[1];
+        return close + 1;
+    }
+
+    expr = strndup(s + 1, close - (s + 1));
+    text = expand_word(expr);
+    free(expr);
+
+    if (!text || arith_eval(text, &v) < 0) {
+        free(text);
+        return NULL;
+    }
+
+    free(text);
+    *all = 0;
+    *index = (int)v;
+
+    return close + 1;
+}
+
+
+/* ${...}: body holds the text between the braces */
+static void expand_brace(Expander *E, const char *body, int quoted)
+{
+    const char *val, *op;
+    char *tmp, *word, *res, all = 0;
+    size_t n;
+    int length = 0, colon = 0, index = 0, subscripted = 0;
+
+    if (body[0] == '#' && body[1]) {
+        length = 1;
+        body++;
+    }
+
+    n = brace_name_len(body);
+    if (!n) {
+        fprintf(stderr, "pssh: ${%s}: bad substitution\n", body);
+        E->error = 1;
+        return;
+    }
+
+    op = body + n;
+
+    if (*op == '[' && var_name_valid(body, n)) {
+        op = subscript(op, &index, &all);
+        if (!op) {
+            fprintf(stderr, "pssh: ${%s}: bad subscript\n", body);
+            E->error = 1;
+            return;
+        }
+        subscripted = 1;
+    }
+
+    tmp = NULL;
+    res = strndup(body, n);
+
+    if (all) {
+        if (*op) {
+            fprintf(stderr, "pssh: ${%s}: bad substitution\n", body);
+            E->error = 1;
+        } else if (length) {
+            char buf[32];
+
+            var_get_array(res, &index);
+            snprintf(buf, sizeof(buf), "%d", index);
+            add_expansion(E, buf, quoted);
+        } else {
+            expand_array(E, res, all, quoted);
+        }
+        free(res);
+        return;
+    }
+
+    val = subscripted ? var_get_elem(res, index) : param_value(body, n, &tmp);
+
+    if (length) {
+        char buf[32];
+
+        if (*op) {
+            fprintf(stderr, "pssh: ${#%s}: bad substitution\n", body);
+            E->error = 1;
+        } else {
+            snprintf(buf, sizeof(buf), "%zu", val ? strlen(val) : (size_t)0);
+            add_expansion(E, buf, quoted);
+        }
+        free(tmp);
+        free(res);
+        return;
+    }
+
+    if (!*op) {
+        if (val)
+            add_expansion(E, val, quoted);
+        free(tmp);
+        free(res);
+        return;
+    }
+
+    if (*op == ':') {
+        colon = 1;
+        op++;
+    }
+
+    if (!strchr("-=+", *op) || !*op) {
+        fprintf(stderr, "pssh: ${%s}: bad substitution\n", body);
+        E->error = 1;
+        free(tmp);
+        free(res);
+        return;
+    }
+
+    /* "unset" for the :- style operators includes the empty string */
+    if (val && colon && !*val)
+        val = NULL;
+
+    if ((*op == '+') == !!val) {
+        word = expand_word(op + 1);
+        if (!word) {
+            E->error = 1;
+        } else {
+            if (*op == '=' && subscripted)
+                var_set_elem(res, index, word);
+            else if (*op == '=')
+                var_set(res, word);
+            add_expansion(E, word, quoted);
+            free(word);
+        }
+    } else if (val && *op != '+') {
+        add_expansion(E, val, quoted);
+    }
+
+    free(tmp);
+    free(res);
+}
+
+
+static void expand_arith(Expander *E, const char *expr, int quoted)
+{
+    char buf[32], *text;
+    long long v;
+
+    text = expand_word(expr);
+    if (!text || arith_eval(text, &v) < 0) {
+        E->error = 1;
+        free(text);
+        return;
+    }
+
+    snprintf(buf, sizeof(buf), "%lld", v);
+    add_expansion(E, buf, quoted);
+    free(text);
+}
+
+
+/* $( ... ) and ` ... `: cmd is the text of the command */
+static void expand_command(Expander *E, const char *cmd, int quoted)
+{
+    char *out = command_subst(cmd);
+
+    if (!out) {
+        E->error = 1;
+        return;
+    }
+
+    add_expansion(E, out, quoted);
+    free(out);
+}
+
+
+/* s[*i] is a backquote; expands the command up to the closing one,
+ * where \$ \` and \\ stand for the character itself */
+static void expand_backquote(Expander *E, const char *s, size_t *i, int quoted)
+{
+    StrBuf cmd = {NULL, 0, 0};
+    size_t j;
+
+    sb_addn(&cmd, "", 0);
+
+    for (j=*i+1; s[j] && s[j] != '`'; j++) {
+        if (s[j] == '\\' && s[j+1] && strchr("$`\\", s[j+1]))
+            j++;
+        sb_addn(&cmd, &s[j], 1);
+    }
+
+    expand_command(E, cmd.buf, quoted);
+    free(cmd.buf);
+
+    *i = s[j] ? j + 1 : j;
+}
+
+
+/* s[*i] starts <( ... ) or >( ... ) */
+static void expand_proc_subst(Expander *E, const char *s, size_t *i)
+{
+    size_t start = *i, end;
+    char *inner, *path;
+
+    end = parse_skip_subst(s, start);
+    if (!end) {
+        fprintf(stderr, "pssh: %s: unterminated process substitution\n", &s[start]);
+        E->error = 1;
+        *i = strlen(s);
+        return;
+    }
+
+    inner = strndup(&s[start+2], end - 1 - (start+2));
+    path = proc_subst(inner, s[start] == '>');
+    free(inner);
+
+    if (!path) {
+        E->error = 1;
+    } else {
+        add_literal(E, path, strlen(path));
+        free(path);
+    }
+
+    *i = end;
+}
+
+
+/* s[*i] is a '$'; expands what follows and advances *i past it */
+static void expand_dollar(Expander *E, const char *s, size_t *i, int quoted)
+{
+    const char *val;
+    char *tmp, *inner;
+    size_t start = *i, end, k, n;
+
+    if (s[start+1] == '(' && s[start+2] == '(') {
+        end = parse_skip_subst(s, start);
+        k = parse_skip_subst(s, start+1);
+
+        /* $(( ... )) only if the inner parens close right at the end */
+        if (end && k && s[k] == ')' && k + 1 == end) {
+            inner = strndup(&s[start+3], k - 1 - (start+3));
+            expand_arith(E, inner, quoted);
+            free(inner);
+            *i = end;
+            return;
+        }
+    }
+
+    if (s[start+1] == '(') {
+        end = parse_skip_subst(s, start);
+        if (!end) {
+            fprintf(stderr, "pssh: %s: unterminated command substitution\n", &s[start]);
+            E->error = 1;
+            *i = strlen(s);
+            return;
+        }
+        inner = strndup(&s[start+2], end - 1 - (start+2));
+        expand_command(E, inner, quoted);
+        free(inner);
+        *i = end;
+        return;
+    }
+
+    if (s[start+1] == '{') {
+        end = parse_skip_subst(s, start);
+        if (!end) {
+            fprintf(stderr, "pssh: %s: bad substitution\n", &s[start]);
+            E->error = 1;
+            *i = strlen(s);
+            return;
+        }
+        inner = strndup(&s[start+2], end - 1 - (start+2));
+        expand_brace(E, inner, quoted);
+        free(inner);
+        *i = end;
+        return;
+    }
+
+    n = name_len(&s[start+1]);
+    if (!n) {
+        add_literal(E, "$", 1);
+        *i = start + 1;
+        return;
+    }
+
+    if (s[start+1] == '@' || s[start+1] == '*') {
+        expand_positional(E, s[start+1], quoted);
+        *i = start + 2;
+        return;
+    }
+
+    val = param_value(&s[start+1], n, &tmp);
+    if (val)
+        add_expansion(E, val, quoted);
+    else if (quoted)
+        E->have = 1;
+    free(tmp);
+
+    *i = start + 1 + n;
+}
+
+
+static void expand_into(Expander *E, const char *s)
+{
+    size_t i = 0, j;
+
+    while (s[i] && !E->error) {
+        switch (s[i]) {
+        case '\\':
+            if (s[i+1] == '\n') {
+                i += 2;
+            } else if (s[i+1]) {
+                add_quoted(E, &s[i+1], 1);
+                i += 2;
+            } else {
+                add_literal(E, &s[i], 1);
+                i++;
+            }
+            break;
+
+        case '\'':
+            for (j=i+1; s[j] && s[j] != '\''; j++);
+            add_quoted(E, &s[i+1], j - (i+1));
+            i = s[j] ? j + 1 : j;
+            break;
+
+        case '"':
+            E->have = 1;
+            for (i++; s[i] && s[i] != '"' && !E->error; ) {
+                if (s[i] == '\\' && s[i+1] && strchr("$`\"\\\n", s[i+1])) {
+                    if (s[i+1] != '\n')
+                        add_quoted(E, &s[i+1], 1);
+                    i += 2;
+                } else if (s[i] == '$') {
+                    expand_dollar(E, s, &i, 1);
+                } else if (s[i] == '`') {
+                    expand_backquote(E, s, &i, 1);
+                } else {
+                    add_quoted(E, &s[i], 1);
+                    i++;
+                }
+            }
+            if (s[i])
+                i++;
+            break;
+
+        case '$':
+            expand_dollar(E, s, &i, 0);
+            break;
+
+        case '`':
+            expand_backquote(E, s, &i, 0);
+            break;
+
+        case '<':
+        case '>':
+            if (s[i+1] == '(') {
+                expand_proc_subst(E, s, &i);
+                break;
+            }
+            add_literal(E, &s[i], 1);
+            i++;
+            break;
+
+        default:
+            add_literal(E, &s[i], 1);
+            i++;
+        }
+    }
+}
+
+
+char **expand_argv(char **words)
+{
+    Expander E;
+    char **argv;
+
+    expander_init(&E, 1);
+
+    for (; *words && !E.error; words++) {
+        expand_into(&E, *words);
+        field_end(&E);
+    }
+
+    if (E.error) {
+        expander_free(&E);
+        return NULL;
+    }
+
+    free(E.cur.buf);
+
+    argv = E.fields;
+    if (!argv) {
+        argv = malloc(sizeof(*argv));
+        argv[0] = NULL;
+    }
+
+    return argv;
+}
+
+
+char *expand_word(const char *word)
+{
+    Expander E;
+    char *ret;
+
+    expander_init(&E, 0);
+    expand_into(&E, word);
+
+    if (E.error) {
+        expander_free(&E);
+        return NULL;
+    }
+
+    ret = E.cur.buf ? E.cur.buf : strdup("");
+    free(E.fields);
+
+    return ret;
+}
+
+
+/**
+ * The text of a here-document: parameter, arithmetic and command
+ * substitution as within double quotes, but quotes are kept as they are
+ */
+char *expand_heredoc(const char *s)
+{
+    Expander E;
+    size_t i = 0;
+    char *ret;
+
+    expander_init(&E, 0);
+
+    while (s[i] && !E.error) {
+        if (s[i] == '\\' && s[i+1] && strchr("$`\\\n", s[i+1])) {
+            if (s[i+1] != '\n')
+                add_quoted(&E, &s[i+1], 1);
+            i += 2;
+        } else if (s[i] == '$') {
+            expand_dollar(&E, s, &i, 1);
+        } else if (s[i] == '`') {
+            expand_backquote(&E, s, &i, 1);
+        } else {
+            add_quoted(&E, &s[i], 1);
+            i++;
+        }
+    }
+
+    if (E.error) {
+        expander_free(&E);
+        return NULL;
+    }
+
+    ret = E.cur.buf ? E.cur.buf : strdup("");
+    free(E.fields);
+
+    return ret;
+}
+
+
+char *expand_pattern(const char *word)
+{
+    Expander E;
+    char *ret;
+
+    expander_init(&E, 0);
+    E.pattern = 1;
+    expand_into(&E, word);
+
+    if (E.error) {
+        expander_free(&E);
+        return NULL;
+    }
+
+    ret = E.cur.buf ? E.cur.buf : strdup("");
+    free(E.fields);
+
+    return ret;
+}
+
+
+size_t is_assignment(const char *word)
+{
+    const char *eq = strchr(word, '=');
+
+    if (!eq || !var_name_valid(word, eq - word))
+        return 0;
+
+    return eq - word;
+}
+
+
+void argv_free(char **argv)
+{
+    int i;
+
+    if (!argv)
+        return;
+
+    for (i=0; argv[i]; i++)
+        free(argv[i]);
+
+    free(argv);
+}
@@ -0,0 +1,30 @@
+#ifndef EXPAND_H
+#define EXPAND_H
+
+#include <stddef.h>
+
+/* Expands the raw words of a command (as stored by the parser) into an
+ * argument vector: parameter and arithmetic expansion, field splitting
+ * of unquoted expansions and quote removal.  Returns a NULL terminated
+ * array on the heap, or NULL if an expansion failed. */
+char **expand_argv(char **words);
+
+/* As above for a single word without field splitting, as used for
+ * assignments and redirection targets.  Returns NULL on failure. */
+char *expand_word(const char *word);
+
+/* As expand_word(), but quoted characters are escaped so that the
+ * result can be handed to fnmatch() as a pattern */
+char *expand_pattern(const char *word);
+
+/* The text of a here-document with an unquoted delimiter: $ and `
+ * expansions as within double quotes, without quote removal */
+char *expand_heredoc(const char *text);
+
+/* Returns the offset of the '=' if word is a NAME=value assignment,
+ * 0 otherwise */
+size_t is_assignment(const char *word);
+
+void argv_free(char **argv);
+
+#endif
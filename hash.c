@@ -0,0 +1,182 @@
+/* hash.c
+ * string keyed hash table used for shell variables and the like
+ *
+ **********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+
+#define HASH_INITIAL_BUCKETS 64
+
+/* FNV-1a */
+static unsigned int hash_string(const char *s)
+{
+    unsigned int h = 2166136261u;
+
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+
+static void hash_grow(HashTable *H)
+{
+    size_t i, nbuckets = H->nbuckets * 2;
+    HashEntry **buckets = calloc(nbuckets, sizeof(*buckets));
+    HashEntry *e, *next;
+
+    if (!buckets)
+        return;
+
+    for (i=0; i<H->nbuckets; i++) {
+        for (e=H->buckets[i]; e; e=next) {
+            next = e->next;
+            e->next = buckets[e->hash & (nbuckets-1)];
+            buckets[e->hash & (nbuckets-1)] = e;
+        }
+    }
+
+    free(H->buckets);
+    H->buckets = buckets;
+    H->nbuckets = nbuckets;
+}
+
+
+HashTable *hash_new(void (*free_value)(void *))
+{
+    HashTable *H = malloc(sizeof(*H));
+
+    H->nbuckets = HASH_INITIAL_BUCKETS;
+    H->buckets = calloc(H->nbuckets, sizeof(*H->buckets));
+    H->count = 0;
+    H->free_value = free_value;
+
+    return H;
+}
+
+
+HashEntry *hash_lookup(HashTable *H, const char *key)
+{
+    unsigned int h = hash_string(key);
+    HashEntry *e;
+
+    for (e=H->buckets[h & (H->nbuckets-1)]; e; e=e->next)
+        if (e->hash == h && !strcmp(e->key, key))
+            return e;
+
+    return NULL;
+}
+
+
+void *hash_get(HashTable *H, const char *key)
+{
+    HashEntry *e = hash_lookup(H, key);
+
+    return e ? e->value : NULL;
+}
+
+
+void hash_put(HashTable *H, const char *key, void *value)
+{
+    HashEntry *e = hash_lookup(H, key);
+
+    if (e) {
+        if (H->free_value && e->value && e->value != value)
+            H->free_value(e->value);
+        e->value = value;
+        return;
+    }
+
+    if (H->count >= H->nbuckets)
+        hash_grow(H);
+
+    e = malloc(sizeof(*e));
+    e->key = strdup(key);
+    e->value = value;
+    e->hash = hash_string(key);
+    e->next = H->buckets[e->hash & (H->nbuckets-1)];
+    H->buckets[e->hash & (H->nbuckets-1)] = e;
+    H->count++;
+}
+
+
+int hash_remove(HashTable *H, const char *key)
+{
+    unsigned int h = hash_string(key);
+    HashEntry **pe, *e;
+
+    for (pe=&H->buckets[h & (H->nbuckets-1)]; *pe; pe=&(*pe)->next) {
+        e = *pe;
+        if (e->hash == h && !strcmp(e->key, key)) {
+            *pe = e->next;
+            if (H->free_value && e->value)
+                H->free_value(e->value);
+            free(e->key);
+            free(e);
+            H->count--;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+void hash_clear(HashTable *H)
+{
+    size_t i;
+    HashEntry *e, *next;
+
+    for (i=0; i<H->nbuckets; i++) {
+        for (e=H->buckets[i]; e; e=next) {
+            next = e->next;
+            if (H->free_value && e->value)
+                H->free_value(e->value);
+            free(e->key);
+            free(e);
+        }
+        H->buckets[i] = NULL;
+    }
+
+    H->count = 0;
+}
+
+
+void hash_destroy(HashTable **H)
+{
+    if (!*H)
+        return;
+
+    hash_clear(*H);
+    free((*H)->buckets);
+    free(*H);
+    *H = NULL;
+}
+
+
+HashEntry *hash_first(HashTable *H, size_t *iter)
+{
+    for (*iter=0; *iter<H->nbuckets; (*iter)++)
+        if (H->buckets[*iter])
+            return H->buckets[*iter];
+
+    return NULL;
+}
+
+
+HashEntry *hash_next(HashTable *H, HashEntry *e, size_t *iter)
+{
+    if (e->next)
+        return e->next;
+
+    for ((*iter)++; *iter<H->nbuckets; (*iter)++)
+        if (H->buckets[*iter])
+            return H->buckets[*iter];
+
+    return NULL;
+}
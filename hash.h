@@ -0,0 +1,36 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+
+/* A string keyed hash table with chained buckets.  Keys are copied
+ * into the table; values are opaque pointers owned by the caller
+ * unless a destructor is supplied at creation time. */
+
+typedef struct HashEntry {
+    char *key;
+    void *value;
+    unsigned int hash;
+    struct HashEntry *next;
+} HashEntry;
+
+typedef struct {
+    HashEntry **buckets;
+    size_t nbuckets;
+    size_t count;
+    void (*free_value)(void *);
+} HashTable;
+
+HashTable *hash_new(void (*free_value)(void *));
+void hash_destroy(HashTable **H);
+void *hash_get(HashTable *H, const char *key);
+HashEntry *hash_lookup(HashTable *H, const char *key);
+void hash_put(HashTable *H, const char *key, void *value);
+int hash_remove(HashTable *H, const char *key);
+void hash_clear(HashTable *H);
+
+/* iterate: for (e = hash_first(H, &i); e; e = hash_next(H, e, &i)) */
+HashEntry *hash_first(HashTable *H, size_t *iter);
+HashEntry *hash_next(HashTable *H, HashEntry *e, size_t *iter);
+
+#endif
@@ -8,15 +8,47 @@
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
+#include <sys/resource.h>
+#include <sys/select.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <termios.h>
 #include <errno.h>
 
+#include "deadline.h"
+#include "expand.h"
 #include "job_control.h"
+#include "jobserver.h"
+#include "run.h"
 
-Job jobs[100];
+Job *jobs;
 int num_jobs = 0;
+static int jobs_cap = 0;
+
+pid_t shell_pgid;
+int job_control_active = 1;
+volatile sig_atomic_t job_interrupted = 0;
+
+static int fg_exit_status = 0;
+
+/* the most recent jobs to finish, newest at done_count - 1; written by
+ * the SIGCHLD handler, so no more than a fixed ring */
+#define DONE_RING 64
+static struct {
+    int job_id;
+    pid_t pid;
+    int status;                 /* exit code */
+} done_ring[DONE_RING];
+static volatile unsigned long done_count;
+
+static void record_done(Job *job) {
+    int slot = done_count % DONE_RING;
+
+    done_ring[slot].job_id = job->job_id;
+    done_ring[slot].pid = job->last_pid;
+    done_ring[slot].status = status_to_exit_code(job->exit_status);
+    done_count++;
+}
 
 /**
  * Sets the process group ID that has control of the terminal foreground
@@ -24,6 +56,9 @@ int num_jobs = 0;
  * when it gives terminal control to another process group
  */
 void set_fg_pgid(pid_t pgid) {
+    if (!job_control_active)
+        return;
+
     void (*old_handler)(int) = signal(SIGTTOU, SIG_IGN);
     
     tcsetpgrp(STDIN_FILENO, pgid);
@@ -48,8 +83,9 @@ static void sigchld_handler(int sig) {
     (void)sig; 
     pid_t pid;
     int status;
+    struct rusage ru;
     
-    while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0) {
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &ru)) > 0) {
         Job* job = NULL;
         for (int i = 0; i < num_jobs; i++) {
             for (unsigned int j = 0; j < jobs[i].npids; j++) {
@@ -66,8 +102,10 @@ static void sigchld_handler(int sig) {
         if (WIFSTOPPED(status)) {
             if (job->status == FG) {
                 job->status = STOPPED;
+                fg_exit_status = status;
+                job_interrupted = 1;
                 
-                set_fg_pgid(getpid());
+                set_fg_pgid(shell_pgid);
                 
                 // status message
                 printf("\n[%d] + suspended %s\n", job->job_id, job->name);
@@ -87,11 +125,21 @@ static void sigchld_handler(int sig) {
             for (unsigned int j = 0; j < job->npids; j++) {
                 if (job->pids[j] == pid) {
                     job->pids[j] = 0;  // terminated
+                    if (j == job->npids - 1)
+                        job->exit_status = status;
                     break;
                 }
             }
+            job->csw += ru.ru_nvcsw + ru.ru_nivcsw;
+
+            // whoever schedules the job's processes learns of each one
+            if (job->reaped)
+                job->reaped(job, pid, status);
+
+            if (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT && job->status == FG)
+                job_interrupted = 1;
             
-            int all_done = 1;
+            int all_done = !job->open;
             for (unsigned int j = 0; j < job->npids; j++) {
                 if (job->pids[j] != 0) {
                     all_done = 0;
@@ -100,8 +148,10 @@ static void sigchld_handler(int sig) {
             }
             
             if (all_done) {
+                record_done(job);
                 if (job->status == FG) {
-                    set_fg_pgid(getpid());
+                    fg_exit_status = job->exit_status;
+                    set_fg_pgid(shell_pgid);
                     remove_job(job->job_id);
                     
                     kill(getpid(), SIGUSR1);
@@ -149,6 +199,7 @@ static void sigint_handler(int sig) {
     }
     
     if (!found_fg_job) {
+        job_interrupted = 1;
         write(STDOUT_FILENO, "\n", 1);
         kill(getpid(), SIGUSR1);
     }
@@ -156,17 +207,11 @@ static void sigint_handler(int sig) {
 
 /**
  * Initialize job control subsystem
- * Sets up signal handlers and process group for the shell
+ * Sets up signal handlers and process group for the shell.  A shell
+ * that runs a script (not interactive) does not do job control: its
+ * children stay in its process group and ^C goes to all of them.
  */
-void init_job_control(void) {
-    pid_t shell_pgid = getpid();
-    if (setpgid(shell_pgid, shell_pgid) < 0) {
-        perror("setpgid");
-        exit(EXIT_FAILURE);
-    }
-
-    set_fg_pgid(shell_pgid);
-
+void init_job_control(int interactive) {
     struct sigaction sa;
     sa.sa_flags = SA_RESTART;
     sigemptyset(&sa.sa_mask);
@@ -174,20 +219,95 @@ void init_job_control(void) {
     sa.sa_handler = sigchld_handler;
     sigaction(SIGCHLD, &sa, NULL);
 
+    sa.sa_handler = sigusr1_handler;
+    sigaction(SIGUSR1, &sa, NULL);
+
+    /* SIGCHLD is only let through while the shell waits (for a job,
+     * or for input at the prompt) so that the handler never runs in
+     * the middle of the shell's own bookkeeping */
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    if (!interactive) {
+        job_control_active = 0;
+        shell_pgid = getpgrp();
+        return;
+    }
+
+    shell_pgid = getpid();
+    if (setpgid(shell_pgid, shell_pgid) < 0) {
+        perror("setpgid");
+        exit(EXIT_FAILURE);
+    }
+
+    set_fg_pgid(shell_pgid);
+
     sa.sa_handler = sigtstp_handler;
     sigaction(SIGTSTP, &sa, NULL);
 
     sa.sa_handler = sigint_handler;
     sigaction(SIGINT, &sa, NULL);
-    
-    sa.sa_handler = sigusr1_handler;
-    sigaction(SIGUSR1, &sa, NULL);
 
     signal(SIGTTIN, SIG_IGN);
     signal(SIGTTOU, SIG_IGN);
     signal(SIGQUIT, SIG_IGN);
 }
 
+/**
+ * Restore default signal dispositions in a child that is about to exec
+ */
+void child_reset_signals(void) {
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+}
+
+/**
+ * Turn a forked child into a subshell that runs shell code itself
+ * (a compound command in a pipeline, a background list, ...).
+ * It inherits no jobs and leaves process groups and the terminal
+ * alone: its children stay in the job's process group.
+ */
+void enter_subshell(void) {
+    for (int i = 0; i < num_jobs; i++) {
+        free(jobs[i].name);
+        free(jobs[i].pids);
+        argv_free(jobs[i].argv);
+    }
+    num_jobs = 0;
+
+    job_control_active = 0;
+    shell_pgid = getpgrp();
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+}
+
+/**
+ * Convert a wait status into a shell exit code ($?)
+ */
+int status_to_exit_code(int status) {
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    if (WIFSTOPPED(status))
+        return 128 + WSTOPSIG(status);
+    return status;
+}
+
 /**
  * Check if a process with the given pid exists
  * Returns 1 if process exists, 0 otherwise
@@ -203,6 +323,8 @@ int process_exists(pid_t pid) {
  */
 int job_is_completed(Job* job) {
     if (!job) return 1;
+
+    if (job->open || job->status == QUEUED) return 0;
     
     for (unsigned int i = 0; i < job->npids; i++) {
         if (job->pids[i] != 0 && process_exists(job->pids[i])) {
@@ -224,6 +346,26 @@ int job_is_stopped(Job* job) {
     return job->status == STOPPED;
 }
 
+/**
+ * Send a signal to every process of a job.  Without job control a job
+ * may share the shell's process group, so its processes are signalled
+ * one by one rather than the group (which would take the shell too).
+ * Returns -1 with errno set if any could not be signalled
+ */
+int job_kill(Job* job, int sig) {
+    int ret = 0;
+
+    if (job->pgid != shell_pgid && job->pgid != getpgrp())
+        return killpg(job->pgid, sig);
+
+    for (unsigned int i = 0; i < job->npids; i++) {
+        if (job->pids[i] != 0 && kill(job->pids[i], sig) < 0 && errno != ESRCH)
+            ret = -1;
+    }
+
+    return ret;
+}
+
 /**
  * Update the status of a specific process in a job
  * (Function stub - implementation not provided in the code)
@@ -254,6 +396,9 @@ void print_job_status(Job* job, int show_pid) {
         case TERM:
             printf("done ");
             break;
+        case QUEUED:
+            printf("queued ");
+            break;
     }
 
     printf("%s", job->name);
@@ -273,8 +418,8 @@ void print_job_status(Job* job, int show_pid) {
  * Move a job to the foreground
  * If cont is true, continue the job if it was stopped
  */
-void put_job_in_foreground(Job* job, int cont) {
-    if (!job) return;
+int put_job_in_foreground(Job* job, int cont) {
+    if (!job) return 1;
     
     set_fg_pgid(job->pgid);
 
@@ -289,7 +434,7 @@ void put_job_in_foreground(Job* job, int cont) {
 
     job->status = FG;
     
-    wait_for_job(job);
+    return wait_for_job(job);
 }
 
 /**
@@ -321,27 +466,32 @@ void put_job_in_background(Job* job, int cont) {
 
 /**
  * Wait for a foreground job to complete or be suspended
- * Returns terminal control to the shell when done
+ * Returns terminal control to the shell when done, and the
+ * job's exit code
  */
-void wait_for_job(Job* job) {
-    if (!job) return;
-    
-    if (job_is_completed(job)) {
-        job->status = TERM;
-        set_fg_pgid(getpid());
-        remove_job(job->job_id);
-        return;
-    }
+int wait_for_job(Job* job) {
+    if (!job) return 0;
     
-    while (job->status == FG) {
-        if (job_is_completed(job) || job_is_stopped(job)) {
-            break;
-        }
-        
-        pause();
-    }
+    int job_id = job->job_id;
+    sigset_t mask, prev, waitmask;
+
+    // SIGCHLD stays blocked between the check and sigsuspend() so a
+    // child that exits in between cannot be missed
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &prev);
+    waitmask = prev;
+    sigdelset(&waitmask, SIGCHLD);
+
+    fg_exit_status = 0;
+    while ((job = find_job_by_job_id(job_id)) && job->status == FG)
+        sigsuspend(&waitmask);
+
+    sigprocmask(SIG_SETMASK, &prev, NULL);
     
-    set_fg_pgid(getpid());
+    set_fg_pgid(shell_pgid);
+
+    return status_to_exit_code(fg_exit_status);
 }
 
 /**
@@ -351,7 +501,8 @@ void wait_for_job(Job* job) {
 int add_job(pid_t* pids, int npids, pid_t pgid, char* cmdline, JobStatus status) {
     int job_id = 0;
     
-    for (int i = 0; i < 100; i++) {
+    // the lowest number not in use
+    for (int i = 0; i <= num_jobs; i++) {
         int id_taken = 0;
         for (int j = 0; j < num_jobs; j++) {
             if (jobs[j].job_id == i) {
@@ -365,9 +516,17 @@ int add_job(pid_t* pids, int npids, pid_t pgid, char* cmdline, JobStatus status)
         }
     }
 
-    if (num_jobs >= 100) {
-        fprintf(stderr, "Maximum number of jobs exceeded\n");
-        return -1;
+    // the table grows as needed; SIGCHLD is blocked here, so the
+    // handler never sees it half moved
+    if (num_jobs == jobs_cap) {
+        int cap = jobs_cap ? jobs_cap * 2 : 16;
+        Job *grown = realloc(jobs, cap * sizeof(Job));
+        if (!grown) {
+            fprintf(stderr, "Maximum number of jobs exceeded\n");
+            return -1;
+        }
+        jobs = grown;
+        jobs_cap = cap;
     }
 
     // initialize new job
@@ -377,20 +536,108 @@ int add_job(pid_t* pids, int npids, pid_t pgid, char* cmdline, JobStatus status)
     jobs[num_jobs].status = status;
     jobs[num_jobs].name = strdup(cmdline);
     jobs[num_jobs].npids = npids;
+    jobs[num_jobs].exit_status = 0;
+    jobs[num_jobs].open = 0;
+    jobs[num_jobs].reaped = NULL;
+    jobs[num_jobs].data = NULL;
+    jobs[num_jobs].token = 0;
+    jobs[num_jobs].prio = 0;
+    jobs[num_jobs].qseq = 0;
+    jobs[num_jobs].argv = NULL;
+    jobs[num_jobs].last_pid = npids ? pids[npids - 1] : 0;
+    jobs[num_jobs].cgroup = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &jobs[num_jobs].started);
+    jobs[num_jobs].csw = 0;
+    jobs[num_jobs].pipe_auto = 0;
     jobs[num_jobs].pids = malloc(npids * sizeof(pid_t));
-    memcpy(jobs[num_jobs].pids, pids, npids * sizeof(pid_t));
+    if (npids)
+        memcpy(jobs[num_jobs].pids, pids, npids * sizeof(pid_t));
 
     num_jobs++;
     return job_id;
 }
+/**
+ * Add another process to an open job (one whose processes are started
+ * over time, e.g. the batches of xargs)
+ */
+void job_add_pid(Job* job, pid_t pid) {
+    // the slot of one that is gone will do, so the list stays as long
+    // as the most that ever ran at once
+    for (unsigned int i = 0; i < job->npids; i++) {
+        if (job->pids[i] == 0) {
+            job->pids[i] = pid;
+            return;
+        }
+    }
+
+    job->pids = realloc(job->pids, (job->npids + 1) * sizeof(pid_t));
+    job->pids[job->npids++] = pid;
+}
+
+int job_done_status(int job_id, pid_t pid) {
+    unsigned long n = done_count;
+
+    for (unsigned long i = n; i > 0 && n - i < DONE_RING; i--) {
+        int slot = (i - 1) % DONE_RING;
+        if (pid > 0 ? done_ring[slot].pid == pid : done_ring[slot].job_id == job_id)
+            return done_ring[slot].status;
+    }
+
+    return -1;
+}
+
+unsigned long jobs_done(void) {
+    return done_count;
+}
+
+int job_last_done_status(void) {
+    return done_count ? done_ring[(done_count - 1) % DONE_RING].status : -1;
+}
+
+/**
+ * Sleep until the SIGCHLD handler has run (or the time is up).  The
+ * caller checks the job table first: SIGCHLD is blocked until pselect()
+ * lets it through, so no event slips in between.
+ */
+int wait_for_child_event(const struct timespec *until) {
+    struct timespec now, left, *timeout = NULL;
+    sigset_t waitmask;
+
+    if (until) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > until->tv_sec ||
+            (now.tv_sec == until->tv_sec && now.tv_nsec >= until->tv_nsec))
+            return 1;
+
+        left.tv_sec = until->tv_sec - now.tv_sec;
+        left.tv_nsec = until->tv_nsec - now.tv_nsec;
+        if (left.tv_nsec < 0) {
+            left.tv_sec--;
+            left.tv_nsec += 1000000000;
+        }
+        timeout = &left;
+    }
+
+    sigprocmask(SIG_BLOCK, NULL, &waitmask);
+    sigdelset(&waitmask, SIGCHLD);
+    pselect(0, NULL, NULL, NULL, timeout, &waitmask);
+
+    return job_interrupted ? -1 : 0;
+}
+
 /**
  * Remove a job from the job table by job ID
  */
 void remove_job(int job_id) {
     for (int i = 0; i < num_jobs; i++) {
         if (jobs[i].job_id == job_id) {
+            run_release(&jobs[i]);
             free(jobs[i].name);
             free(jobs[i].pids);
+            argv_free(jobs[i].argv);
+            if (jobs[i].token)
+                jobserver_release();
+            deadline_cancel(job_id);
             
             for (int j = i; j < num_jobs - 1; j++) {
                 jobs[j] = jobs[j + 1];
@@ -408,6 +655,7 @@ void remove_job(int job_id) {
 void cleanup_completed_jobs() {
     for (int i = 0; i < num_jobs; i++) {
         if (job_is_completed(&jobs[i])) {
+            record_done(&jobs[i]);
             if (jobs[i].status == BG) {
                 printf("[%d] + done %s\n", jobs[i].job_id, jobs[i].name);
                 fflush(stdout);
@@ -1,47 +1,85 @@
 #ifndef JOB_CONTROL_H
 #define JOB_CONTROL_H
 
+#include <signal.h>
 #include <sys/types.h>
+#include <time.h>
 
 typedef enum {
     STOPPED,
     TERM,
     BG,
     FG,
+    QUEUED,               /* waiting in the queue, no processes yet */
 } JobStatus;
 
-typedef struct {
+typedef struct Job {
     char* name;           
     pid_t* pids;         
     unsigned int npids;   
     pid_t pgid;          
     JobStatus status;     
     int job_id;          
+    int exit_status;      /* wait status of the last process */
+    int open;             /* more processes may join (xargs, parallel) */
+    void (*reaped)(struct Job *job, pid_t pid, int status);
+    void *data;           /* for reaped() */
+    int token;            /* holds a jobserver token */
+    int prio;             /* queue: higher starts first */
+    long qseq;            /* queue: order queued, 0 if not the queue's */
+    char **argv;          /* queue: the words to run, or NULL for name's text */
+    pid_t last_pid;       /* of the last stage, for wait and $! */
+    char *cgroup;         /* its cgroup v2 group, or NULL */
+    struct timespec started;  /* CLOCK_MONOTONIC, when added */
+    long csw;             /* context switches of its processes so far */
+    int pipe_auto;        /* learns the size of its pipes; see run.c */
 } Job;
 
-extern Job jobs[100];
+extern Job *jobs;           /* num_jobs of them */
 extern int num_jobs;
 
+extern pid_t shell_pgid;
+extern int job_control_active;                /* 0 inside subshells */
+extern volatile sig_atomic_t job_interrupted; /* ^C or ^Z hit a foreground job */
+
 // Helper function for terminal control
 void set_fg_pgid(pid_t pgid);
 
 // Job control functions
-void init_job_control(void);
+void init_job_control(int interactive);
 int add_job(pid_t* pids, int npids, pid_t pgid, char* cmdline, JobStatus status);
+void job_add_pid(Job* job, pid_t pid);
+
+/* jobs that are done are remembered for a while, for wait: the exit
+ * code of the latest one with that job id (or with that pid as its last
+ * stage, if pid > 0), or -1 if it is not known */
+int job_done_status(int job_id, pid_t pid);
+unsigned long jobs_done(void);      /* # of jobs done so far */
+int job_last_done_status(void);     /* exit code of the latest */
+
+/* sleeps until a child changes state, or until the CLOCK_MONOTONIC
+ * time *until (if given): 0 on an event, 1 at the time, -1 on ^C */
+int wait_for_child_event(const struct timespec *until);
 void remove_job(int job_id);
 void update_job_status(int job_id, JobStatus status);
 Job* find_job_by_pgid(pid_t pgid);
 Job* find_job_by_job_id(int job_id);
 void print_job_status(Job* job, int show_pid);
 void mark_process_status(pid_t pid, int status);
-void wait_for_job(Job* job);
-void put_job_in_foreground(Job* job, int cont);
+int wait_for_job(Job* job);
+int put_job_in_foreground(Job* job, int cont);
 void put_job_in_background(Job* job, int cont);
 void continue_job(Job* job, int foreground);
 
+// Process setup
+void child_reset_signals(void);
+void enter_subshell(void);
+int status_to_exit_code(int status);
+
 // Helper functions
 int job_is_completed(Job* job);
 int job_is_stopped(Job* job);
+int job_kill(Job* job, int sig);
 void cleanup_completed_jobs();
 int process_exists(pid_t pid);
 
@@ -0,0 +1,194 @@
+/* jobserver.c
+ * a token pool in the format of GNU make's jobserver.  A FIFO in a
+ * private directory holds one byte per free token.  Children inherit a
+ * blocking descriptor for it, which MAKEFLAGS names in the R,W form of
+ * --jobserver-auth that every make since 4.2 accepts.  The -jN there
+ * makes a plain `make` run in parallel and join the pool.  The shell
+ * itself reads the FIFO through a descriptor of its own that does not
+ * block.
+ *
+ * The shell takes a token for each job it puts in the background and
+ * gives it back when the job is removed from the table.  That token is
+ * the job's implicit slot in the jobserver protocol.  Anything in the
+ * job that speaks the protocol takes further tokens from the FIFO
+ * itself, so all the builds started from the shell share the n slots.
+ **********************************************************************/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "jobserver.h"
+#include "job_control.h"
+#include "vars.h"
+
+static int js_fd = -1;
+static int js_child_fd = -1;    /* inherited by children */
+static int js_size;
+static pid_t js_owner;          /* only the shell that made it removes it */
+static char js_dir[] = "/tmp/pssh-jobserver.XXXXXX";
+static char js_path[sizeof(js_dir) + 8];
+static char *js_saved_flags;    /* MAKEFLAGS from before, or NULL */
+
+
+static void jobserver_cleanup(void)
+{
+    if (js_fd >= 0 && getpid() == js_owner) {
+        unlink(js_path);
+        rmdir(js_dir);
+    }
+}
+
+
+int jobserver_start(int n)
+{
+    static int registered;
+    const char *flags;
+    char *auth, *tokens;
+    size_t len;
+    int n_moved;
+
+    if (js_fd >= 0)
+        jobserver_stop();
+
+    strcpy(js_dir, "/tmp/pssh-jobserver.XXXXXX");
+    if (!mkdtemp(js_dir)) {
+        perror("jobserver");
+        return -1;
+    }
+
+    snprintf(js_path, sizeof(js_path), "%s/fifo", js_dir);
+    if (mkfifo(js_path, 0600) < 0 ||
+        (js_fd = open(js_path, O_RDWR | O_NONBLOCK | O_CLOEXEC)) < 0 ||
+        (js_child_fd = open(js_path, O_RDWR)) < 0) {
+        perror("jobserver");
+        if (js_fd >= 0)
+            close(js_fd);
+        js_fd = -1;
+        unlink(js_path);
+        rmdir(js_dir);
+        return -1;
+    }
+
+    /* out of the way of the descriptors scripts redirect */
+    n_moved = fcntl(js_child_fd, F_DUPFD, 10);
+    close(js_child_fd);
+    js_child_fd = n_moved;
+
+    tokens = malloc(n);
+    memset(tokens, '+', n);
+    if (write(js_fd, tokens, n) != n) {
+        perror("jobserver");
+        free(tokens);
+        close(js_fd);
+        close(js_child_fd);
+        js_fd = js_child_fd = -1;
+        unlink(js_path);
+        rmdir(js_dir);
+        return -1;
+    }
+    free(tokens);
+
+    js_size = n;
+    js_owner = getpid();
+    if (!registered) {
+        atexit(jobserver_cleanup);
+        registered = 1;
+    }
+
+    /* what the user had in MAKEFLAGS still applies */
+    flags = var_get("MAKEFLAGS");
+    js_saved_flags = flags ? strdup(flags) : NULL;
+
+    len = (flags ? strlen(flags) + 1 : 0) + 64;
+    auth = malloc(len);
+    snprintf(auth, len, "%s%s-j%d --jobserver-auth=%d,%d",
+             flags ? flags : "", flags ? " " : "", n, js_child_fd, js_child_fd);
+    var_set("MAKEFLAGS", auth);
+    var_export("MAKEFLAGS");
+    free(auth);
+
+    return 0;
+}
+
+
+void jobserver_stop(void)
+{
+    if (js_fd < 0)
+        return;
+
+    jobserver_cleanup();
+    close(js_fd);
+    close(js_child_fd);
+    js_fd = js_child_fd = -1;
+    js_size = 0;
+
+    if (js_saved_flags) {
+        var_set("MAKEFLAGS", js_saved_flags);
+        free(js_saved_flags);
+        js_saved_flags = NULL;
+    } else {
+        var_unset("MAKEFLAGS");
+    }
+}
+
+
+int jobserver_size(void)
+{
+    return js_size;
+}
+
+
+const char *jobserver_path(void)
+{
+    return js_fd >= 0 ? js_path : NULL;
+}
+
+
+int jobserver_acquire(void)
+{
+    struct pollfd pfd;
+    sigset_t waitmask;
+    char token;
+
+    if (js_fd < 0)
+        return 0;
+
+    /* SIGCHLD is let through while waiting: jobs that end give back
+     * their tokens from the handler */
+    sigprocmask(SIG_BLOCK, NULL, &waitmask);
+    sigdelset(&waitmask, SIGCHLD);
+
+    for (;;) {
+        if (read(js_fd, &token, 1) == 1)
+            return 1;
+
+        if (errno != EAGAIN && errno != EINTR)
+            return 0;
+
+        if (job_interrupted)
+            return -1;
+
+        pfd.fd = js_fd;
+        pfd.events = POLLIN;
+        ppoll(&pfd, 1, NULL, &waitmask);
+    }
+}
+
+
+void jobserver_release(void)
+{
+    int saved = errno;
+
+    if (js_fd >= 0)
+        write(js_fd, "+", 1);
+
+    errno = saved;
+}
@@ -0,0 +1,25 @@
+#ifndef JOBSERVER_H
+#define JOBSERVER_H
+
+/* the shell as a GNU make jobserver: a pool of tokens in a FIFO, named
+ * to children in MAKEFLAGS, that background jobs and the builds they
+ * run share so that they use the cores between them */
+
+/* sets up a pool of n tokens; 0 on success */
+int jobserver_start(int n);
+
+/* removes the pool and puts MAKEFLAGS back */
+void jobserver_stop(void);
+
+/* # of tokens in the pool, 0 when there is none */
+int jobserver_size(void);
+const char *jobserver_path(void);
+
+/* takes a token, waiting until one is free: 1 if taken, 0 if there is
+ * no pool and -1 if the wait was interrupted */
+int jobserver_acquire(void);
+
+/* gives a token back; safe in a signal handler */
+void jobserver_release(void);
+
+#endif
@@ -0,0 +1,179 @@
+/* optimize.c
+ * rewrites of pipelines that save processes and copies.  They are made
+ * on the expanded words of a pipeline, just before it is started, and
+ * only where the result does the same:
+ *
+ *   cat FILE | cmd ...   ->   cmd ... < FILE
+ *   cat A > B            ->   A copied to B by the shell itself, with
+ *                             copy_file_range(2) or sendfile(2)
+ *
+ * FILE and A must be regular files that can be read (else cat's own
+ * complaint and status are kept), cat must be the plain command, and
+ * a stage left on its own must not be one that would then run in the
+ * shell rather than in a child.  set +o optimize turns the rewrites
+ * off; with set -x each one is reported on stderr.
+ **********************************************************************/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#include "builtin.h"
+#include "exec.h"
+#include "job_control.h"
+#include "optimize.h"
+
+#define COPY_CHUNK  (64 << 20)   /* between checks for ^C */
+
+
+/* argv is cat with a single file that can be read in place of it */
+static int plain_cat(char **argv, int nassign, Redir *redirs)
+{
+    struct stat st;
+
+    if (!argv || !argv[0] || strcmp(argv[0], "cat") || !argv[1] || argv[2])
+        return 0;
+
+    if (nassign || redirs || argv[1][0] == '-' || function_get("cat"))
+        return 0;
+
+    return !stat(argv[1], &st) && S_ISREG(st.st_mode) && !access(argv[1], R_OK);
+}
+
+
+/* stage i, alone, would run in the shell: a compound command, function
+ * or builtin, where what it set would no longer stay in a subshell (but
+ * builtins that only print, such as count or fgrep, set nothing) */
+static int runs_in_shell(Parse *P, char ***argv, int i)
+{
+    char *cmd = argv[i][0];
+
+    if (P->tasks[i].body)
+        return 1;
+    if (!cmd)
+        return 0;
+
+    return function_get(cmd) || (is_builtin(cmd) && !is_subst_builtin(cmd));
+}
+
+
+int optimize_cat_pipe(Parse *P, char ***argv, int *nassign, Redir **redirs)
+{
+    Redir *R;
+
+    if (!opt_optimize || P->ntasks < 2 || !plain_cat(argv[0], nassign[0], redirs[0]))
+        return 0;
+
+    if (P->ntasks == 2 && !P->background && runs_in_shell(P, argv, 1))
+        return 0;
+
+    if (opt_xtrace)
+        fprintf(stderr, "pssh: optimize: cat %s | ... -> ... < %s\n",
+                argv[0][1], argv[0][1]);
+
+    /* first, so that the stage's own redirections still win */
+    R = calloc(1, sizeof(*R));
+    R->type = REDIR_IN;
+    R->fd = 0;
+    R->word = strdup(argv[0][1]);
+    R->next = redirs[1];
+    redirs[1] = R;
+
+    return 1;
+}
+
+
+/* everything from in to out; -1 with errno on a failure */
+static int copy_file(int in, int out)
+{
+    char buf[65536];
+    ssize_t n, w;
+    int how = 0;      /* copy_file_range, sendfile, or read and write */
+
+    for (;;) {
+        if (job_interrupted) {
+            errno = EINTR;
+            return -1;
+        }
+
+        if (how == 0)
+            n = copy_file_range(in, NULL, out, NULL, COPY_CHUNK, 0);
+        else if (how == 1)
+            n = sendfile(out, in, NULL, COPY_CHUNK);
+        else
+            n = read(in, buf, sizeof(buf));
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        /* not between these two kinds of file: the next way, then */
+        if (n < 0 && how < 2 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS ||
+                                 errno == EOPNOTSUPP || errno == EBADF)) {
+            how++;
+            continue;
+        }
+
+        if (n <= 0)
+            return n;
+
+        if (how == 2) {
+            for (char *p = buf; n > 0; p += w, n -= w) {
+                w = write(out, p, n);
+                if (w < 0 && errno == EINTR)
+                    w = 0;
+                else if (w < 0)
+                    return -1;
+            }
+        }
+    }
+}
+
+
+int optimize_cat_copy(Parse *P, char ***argv, int *nassign, Redir **redirs)
+{
+    struct stat a, b;
+    Redir *R = redirs[0];
+    int in, out, status = 0;
+
+    if (!opt_optimize || P->ntasks != 1 || P->background || P->tasks[0].body ||
+        !R || R->next || R->fd != 1 || (R->type != REDIR_OUT && R->type != REDIR_APPEND) ||
+        !plain_cat(argv[0], nassign[0], NULL))
+        return -1;
+
+    /* cat a > a: leave it to cat to refuse */
+    if (stat(argv[0][1], &a) < 0 || (!stat(R->word, &b) && a.st_dev == b.st_dev && a.st_ino == b.st_ino))
+        return -1;
+
+    in = open(argv[0][1], O_RDONLY | O_CLOEXEC);
+    if (in < 0)
+        return -1;
+
+    out = open(R->word, O_WRONLY | O_CREAT | O_CLOEXEC |
+               (R->type == REDIR_OUT ? O_TRUNC : O_APPEND), 0644);
+    if (out < 0) {
+        fprintf(stderr, "pssh: %s: %s\n", R->word, strerror(errno));
+        close(in);
+        return 1;
+    }
+
+    if (opt_xtrace)
+        fprintf(stderr, "pssh: optimize: cat %s %s %s -> copied by the shell\n",
+                argv[0][1], R->type == REDIR_OUT ? ">" : ">>", R->word);
+
+    if (copy_file(in, out) < 0) {
+        status = errno == EINTR ? 130 : 1;
+        if (status == 1)
+            fprintf(stderr, "cat: %s: %s\n", R->word, strerror(errno));
+    }
+
+    close(in);
+    close(out);
+
+    return status;
+}
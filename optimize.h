@@ -0,0 +1,17 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include "parse.h"
+
+/* rewrites of a pipeline, made on its expanded words (argv, nassign and
+ * redirs as in execute_tasks()) just before it runs; see optimize.c */
+
+/* cat FILE | cmd ...: FILE becomes a < of the next stage and the cat
+ * stage is dropped; returns the # of stages dropped (0 or 1) */
+int optimize_cat_pipe(Parse *P, char ***argv, int *nassign, Redir **redirs);
+
+/* cat A > B on its own: copies A to B in the shell and returns the
+ * exit status, or -1 if the pipeline is not such a command */
+int optimize_cat_copy(Parse *P, char ***argv, int *nassign, Redir **redirs);
+
+#endif
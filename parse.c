@@ -6,9 +6,32 @@
  *
  * Parses the following syntax:
  *
- *  ~$ command_1 [< infile] [| command_n]* [> outfile] [&]
+ *  ~$ command_1 [redirection]* [| command_n [redirection]*]* [&]
  *
- * and produces a correspondingly populated Parse structure on the heap
+ * where a redirection is one of  [n]< file, [n]> file, [n]>> file,
+ * [n]>&m, [n]<&m, [n]>&- (m an fd, - closes n), &> file, &>> file,
+ * [n]<<word (a here-document read from the lines that follow),
+ * [n]<<-word, [n]<<< word or [n]|> file (a copy of the output, as with
+ * tee; any number of them, e.g. cmd |> a.log |> b.log | next),
+ *
+ * and pipelines may be joined into lists with ';', '&', newlines,
+ * '&&' and '||', negated with '!', and where a command may also be
+ * one of the compound commands
+ *
+ *     if list; then list; [elif list; then list;]* [else list;] fi
+ *     while list; do list; done
+ *     until list; do list; done
+ *     for name [in word...]; do list; done
+ *     case word in [(]pattern[|pattern]*) list;; ... esac
+ *     { list; }
+ *     ( list )
+ *     (( expression ))
+ *
+ * or a function definition,  name() compound-command.  In interactive
+ * shells aliases are replaced in the input before the command word is
+ * read.  The parser produces a correspondingly populated tree of Nodes on the heap.
+ * The tree is built once and then executed (repeatedly, for loop
+ * bodies) without being re-lexed.
  *
  * Note:
  *  - Items in brackets [ ] are optional
@@ -21,324 +44,1105 @@
  *     ~$ wc -l < somefile.txt > numlines.txt
  *     ~$ ls -lh | grep 8.*K | wc -l
  *     ~$ gvim &
+ *     ~$ seq $((n * 2)) | tail -n $((n + 1))
+ *     ~$ for f in a b c; do echo $f; done > list.txt
+ *     ~$ make 2>&1 | tee build.log
+ *     ~$ while ((i < 10)); do i=$((i + 1)); done
+ *     ~$ diff <(sort a.txt) <(sort b.txt)
+ *
+ * Words are kept exactly as typed (quotes and all) so that they can
+ * be expanded each time the command runs; see expand.c.  Quoted text
+ * and $( ... ) / ${ ... } / ` ... ` constructs may contain operator
+ * characters without splitting the command.
  **********************************************************************/
 #include <ctype.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "alias.h"
 #include "parse.h"
 
+#define MAX_ALIAS_DEPTH 16
+
+int parse_aliases;
+
+
+typedef enum {
+    TOK_WORD,
+    TOK_PIPE,       /* |  */
+    TOK_PIPEGREAT,  /* |> */
+    TOK_OR_IF,      /* || */
+    TOK_AMP,        /* &  */
+    TOK_AND_IF,     /* && */
+    TOK_SEMI,       /* ;  */
+    TOK_DSEMI,      /* ;; */
+    TOK_NEWLINE,
+    TOK_LESS,       /* <  */
+    TOK_GREAT,      /* >  */
+    TOK_DLESS,      /* << */
+    TOK_DLESSDASH,  /* <<- */
+    TOK_TLESS,      /* <<< */
+    TOK_DGREAT,     /* >> */
+    TOK_GREATAND,   /* >& */
+    TOK_LESSAND,    /* <& */
+    TOK_ANDGREAT,   /* &> */
+    TOK_ANDDGREAT,  /* &>> */
+    TOK_IO_NUMBER,  /* the n of n> and the like */
+    TOK_LPAREN,     /* (  */
+    TOK_RPAREN,     /* )  */
+    TOK_ARITH,      /* (( expression )) */
+    TOK_END,
+    TOK_ERROR,      /* unterminated quote or substitution */
+} TokenType;
+
+typedef struct {
+    TokenType type;
+    char *text;     /* raw word, or the expression of (( )) */
+    size_t start;   /* offset of the token in the input */
+} Token;
+
+typedef struct {
+    char *name;
+    size_t end;     /* offset just past its replacement text */
+} ActiveAlias;
+
+typedef struct {
+    const char *s;
+    char *buf;      /* s, once rewritten by alias expansion */
+    size_t pos;
+    Token tok;      /* lookahead */
+    ParseStatus status;
+    ActiveAlias active[MAX_ALIAS_DEPTH];  /* not to be expanded again */
+    int nactive;
+    Redir **heredocs;   /* waiting for their text after the next newline */
+    int nheredocs;
+} Parser;
 
 typedef struct {
-    char *cmd;
     char **argv;
-    char *input_fn;
-    char *output_fn;
+    int argc;
+    Redir *redirs;
+    Redir **redirs_tail;
+    Node *body;
 } Unit;
 
-static char ops[] = {'>', '<', '|', '\0'};
+static char ops[] = {'>', '<', '|', '&', ';', '(', ')', '\0'};
 
+/* reserved words that end a list */
+static const char *terminators[] = {
+    "then", "elif", "else", "fi", "do", "done", "esac", "}", NULL
+};
 
-static void trim(char *s)
+static Node *parse_list(Parser *Pr);
+static void parse_debug_node(Node *N, int indent);
+
+
+static int is_op(char c)
 {
-    size_t start, end;
+    int i;
 
-    if (!s)
-        return;
+    for (i=0; ops[i]; i++)
+        if (c == ops[i])
+            return 1;
 
-    end = strlen(s);
+    return 0;
+}
 
-    for (start=0; isspace(s[start]); ++start);
 
-    if (s[start]) {
-        while (end > 0 && isspace(s[end-1]))
-            --end;
+static size_t skip_word_part(const char *s, size_t i);
+static size_t skip_group(const char *s, size_t i);
 
-        memmove(s, &s[start], end-start);
+/* s[i] is an opening quote (or backquote); returns the index just past
+ * the closing one, or 0 if the quote is unterminated */
+static size_t skip_quote(const char *s, size_t i)
+{
+    char q = s[i++];
+
+    while (s[i] && s[i] != q) {
+        if (q != '\'' && s[i] == '\\' && s[i+1])
+            i += 2;
+        else if (q == '\"' && (s[i] == '`' ||
+                 (s[i] == '$' && (s[i+1] == '(' || s[i+1] == '{')))) {
+            i = skip_word_part(s, i);
+            if (!i)
+                return 0;
+        } else
+            i++;
     }
-    s[end-start] = '\0';
+
+    return s[i] ? i + 1 : 0;
 }
 
 
-static int is_background(char *cmdline)
+/* s[i] is an opening '(' or '{'; returns the index just past the
+ * matching close, or 0 if it is unterminated */
+static size_t skip_group(const char *s, size_t i)
 {
-    size_t last;
-    int ret = 0;
+    char open = s[i];
+    char close = open == '(' ? ')' : '}';
+    int depth = 0;
+
+    while (s[i]) {
+        if (s[i] == open) {
+            depth++;
+            i++;
+        } else if (s[i] == close) {
+            if (--depth == 0)
+                return i + 1;
+            i++;
+        } else if (s[i] == '\'' || s[i] == '\"' || s[i] == '`') {
+            i = skip_quote(s, i);
+            if (!i)
+                return 0;
+        } else if (s[i] == '\\' && s[i+1]) {
+            i += 2;
+        } else if (s[i] == '$' && (s[i+1] == '(' || s[i+1] == '{')) {
+            i = skip_group(s, i+1);
+            if (!i)
+                return 0;
+        } else {
+            i++;
+        }
+    }
 
-    trim(cmdline);
-    last = strlen(cmdline) - 1;
+    return 0;
+}
 
-    if ('&' == cmdline[last]) {
-        cmdline[last] = '\0';
-        ret = 1;
-    }
 
-    return ret;
+/* s[i] is '$' followed by an opening '(' or '{'; returns the index just
+ * past the matching close, or 0 if it is unterminated */
+size_t parse_skip_subst(const char *s, size_t i)
+{
+    return skip_group(s, i+1);
 }
 
 
-static int is_empty(char *cmdline)
+/* <( or >( starts a process substitution, which is part of a word */
+static int at_proc_subst(const char *s, size_t i)
 {
-    trim(cmdline);
+    return (s[i] == '<' || s[i] == '>') && s[i+1] == '(';
+}
 
-    if (!cmdline || !strlen(cmdline))
-        return 1;
 
-    return 0;
+/* skips one quoted string, escape, substitution or plain character of a
+ * word starting at s[i]; returns the new index, or 0 on error */
+static size_t skip_word_part(const char *s, size_t i)
+{
+    if (s[i] == '\'' || s[i] == '\"' || s[i] == '`')
+        return skip_quote(s, i);
+
+    if (s[i] == '\\')
+        return s[i+1] ? i + 2 : i + 1;
+
+    if (s[i] == '$' && (s[i+1] == '(' || s[i+1] == '{'))
+        return parse_skip_subst(s, i);
+
+    if (at_proc_subst(s, i))
+        return skip_group(s, i+1);
+
+    return i + 1;
 }
 
 
-static int is_op(char c)
+static void lex_op(Parser *Pr, TokenType type, size_t len)
 {
+    Pr->tok.type = type;
+    Pr->pos += len;
+}
+
+
+/* reads the text of the pending here-documents from the lines that
+ * start at Pr->pos; returns 0 if the input ends before a delimiter */
+static int read_heredocs(Parser *Pr)
+{
+    const char *s = Pr->s, *line, *eol;
+    size_t len, dlen, n;
+    Redir *R;
+    char *text;
     int i;
 
-    for (i=0; ops[i]; i++)
-        if (c == ops[i])
-            return 1;
+    for (i=0; i<Pr->nheredocs; i++) {
+        R = Pr->heredocs[i];
+        dlen = strlen(R->delim);
+        text = malloc(1);
+        len = 0;
+
+        for (;;) {
+            line = &s[Pr->pos];
+            if (!*line) {
+                free(text);
+                return 0;
+            }
 
-    return 0;
+            eol = strchr(line, '\n');
+            n = eol ? (size_t)(eol - line) : strlen(line);
+            Pr->pos += eol ? n + 1 : n;
+
+            if (R->strip_tabs)
+                while (n && *line == '\t') {
+                    line++;
+                    n--;
+                }
+
+            if (n == dlen && !strncmp(line, R->delim, dlen))
+                break;
+
+            text = realloc(text, len + n + 2);
+            memcpy(text + len, line, n);
+            len += n;
+            text[len++] = '\n';
+        }
+
+        text[len] = '\0';
+        R->word = text;
+        free(R->delim);
+        R->delim = NULL;
+    }
+
+    Pr->nheredocs = 0;
+
+    return 1;
+}
+
+
+/* advances to the next token, discarding the text of the current one
+ * unless it was claimed (set to NULL) by the parser */
+static void lex(Parser *Pr)
+{
+    const char *s = Pr->s;
+    Token *T = &Pr->tok;
+    size_t i, k;
+
+    free(T->text);
+    T->text = NULL;
+
+    for (;;) {
+        while (s[Pr->pos] == ' ' || s[Pr->pos] == '\t' || s[Pr->pos] == '\r')
+            Pr->pos++;
+
+        if (s[Pr->pos] == '\\' && s[Pr->pos+1] == '\n') {
+            Pr->pos += 2;
+            continue;
+        }
+
+        if (s[Pr->pos] == '#')
+            while (s[Pr->pos] && s[Pr->pos] != '\n')
+                Pr->pos++;
+
+        break;
+    }
+
+    T->start = i = Pr->pos;
+
+    switch (s[i]) {
+    case '\0':
+        /* here-documents without their text: more input is needed */
+        T->type = Pr->nheredocs ? TOK_ERROR : TOK_END;
+        return;
+    case '\n':
+        lex_op(Pr, TOK_NEWLINE, 1);
+        if (Pr->nheredocs && Pr->status == PARSE_OK && !read_heredocs(Pr))
+            T->type = TOK_ERROR;
+        return;
+    case '|':
+        if (s[i+1] == '|')
+            lex_op(Pr, TOK_OR_IF, 2);
+        else if (s[i+1] == '>')
+            lex_op(Pr, TOK_PIPEGREAT, 2);
+        else
+            lex_op(Pr, TOK_PIPE, 1);
+        return;
+    case '&':
+        if (s[i+1] == '&')
+            lex_op(Pr, TOK_AND_IF, 2);
+        else if (s[i+1] == '>' && s[i+2] == '>')
+            lex_op(Pr, TOK_ANDDGREAT, 3);
+        else if (s[i+1] == '>')
+            lex_op(Pr, TOK_ANDGREAT, 2);
+        else
+            lex_op(Pr, TOK_AMP, 1);
+        return;
+    case ';':
+        if (s[i+1] == ';')
+            lex_op(Pr, TOK_DSEMI, 2);
+        else
+            lex_op(Pr, TOK_SEMI, 1);
+        return;
+    case '<':
+        if (at_proc_subst(s, i))
+            break;
+        if (s[i+1] == '<' && s[i+2] == '<')
+            lex_op(Pr, TOK_TLESS, 3);
+        else if (s[i+1] == '<' && s[i+2] == '-')
+            lex_op(Pr, TOK_DLESSDASH, 3);
+        else if (s[i+1] == '<')
+            lex_op(Pr, TOK_DLESS, 2);
+        else if (s[i+1] == '&')
+            lex_op(Pr, TOK_LESSAND, 2);
+        else
+            lex_op(Pr, TOK_LESS, 1);
+        return;
+    case '>':
+        if (at_proc_subst(s, i))
+            break;
+        if (s[i+1] == '>')
+            lex_op(Pr, TOK_DGREAT, 2);
+        else if (s[i+1] == '&')
+            lex_op(Pr, TOK_GREATAND, 2);
+        else
+            lex_op(Pr, TOK_GREAT, 1);
+        return;
+    case ')':
+        lex_op(Pr, TOK_RPAREN, 1);
+        return;
+    case '(':
+        /* "((" starts an arithmetic command if it closes with "))" */
+        if (s[i+1] == '(') {
+            size_t end = skip_group(s, i);
+
+            k = skip_group(s, i+1);
+            if (!end || !k) {
+                T->type = TOK_ERROR;
+                return;
+            }
+            if (s[k] == ')' && k + 1 == end) {
+                T->type = TOK_ARITH;
+                T->text = strndup(&s[i+2], k - 1 - (i+2));
+                Pr->pos = end;
+                return;
+            }
+        }
+        lex_op(Pr, TOK_LPAREN, 1);
+        return;
+    }
+
+    while (s[i] && !isspace((unsigned char)s[i]) &&
+           (!is_op(s[i]) || at_proc_subst(s, i))) {
+        i = skip_word_part(s, i);
+        if (!i) {
+            T->type = TOK_ERROR;
+            return;
+        }
+    }
+
+    T->type = TOK_WORD;
+    T->text = strndup(&s[T->start], i - T->start);
+    Pr->pos = i;
+
+    /* digits right before a redirection name the fd it applies to */
+    if ((s[i] == '<' || s[i] == '>' || (s[i] == '|' && s[i+1] == '>')) && !at_proc_subst(s, i) &&
+        strspn(T->text, "0123456789") == i - T->start)
+        T->type = TOK_IO_NUMBER;
 }
 
 
-static int has_trailing(char needle, char *haystack)
+/* flags a syntax error; running out of input is reported as
+ * PARSE_INCOMPLETE so that the caller can ask for more */
+static void parse_fail(Parser *Pr)
 {
-    trim(haystack);
+    if (Pr->status != PARSE_OK)
+        return;
+
+    if (Pr->tok.type == TOK_END || Pr->tok.type == TOK_ERROR)
+        Pr->status = PARSE_INCOMPLETE;
+    else
+        Pr->status = PARSE_ERROR;
+}
+
+
+static int is_word(Parser *Pr, const char *word)
+{
+    return Pr->tok.type == TOK_WORD && !strcmp(Pr->tok.text, word);
+}
+
 
-    if (haystack[0] == needle ||
-        haystack[strlen(haystack)-1] == needle) {
+static int expect_word(Parser *Pr, const char *word)
+{
+    if (!is_word(Pr, word)) {
+        parse_fail(Pr);
+        return 0;
+    }
+
+    lex(Pr);
+    return 1;
+}
+
+
+static void skip_newlines(Parser *Pr)
+{
+    while (Pr->tok.type == TOK_NEWLINE)
+        lex(Pr);
+}
+
+
+static int at_terminator(Parser *Pr)
+{
+    int i;
+
+    switch (Pr->tok.type) {
+    case TOK_END:
+    case TOK_ERROR:
+    case TOK_RPAREN:
+    case TOK_DSEMI:
         return 1;
+    case TOK_WORD:
+        for (i=0; terminators[i]; i++)
+            if (!strcmp(Pr->tok.text, terminators[i]))
+                return 1;
+        return 0;
+    default:
+        return 0;
     }
+}
 
-    return 0;
+
+/* returns the source text between two offsets, whitespace trimmed */
+static char *source_text(Parser *Pr, size_t start, size_t end)
+{
+    while (start < end && isspace((unsigned char)Pr->s[start]))
+        start++;
+
+    while (end > start && isspace((unsigned char)Pr->s[end-1]))
+        end--;
+
+    return strndup(&Pr->s[start], end - start);
 }
 
 
-static unsigned int count_char(char needle, char *haystack)
+static Node *node_new(NodeType type)
 {
-    unsigned int c = 0;
+    Node *N = malloc(sizeof(*N));
 
-    while (*haystack)
-        if (*haystack++ == needle)
-            c++;
+    memset(N, 0, sizeof(*N));
+    N->type = type;
 
-    return c;
+    return N;
 }
 
 
-static unsigned int count_args (char *unit)
+static Unit *unit_new()
 {
-    unsigned int n = 0;
+    Unit *U = malloc(sizeof(*U));
 
-    for (; *unit; unit++) {
-        if (isspace((unsigned char)(*unit))) {
-            while (isspace((unsigned char)(*++unit)));
-            if (*unit == '\"') {
-                do {
-                    unit++;
-                } while (*unit != '\"');
-                n++;
-            } else if (*unit == '\'') {
-                do {
-                    unit++;
-                } while (*unit != '\'');
-                n++;
-            } else if (!isspace((unsigned char)(*unit))) {
-                n++;
-            }
-        }
+    U->argv = malloc(sizeof(*U->argv));
+    U->argv[0] = NULL;
+    U->argc = 0;
+    U->redirs = NULL;
+    U->redirs_tail = &U->redirs;
+    U->body = NULL;
+
+    return U;
+}
+
+
+static void unit_add_arg(Unit *U, char *arg)
+{
+    U->argv = realloc(U->argv, (U->argc + 2) * sizeof(*U->argv));
+    U->argv[U->argc++] = arg;
+    U->argv[U->argc] = NULL;
+}
+
+
+static void unit_destroy(Unit **U)
+{
+    int i;
+
+    if (!*U)
+        return;
+
+    redir_destroy(&(*U)->redirs);
+
+    if ((*U)->argv) {
+        for (i=0; (*U)->argv[i]; i++)
+            free((*U)->argv[i]);
+        free((*U)->argv);
     }
 
-    return n;
+    node_destroy(&(*U)->body);
+
+    free(*U);
+    *U = NULL;
 }
 
 
-static int valid_syntax(Parse *P, Unit *U, int i)
+/* claims the text of the current word token */
+static char *take_word(Parser *Pr)
 {
-    if (!U)
-        return 0;
+    char *text = Pr->tok.text;
 
-    if (U->input_fn && ((i != 0) || is_empty(U->input_fn)))
-        return 0;
+    Pr->tok.text = NULL;
+    lex(Pr);
 
-    if (U->output_fn && ((i != P->ntasks-1) || is_empty(U->output_fn)))
-        return 0;
+    return text;
+}
+
+
+/* replaces the current word by its alias, if it has one that is not
+ * already being expanded, and lexes the replacement text */
+static void expand_alias(Parser *Pr)
+{
+    const char *value;
+    size_t wlen, vlen, len;
+    char *s;
+    int i, n;
+
+    while (parse_aliases && Pr->tok.type == TOK_WORD) {
+        /* aliases whose text has been read are free to expand again */
+        for (i=n=0; i<Pr->nactive; i++) {
+            if (Pr->active[i].end > Pr->tok.start)
+                Pr->active[n++] = Pr->active[i];
+            else
+                free(Pr->active[i].name);
+        }
+        Pr->nactive = n;
+
+        for (i=0; i<Pr->nactive; i++)
+            if (!strcmp(Pr->active[i].name, Pr->tok.text))
+                return;
+
+        value = alias_get(Pr->tok.text);
+        if (!value || Pr->nactive == MAX_ALIAS_DEPTH)
+            return;
 
-    if (!U->cmd || !*U->cmd)
+        wlen = Pr->pos - Pr->tok.start;
+        vlen = strlen(value);
+        len = strlen(Pr->s);
+
+        s = malloc(len - wlen + vlen + 1);
+        memcpy(s, Pr->s, Pr->tok.start);
+        memcpy(s + Pr->tok.start, value, vlen);
+        strcpy(s + Pr->tok.start + vlen, Pr->s + Pr->pos);
+
+        for (i=0; i<Pr->nactive; i++)
+            Pr->active[i].end += vlen - wlen;
+
+        Pr->active[Pr->nactive].name = strdup(Pr->tok.text);
+        Pr->active[Pr->nactive].end = Pr->tok.start + vlen;
+        Pr->nactive++;
+
+        free(Pr->buf);
+        Pr->s = Pr->buf = s;
+        Pr->pos = Pr->tok.start;
+        lex(Pr);
+    }
+}
+
+
+static int is_redirect(Parser *Pr)
+{
+    switch (Pr->tok.type) {
+    case TOK_LESS:
+    case TOK_GREAT:
+    case TOK_DLESS:
+    case TOK_DLESSDASH:
+    case TOK_TLESS:
+    case TOK_DGREAT:
+    case TOK_GREATAND:
+    case TOK_LESSAND:
+    case TOK_ANDGREAT:
+    case TOK_ANDDGREAT:
+    case TOK_PIPEGREAT:
+    case TOK_IO_NUMBER:
+        return 1;
+    default:
         return 0;
+    }
+}
 
 
-    return 1;
+static Redir *redir_add(Unit *U, RedirType type, int fd)
+{
+    Redir *R = malloc(sizeof(*R));
+
+    memset(R, 0, sizeof(*R));
+    R->type = type;
+    R->fd = fd;
+    *U->redirs_tail = R;
+    U->redirs_tail = &R->next;
+
+    return R;
+}
+
+
+/* quote removal for a here-document delimiter */
+static char *unquote(const char *w)
+{
+    char *ret = malloc(strlen(w) + 1), *p = ret;
+    char q = 0;
+
+    for (; *w; w++) {
+        if (!q && (*w == '\'' || *w == '\"'))
+            q = *w;
+        else if (q && *w == q)
+            q = 0;
+        else if (*w == '\\' && q != '\'' && w[1])
+            *p++ = *++w;
+        else
+            *p++ = *w;
+    }
+    *p = '\0';
+
+    return ret;
 }
 
 
-static char *parse_unary(char op, char *unit)
+static int parse_redirect(Parser *Pr, Unit *U)
 {
-    char *start, *end, *arg;
+    TokenType type;
+    Redir *R;
+    int fd = -1;
+
+    if (Pr->tok.type == TOK_IO_NUMBER) {
+        fd = atoi(Pr->tok.text);
+        lex(Pr);
+    }
 
-    for (start=NULL; *unit; unit++)
-        if (*unit == op) {
-           start = ++unit;
-           break;
+    /* in 2>&1>file, the 1 is lexed as the fd of the next one */
+    type = Pr->tok.type;
+    lex(Pr);
+    if (Pr->tok.type == TOK_IO_NUMBER)
+        Pr->tok.type = TOK_WORD;
+    if (Pr->tok.type != TOK_WORD) {
+        parse_fail(Pr);
+        return 0;
+    }
+
+    switch (type) {
+    case TOK_GREAT:
+    case TOK_DGREAT:
+        R = redir_add(U, type == TOK_GREAT ? REDIR_OUT : REDIR_APPEND,
+                      fd < 0 ? 1 : fd);
+        R->word = take_word(Pr);
+        break;
+
+    case TOK_PIPEGREAT:
+        R = redir_add(U, REDIR_TEE, fd < 0 ? 1 : fd);
+        R->word = take_word(Pr);
+        break;
+
+    case TOK_GREATAND:
+    case TOK_LESSAND:
+        R = redir_add(U, REDIR_DUP, fd >= 0 ? fd : type == TOK_LESSAND ? 0 : 1);
+        R->word = take_word(Pr);
+        break;
+
+    case TOK_ANDGREAT:
+    case TOK_ANDDGREAT:
+        /* &> file is > file 2>&1 */
+        if (fd >= 0) {
+            parse_fail(Pr);
+            return 0;
         }
+        R = redir_add(U, type == TOK_ANDGREAT ? REDIR_OUT : REDIR_APPEND, 1);
+        R->word = take_word(Pr);
+        R = redir_add(U, REDIR_DUP, 2);
+        R->word = strdup("1");
+        break;
+
+    case TOK_TLESS:
+        R = redir_add(U, REDIR_HERESTRING, fd < 0 ? 0 : fd);
+        R->word = take_word(Pr);
+        break;
+
+    case TOK_DLESS:
+    case TOK_DLESSDASH:
+        /* the text is filled in at the next newline */
+        R = redir_add(U, REDIR_HEREDOC, fd < 0 ? 0 : fd);
+        R->strip_tabs = type == TOK_DLESSDASH;
+        R->quoted = strpbrk(Pr->tok.text, "\"'\\") != NULL;
+        R->delim = unquote(Pr->tok.text);
+        Pr->heredocs = realloc(Pr->heredocs, (Pr->nheredocs + 1) * sizeof(*Pr->heredocs));
+        Pr->heredocs[Pr->nheredocs++] = R;
+        lex(Pr);
+        break;
+
+    case TOK_LESS:
+        R = redir_add(U, REDIR_IN, fd < 0 ? 0 : fd);
+        R->word = take_word(Pr);
+        break;
+
+    default:
+        parse_fail(Pr);
+        return 0;
+    }
 
-    if (!start)
-        return NULL;
+    return 1;
+}
 
-    for (end=start; *end; end++)
-        if (is_op(*end))
-           break;
 
-    arg = strndup(start, end - start);
-    arg[end - start] = '\0';
-    trim(arg);
+/* list that must not be empty, e.g. the condition of an if */
+static Node *parse_body(Parser *Pr)
+{
+    Node *N = parse_list(Pr);
 
-    start--;
-    memset(start, ' ', end - start);
+    if (!N)
+        parse_fail(Pr);
 
-    return arg;
+    return N;
 }
 
 
-static char *argtok(char *str, char **state)
+/* called with "if" or "elif" already consumed */
+static Node *parse_if(Parser *Pr)
 {
-    char *ret;
-    char seek_ch;
+    Node *N = node_new(NODE_IF);
 
-    if (!str)
-        str = *state;
+    if (!(N->cond = parse_body(Pr)) || !expect_word(Pr, "then") ||
+        !(N->body = parse_body(Pr)))
+        goto fail;
 
-    if (!*str)
-        return NULL;
+    if (is_word(Pr, "elif")) {
+        lex(Pr);
+        if (!(N->alt = parse_if(Pr)))
+            goto fail;
+        return N;
+    }
+
+    if (is_word(Pr, "else")) {
+        lex(Pr);
+        if (!(N->alt = parse_body(Pr)))
+            goto fail;
+    }
 
-    trim(str);
+    if (!expect_word(Pr, "fi"))
+        goto fail;
 
-    seek_ch = *str == '\"' ? '\"' :
-              *str == '\'' ? '\'' :
-              ' ';
+    return N;
 
-    ret = seek_ch == ' ' ? str : ++str;
+fail:
+    node_destroy(&N);
+    return NULL;
+}
 
-    str = strchr(str, seek_ch);
 
-    if (str)
-        *str = '\0';
+static int parse_do_group(Parser *Pr, Node *N)
+{
+    return expect_word(Pr, "do") && (N->body = parse_body(Pr)) &&
+           expect_word(Pr, "done");
+}
 
-    *state = str ? ++str : (ret + strlen(ret));
 
-    return ret;
+static Node *parse_loop(Parser *Pr, NodeType type)
+{
+    Node *N = node_new(type);
+
+    if (!(N->cond = parse_body(Pr)) || !parse_do_group(Pr, N))
+        node_destroy(&N);
+
+    return N;
 }
 
 
-static void parse_command(Unit *U, char *unit)
+static Node *parse_for(Parser *Pr)
 {
-    unsigned int argc, n;
-    char *str, *token, *state;
+    Node *N = node_new(NODE_FOR);
+    int n = 0;
 
-    trim(unit);
-    argc = count_args(unit)+1; /* +1 for command */
+    if (Pr->tok.type != TOK_WORD) {
+        parse_fail(Pr);
+        goto fail;
+    }
+    N->word = take_word(Pr);
 
-    U->argv = malloc((argc+1) * sizeof(*U->argv));
-    U->argv[argc] = NULL;
+    skip_newlines(Pr);
 
-    for (n=0, str=unit; ; n++, str=NULL) {
-        token = argtok(str, &state);
-        if (!token)
-            break;
+    if (is_word(Pr, "in")) {
+        lex(Pr);
+        N->words = malloc(sizeof(*N->words));
+        N->words[0] = NULL;
 
-        U->argv[n] = strdup(token);
+        while (Pr->tok.type == TOK_WORD) {
+            N->words = realloc(N->words, (n + 2) * sizeof(*N->words));
+            N->words[n++] = take_word(Pr);
+            N->words[n] = NULL;
+        }
+
+        if (Pr->tok.type != TOK_SEMI && Pr->tok.type != TOK_NEWLINE) {
+            parse_fail(Pr);
+            goto fail;
+        }
+        lex(Pr);
+    } else if (Pr->tok.type == TOK_SEMI) {
+        lex(Pr);
     }
 
-    U->cmd = U->argv[0];
+    skip_newlines(Pr);
+
+    if (!parse_do_group(Pr, N))
+        goto fail;
+
+    return N;
+
+fail:
+    node_destroy(&N);
+    return NULL;
 }
 
 
-static Unit *parse_unit(char *unit)
+static Node *parse_case(Parser *Pr)
 {
-    Unit *U;
+    Node *N = node_new(NODE_CASE);
+    CaseItem **tail = &N->items, *C;
+    int n;
 
-    int infiles = count_char('<', unit);
-    int outfiles = count_char('>', unit);
+    if (Pr->tok.type != TOK_WORD) {
+        parse_fail(Pr);
+        goto fail;
+    }
+    N->word = take_word(Pr);
+
+    skip_newlines(Pr);
+    if (!expect_word(Pr, "in"))
+        goto fail;
+    skip_newlines(Pr);
+
+    while (!is_word(Pr, "esac")) {
+        C = malloc(sizeof(*C));
+        C->patterns = malloc(sizeof(*C->patterns));
+        C->patterns[0] = NULL;
+        C->body = NULL;
+        C->next = NULL;
+        *tail = C;
+        tail = &C->next;
+
+        if (Pr->tok.type == TOK_LPAREN)
+            lex(Pr);
+
+        for (n=0; ; ) {
+            if (Pr->tok.type != TOK_WORD) {
+                parse_fail(Pr);
+                goto fail;
+            }
+            C->patterns = realloc(C->patterns, (n + 2) * sizeof(*C->patterns));
+            C->patterns[n++] = take_word(Pr);
+            C->patterns[n] = NULL;
 
-    if (infiles > 1 || outfiles > 1)
-        return NULL;
+            if (Pr->tok.type != TOK_PIPE)
+                break;
+            lex(Pr);
+        }
 
-    if (count_char('\'', unit) % 2)
-        return NULL;
+        if (Pr->tok.type != TOK_RPAREN) {
+            parse_fail(Pr);
+            goto fail;
+        }
+        lex(Pr);
+
+        C->body = parse_list(Pr);
+        if (Pr->status != PARSE_OK)
+            goto fail;
+
+        if (Pr->tok.type == TOK_DSEMI) {
+            lex(Pr);
+            skip_newlines(Pr);
+        } else if (!is_word(Pr, "esac")) {
+            parse_fail(Pr);
+            goto fail;
+        }
+    }
+    lex(Pr);
 
-    if (count_char('\"', unit) % 2)
-        return NULL;
+    return N;
 
-    U = malloc(sizeof(*U));
-    U->cmd = NULL;
-    U->argv = NULL;
+fail:
+    node_destroy(&N);
+    return NULL;
+}
 
-    if (infiles)
-        U->input_fn = parse_unary('<', unit);
-    else
-        U->input_fn = NULL;
 
-    if (outfiles)
-        U->output_fn = parse_unary('>', unit);
-    else
-        U->output_fn = NULL;
+static int is_compound_start(Parser *Pr)
+{
+    return is_word(Pr, "if") || is_word(Pr, "while") || is_word(Pr, "until") ||
+           is_word(Pr, "for") || is_word(Pr, "case") || is_word(Pr, "{") ||
+           Pr->tok.type == TOK_LPAREN || Pr->tok.type == TOK_ARITH;
+}
 
-    parse_command(U, unit);
 
-    return U;
+static Node *parse_compound(Parser *Pr)
+{
+    Node *N = NULL;
+
+    if (Pr->tok.type == TOK_ARITH) {
+        N = node_new(NODE_ARITH);
+        N->word = Pr->tok.text;
+        Pr->tok.text = NULL;
+        lex(Pr);
+        return N;
+    }
+
+    if (Pr->tok.type == TOK_LPAREN) {
+        lex(Pr);
+        N = node_new(NODE_SUBSHELL);
+        if (!(N->body = parse_body(Pr)) || Pr->tok.type != TOK_RPAREN) {
+            parse_fail(Pr);
+            node_destroy(&N);
+            return NULL;
+        }
+        lex(Pr);
+        return N;
+    }
+
+    if (is_word(Pr, "{")) {
+        lex(Pr);
+        N = node_new(NODE_GROUP);
+        if (!(N->body = parse_body(Pr)) || !expect_word(Pr, "}"))
+            node_destroy(&N);
+        return N;
+    }
+
+    if (is_word(Pr, "if")) {
+        lex(Pr);
+        return parse_if(Pr);
+    }
+
+    if (is_word(Pr, "while")) {
+        lex(Pr);
+        return parse_loop(Pr, NODE_WHILE);
+    }
+
+    if (is_word(Pr, "until")) {
+        lex(Pr);
+        return parse_loop(Pr, NODE_UNTIL);
+    }
+
+    if (is_word(Pr, "for")) {
+        lex(Pr);
+        return parse_for(Pr);
+    }
+
+    if (is_word(Pr, "case")) {
+        lex(Pr);
+        return parse_case(Pr);
+    }
+
+    return NULL;
 }
 
 
-static void unit_destroy(Unit **U)
+/* name [()] compound-command, with the name already read */
+static Node *parse_funcdef(Parser *Pr, char *name)
 {
-    int i;
+    Node *N = node_new(NODE_FUNCDEF);
 
-    if (!*U)
-        return;
+    N->word = name;
 
-    if ((*U)->input_fn)
-        free((*U)->input_fn);
+    if (Pr->tok.type == TOK_LPAREN) {
+        lex(Pr);
+        if (Pr->tok.type != TOK_RPAREN) {
+            parse_fail(Pr);
+            goto fail;
+        }
+        lex(Pr);
+    }
 
-    if ((*U)->output_fn)
-        free((*U)->output_fn);
+    skip_newlines(Pr);
 
-    if ((*U)->argv) {
-        for (i=0; (*U)->argv[i]; i++)
-            free((*U)->argv[i]);
-        free((*U)->argv);
+    if (!is_compound_start(Pr)) {
+        parse_fail(Pr);
+        goto fail;
     }
 
-    free(*U);
-    *U = NULL;
+    if (!(N->body = parse_compound(Pr)))
+        goto fail;
+
+    return N;
+
+fail:
+    node_destroy(&N);
+    return NULL;
 }
 
 
-static void parse_add_unit(Parse *P, Unit *U, int i)
+/* reads one command of a pipeline: either a simple command (words and
+ * redirections), a compound command with optional redirections or a
+ * function definition */
+static Unit *parse_command(Parser *Pr)
 {
-    if (!valid_syntax(P, U, i)) {
-        P->invalid_syntax = 1;
-        goto out;
-    }
+    Unit *U = unit_new();
 
-    P->tasks[i].cmd = U->cmd;
+    expand_alias(Pr);
 
-    if (U->argv) {
-        P->tasks[i].argv = U->argv;
-        U->argv = NULL;
+    if (at_terminator(Pr)) {
+        parse_fail(Pr);
+        goto fail;
     }
 
-    if (U->input_fn && (i == 0)) {
-        P->infile = U->input_fn;
-        U->input_fn = NULL;
+    if (is_word(Pr, "function")) {
+        lex(Pr);
+        if (Pr->tok.type != TOK_WORD) {
+            parse_fail(Pr);
+            goto fail;
+        }
+        if (!(U->body = parse_funcdef(Pr, take_word(Pr))))
+            goto fail;
+    } else if (is_compound_start(Pr)) {
+        if (!(U->body = parse_compound(Pr)))
+            goto fail;
     }
 
-    if (U->output_fn && (i == P->ntasks-1)) {
-        P->outfile = U->output_fn;
-        U->output_fn = NULL;
+    for (;;) {
+        if (Pr->tok.type == TOK_WORD && !U->body) {
+            unit_add_arg(U, take_word(Pr));
+
+            /* name() starts a function definition */
+            if (U->argc == 1 && Pr->tok.type == TOK_LPAREN && !U->redirs) {
+                U->body = parse_funcdef(Pr, U->argv[0]);
+                U->argv[0] = NULL;
+                U->argc = 0;
+                if (!U->body)
+                    goto fail;
+                break;
+            }
+        } else if (is_redirect(Pr)) {
+            if (!parse_redirect(Pr, U))
+                goto fail;
+        } else {
+            break;
+        }
     }
 
-out:
+    if (Pr->tok.type == TOK_WORD || Pr->tok.type == TOK_ERROR ||
+        Pr->tok.type == TOK_LPAREN || Pr->tok.type == TOK_ARITH ||
+        (!U->argc && !U->body)) {
+        parse_fail(Pr);
+        goto fail;
+    }
+
+    return U;
+
+fail:
     unit_destroy(&U);
+    return NULL;
+}
+
+
+static int valid_syntax(Unit *U)
+{
+    if (!U)
+        return 0;
+
+    if (!U->argc && !U->body)
+        return 0;
+
+    return 1;
+}
+
+
+static void parse_add_unit(Parse *P, Unit *U)
+{
+    Task *T;
+
+    P->tasks = realloc(P->tasks, (P->ntasks + 1) * sizeof(*P->tasks));
+    T = &P->tasks[P->ntasks++];
+
+    T->argv = U->argv;
+    T->cmd = U->argv[0];
+    T->body = U->body;
+    T->redirs = U->redirs;
+    U->argv = NULL;
+    U->body = NULL;
+    U->redirs = NULL;
 }
 
 
@@ -348,32 +1152,237 @@ static Parse *parse_new()
 
     P->tasks = NULL;
     P->ntasks = 0;
-    P->infile = NULL;
-    P->outfile = NULL;
     P->background = 0;
-    P->invalid_syntax = 0;
+    P->text = NULL;
 
     return P;
 }
 
 
-static void parse_init(Parse *P, char *cmdline)
+static Node *parse_pipeline(Parser *Pr)
 {
-    P->background = is_background(cmdline);
+    Unit **units = NULL;
+    int nunits = 0, negate = 0, i;
+    size_t start = Pr->tok.start;
+    Node *N = NULL;
+    Parse *P;
 
-    if (count_char('&', cmdline)) {
-        P->invalid_syntax = 1;
-        return;
+    if (is_word(Pr, "!")) {
+        negate = 1;
+        lex(Pr);
     }
 
-    if (has_trailing('|', cmdline)) {
-        P->invalid_syntax = 1;
-        return;
+    for (;;) {
+        units = realloc(units, (nunits + 1) * sizeof(*units));
+        units[nunits] = parse_command(Pr);
+        if (!units[nunits])
+            goto out;
+        nunits++;
+
+        if (Pr->tok.type != TOK_PIPE)
+            break;
+
+        lex(Pr);
+        skip_newlines(Pr);
+    }
+
+    for (i=0; i<nunits; i++) {
+        if (!valid_syntax(units[i])) {
+            Pr->status = PARSE_ERROR;
+            goto out;
+        }
     }
 
-    P->ntasks = count_char('|', cmdline) + 1;
-    P->tasks = malloc(P->ntasks * sizeof(*P->tasks));
-    memset(P->tasks, 0, P->ntasks * sizeof(*P->tasks));
+    /* a lone compound command without redirections runs as is */
+    if (nunits == 1 && units[0]->body && units[0]->body->type != NODE_SUBSHELL &&
+        !units[0]->redirs) {
+        N = units[0]->body;
+        units[0]->body = NULL;
+        N->negate = negate;
+        goto out;
+    }
+
+    P = parse_new();
+    for (i=0; i<nunits; i++)
+        parse_add_unit(P, units[i]);
+    P->text = source_text(Pr, start, Pr->tok.start);
+
+    N = node_new(NODE_PIPELINE);
+    N->P = P;
+    N->negate = negate;
+
+out:
+    for (i=0; i<nunits; i++)
+        unit_destroy(&units[i]);
+    free(units);
+
+    return N;
+}
+
+
+static Node *parse_and_or(Parser *Pr)
+{
+    Node *N, *R, *J;
+    NodeType type;
+
+    N = parse_pipeline(Pr);
+
+    while (N && (Pr->tok.type == TOK_AND_IF || Pr->tok.type == TOK_OR_IF)) {
+        type = Pr->tok.type == TOK_AND_IF ? NODE_AND : NODE_OR;
+        lex(Pr);
+        skip_newlines(Pr);
+
+        R = parse_pipeline(Pr);
+        if (!R) {
+            node_destroy(&N);
+            break;
+        }
+
+        J = node_new(type);
+        J->cond = N;
+        J->body = R;
+        N = J;
+    }
+
+    return N;
+}
+
+
+/* marks N to run in the background, wrapping anything that is not
+ * already a pipeline as the single stage of one */
+static Node *make_background(Parser *Pr, Node *N, size_t start)
+{
+    char *text = source_text(Pr, start, Pr->tok.start);
+    Node *W;
+    Parse *P;
+
+    if (N->type != NODE_PIPELINE) {
+        P = parse_new();
+        P->tasks = malloc(sizeof(*P->tasks));
+        P->tasks[0].argv = malloc(sizeof(*P->tasks[0].argv));
+        P->tasks[0].argv[0] = NULL;
+        P->tasks[0].cmd = NULL;
+        P->tasks[0].body = N;
+        P->tasks[0].redirs = NULL;
+        P->ntasks = 1;
+
+        W = node_new(NODE_PIPELINE);
+        W->P = P;
+        N = W;
+    }
+
+    free(N->P->text);
+    N->P->text = malloc(strlen(text) + 3);
+    sprintf(N->P->text, "%s &", text);
+    N->P->background = 1;
+    free(text);
+
+    return N;
+}
+
+
+static Node *parse_list(Parser *Pr)
+{
+    Node *head = NULL, **tail = &head, *N;
+    size_t start;
+
+    skip_newlines(Pr);
+
+    while (Pr->status == PARSE_OK && !at_terminator(Pr)) {
+        start = Pr->tok.start;
+
+        N = parse_and_or(Pr);
+        if (!N)
+            break;
+
+        if (Pr->tok.type == TOK_AMP) {
+            N = make_background(Pr, N, start);
+            lex(Pr);
+        } else if (Pr->tok.type == TOK_SEMI) {
+            lex(Pr);
+        } else if (Pr->tok.type != TOK_NEWLINE && !at_terminator(Pr)) {
+            parse_fail(Pr);
+        }
+
+        *tail = N;
+        tail = &N->next;
+
+        skip_newlines(Pr);
+    }
+
+    if (Pr->status != PARSE_OK)
+        node_destroy(&head);
+
+    return head;
+}
+
+
+static void case_items_destroy(CaseItem *C)
+{
+    CaseItem *next;
+    int i;
+
+    for (; C; C=next) {
+        next = C->next;
+        for (i=0; C->patterns[i]; i++)
+            free(C->patterns[i]);
+        free(C->patterns);
+        node_destroy(&C->body);
+        free(C);
+    }
+}
+
+
+/* takes another reference to N, which node_destroy() then drops */
+Node *node_ref(Node *N)
+{
+    N->refs++;
+    return N;
+}
+
+
+void node_destroy(Node **N)
+{
+    Node *next;
+    int i;
+
+    for (; *N; *N=next) {
+        if ((*N)->refs) {
+            (*N)->refs--;
+            *N = NULL;
+            return;
+        }
+
+        next = (*N)->next;
+
+        parse_destroy(&(*N)->P);
+        node_destroy(&(*N)->cond);
+        node_destroy(&(*N)->body);
+        node_destroy(&(*N)->alt);
+        free((*N)->word);
+
+        if ((*N)->words) {
+            for (i=0; (*N)->words[i]; i++)
+                free((*N)->words[i]);
+            free((*N)->words);
+        }
+
+        case_items_destroy((*N)->items);
+        free(*N);
+    }
+}
+
+
+void redir_destroy(Redir **R)
+{
+    Redir *next;
+
+    for (; *R; *R=next) {
+        next = (*R)->next;
+        free((*R)->word);
+        free((*R)->delim);
+        free(*R);
+    }
 }
 
 
@@ -384,12 +1393,6 @@ void parse_destroy(Parse **P)
     if (!*P)
         return;
 
-    if ((*P)->infile)
-        free((*P)->infile);
-
-    if ((*P)->outfile)
-        free((*P)->outfile);
-
     if ((*P)->tasks) {
         for (i=0; i<(*P)->ntasks; i++) {
             if ((*P)->tasks[i].argv) {
@@ -398,65 +1401,130 @@ void parse_destroy(Parse **P)
 
                 free((*P)->tasks[i].argv);
             }
+            node_destroy(&(*P)->tasks[i].body);
+            redir_destroy(&(*P)->tasks[i].redirs);
         }
         free((*P)->tasks);
     }
 
+    free((*P)->text);
     free(*P);
     *P = NULL;
 }
 
 
-Parse *parse_cmdline(char *cmdline)
+Node *parse_cmdline(const char *cmdline, ParseStatus *status)
 {
-    char *str, *token, *state;
-    int i;
-    Unit *U;
-    Parse *P;
-
-    if (is_empty(cmdline))
+    Parser Pr;
+    Node *N;
+    size_t len = strlen(cmdline);
+
+    /* a trailing backslash continues the line */
+    if ((len >= 1 && cmdline[len-1] == '\\') ||
+        (len >= 2 && cmdline[len-2] == '\\' && cmdline[len-1] == '\n')) {
+        *status = PARSE_INCOMPLETE;
         return NULL;
+    }
 
-    P = parse_new();
-    parse_init(P, cmdline);
-
-    for (i=0, str=cmdline; !P->invalid_syntax; i++, str=NULL) {
-        token = strtok_r(str, "|", &state);
-        if (!token)
-            break;
-
-        U = parse_unit(token);
-
-        parse_add_unit(P, U, i);
+    Pr.s = cmdline;
+    Pr.buf = NULL;
+    Pr.pos = 0;
+    Pr.tok.text = NULL;
+    Pr.status = PARSE_OK;
+    Pr.nactive = 0;
+    Pr.heredocs = NULL;
+    Pr.nheredocs = 0;
+
+    lex(&Pr);
+    N = parse_list(&Pr);
+
+    if (Pr.status == PARSE_OK && Pr.tok.type != TOK_END) {
+        parse_fail(&Pr);
+        node_destroy(&N);
     }
 
-    return P;
+    free(Pr.tok.text);
+    while (Pr.nactive)
+        free(Pr.active[--Pr.nactive].name);
+    free(Pr.buf);
+    free(Pr.heredocs);
+    *status = Pr.status;
+
+    return N;
 }
 
 
-void parse_debug(Parse *P)
+static void pipeline_debug(Parse *P, int indent)
 {
+    static const char *names[] = { "<", ">", "<<", "<<<", ">>", ">&", "|>" };
+    Redir *R;
     int i, j;
 
-    fprintf(stderr, "==[ DEBUG: PARSE ]==================================\n");
-    fprintf(stderr, "Run in Background? %s\n", P->background ? "Yes" : "No");
+    fprintf(stderr, "%*sRun in Background? %s\n", indent, "", P->background ? "Yes" : "No");
 
-    if (P->infile)
-        fprintf(stderr, "infile: %s\n", P->infile);
+    fprintf(stderr, "%*sntasks: %i\n", indent, "", P->ntasks);
 
-    if (P->outfile)
-        fprintf(stderr, "outfile: %s\n", P->outfile);
+    for (i=0; i<P->ntasks; i++) {
+        fprintf(stderr, "%*sTask %i\n", indent, "", i);
 
-    fprintf(stderr, "ntasks: %i\n", P->ntasks);
+        if (P->tasks[i].body) {
+            fprintf(stderr, "%*s  - compound:\n", indent, "");
+            parse_debug_node(P->tasks[i].body, indent + 4);
+            continue;
+        }
 
-    for (i=0; i<P->ntasks; i++) {
-        fprintf(stderr, "Task %i\n", i);
-        fprintf(stderr, "  - cmd: [%s]\n", P->tasks[i].cmd);
+        fprintf(stderr, "%*s  - cmd: [%s]\n", indent, "", P->tasks[i].cmd);
 
         if (P->tasks[i].argv)
             for (j=0; P->tasks[i].argv[j]; j++)
-                fprintf(stderr, "    + arg[%i]: [%s]\n", j, P->tasks[i].argv[j]);
+                fprintf(stderr, "%*s    + arg[%i]: [%s]\n", indent, "", j, P->tasks[i].argv[j]);
+
+        for (R=P->tasks[i].redirs; R; R=R->next)
+            fprintf(stderr, "%*s    + redir %d %s [%s]\n", indent, "", R->fd,
+                    names[R->type], R->word);
     }
+}
+
 
+static void parse_debug_node(Node *N, int indent)
+{
+    static const char *names[] = {
+        "pipeline", "&&", "||", "if", "while", "until", "for", "case",
+        "group", "subshell", "arith", "function"
+    };
+    CaseItem *C;
+    int i;
+
+    for (; N; N=N->next) {
+        fprintf(stderr, "%*s%s%s", indent, "", N->negate ? "! " : "", names[N->type]);
+        if (N->word)
+            fprintf(stderr, " [%s]", N->word);
+        if (N->words)
+            for (i=0; N->words[i]; i++)
+                fprintf(stderr, " [%s]", N->words[i]);
+        fprintf(stderr, "\n");
+
+        if (N->P)
+            pipeline_debug(N->P, indent + 2);
+        parse_debug_node(N->cond, indent + 2);
+        parse_debug_node(N->body, indent + 2);
+        if (N->alt) {
+            fprintf(stderr, "%*selse\n", indent, "");
+            parse_debug_node(N->alt, indent + 2);
+        }
+        for (C=N->items; C; C=C->next) {
+            for (i=0; C->patterns[i]; i++)
+                fprintf(stderr, "%*s%s%s", i ? 0 : indent + 2, "", i ? "|" : "", C->patterns[i]);
+            fprintf(stderr, ")\n");
+            parse_debug_node(C->body, indent + 4);
+        }
+    }
+}
+
+
+void parse_debug(Node *N)
+{
+    fprintf(stderr, "==[ DEBUG: PARSE ]==================================\n");
+    parse_debug_node(N, 0);
     fprintf(stderr, "==================================[ DEBUG: PARSE ]==\n");
-}
\ No newline at end of file
+}
@@ -2,26 +2,94 @@
 #define PARSE_H
 
 #include <limits.h>
+#include <stddef.h>
+
+struct Node;
+
+typedef enum {
+    REDIR_IN,            /* [n]< word */
+    REDIR_OUT,           /* [n]> word */
+    REDIR_HEREDOC,       /* [n]<< delimiter, with the text in word */
+    REDIR_HERESTRING,    /* [n]<<< word */
+    REDIR_APPEND,        /* [n]>> word */
+    REDIR_DUP,           /* [n]>& word, [n]<& word: word is an fd or - */
+    REDIR_TEE,           /* [n]|> word: a copy of the output goes to word */
+} RedirType;
+
+typedef struct Redir {
+    RedirType type;
+    int fd;              /* the fd redirected */
+    char *word;
+    int quoted;          /* here-document delimiter was quoted: no expansion */
+    int strip_tabs;      /* <<- */
+    char *delim;         /* here-document delimiter, until its text is read */
+    struct Redir *next;
+} Redir;
 
 typedef struct {
     char *cmd;
-    char **argv;   /* NULL terminated array of strings */
+    char **argv;         /* NULL terminated array of strings */
+    struct Node *body;   /* compound command run as this stage, or NULL */
+    Redir *redirs;       /* in the order given */
 } Task;
 
 typedef struct {
     Task *tasks;         /* ordered list of tasks to pipe */
     int   ntasks;        /* # of tasks in the parse */
 
-    char *infile;        /* filename of 'infile'  */
-    char *outfile;       /* filename of 'outfile' */
-
     int background;      /* run process in background? */
-    int invalid_syntax;  /* parse failed */
+    char *text;          /* source text, used as the job name */
 } Parse;
 
+typedef enum {
+    NODE_PIPELINE,       /* P */
+    NODE_AND,            /* cond && body */
+    NODE_OR,             /* cond || body */
+    NODE_IF,             /* if cond; then body; else alt; fi */
+    NODE_WHILE,          /* while cond; do body; done */
+    NODE_UNTIL,          /* until cond; do body; done */
+    NODE_FOR,            /* for word in words; do body; done */
+    NODE_CASE,           /* case word in items esac */
+    NODE_GROUP,          /* { body; } */
+    NODE_SUBSHELL,       /* ( body ) */
+    NODE_ARITH,          /* (( word )) */
+    NODE_FUNCDEF,        /* word() body */
+} NodeType;
+
+typedef struct CaseItem {
+    char **patterns;
+    struct Node *body;
+    struct CaseItem *next;
+} CaseItem;
+
+typedef struct Node {
+    NodeType type;
+    Parse *P;
+    struct Node *cond;
+    struct Node *body;
+    struct Node *alt;    /* else branch; elif is a nested NODE_IF */
+    char *word;
+    char **words;        /* for ... in words (NULL: the positional params) */
+    CaseItem *items;
+    int negate;          /* ! pipeline */
+    int refs;            /* extra owners, e.g. the function table */
+    struct Node *next;   /* next command of a list */
+} Node;
+
+typedef enum {
+    PARSE_OK,
+    PARSE_INCOMPLETE,    /* more input needed (open quote, if without fi...) */
+    PARSE_ERROR,
+} ParseStatus;
+
+extern int parse_aliases;   /* expand aliases (interactive shells only) */
 
-Parse *parse_cmdline(char *cmdline);
+Node *parse_cmdline(const char *cmdline, ParseStatus *status);
+Node *node_ref(Node *N);
+void node_destroy(Node **N);
 void parse_destroy(Parse **P);
-void parse_debug(Parse *P);
+void redir_destroy(Redir **R);
+void parse_debug(Node *N);
+size_t parse_skip_subst(const char *s, size_t i);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,125 @@
+/* pcache.c
+ * the parse cache: source text -> command tree, least recently used
+ * first out.  Only complete, valid parses are kept, and texts longer
+ * than PCACHE_MAX_TEXT (whole scripts) are never worth holding on to.
+ *
+ * A tree depends on nothing but its text, except for the aliases it
+ * was parsed with, so the cache is emptied whenever those change.
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "pcache.h"
+
+#define PCACHE_SIZE      128
+#define PCACHE_MAX_TEXT  4096
+
+typedef struct Entry {
+    char *text;
+    Node *N;                    /* NULL for an empty command */
+    struct Entry *prev, *next;  /* most recently used first */
+} Entry;
+
+static HashTable *cache;
+static Entry *head, *tail;
+
+static unsigned long hits, misses;
+
+
+static void unlink_entry(Entry *e)
+{
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        head = e->next;
+
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        tail = e->prev;
+}
+
+
+static void push_front(Entry *e)
+{
+    e->prev = NULL;
+    e->next = head;
+
+    if (head)
+        head->prev = e;
+    else
+        tail = e;
+
+    head = e;
+}
+
+
+static void entry_free(void *p)
+{
+    Entry *e = p;
+
+    unlink_entry(e);
+    node_destroy(&e->N);
+    free(e->text);
+    free(e);
+}
+
+
+/**
+ * As parse_cmdline(), but an identical text parsed before is served
+ * from the cache without being tokenized again
+ */
+Node *pcache_parse(const char *text, ParseStatus *status)
+{
+    Entry *e;
+    Node *N;
+
+    if (strlen(text) > PCACHE_MAX_TEXT)
+        return parse_cmdline(text, status);
+
+    if (!cache)
+        cache = hash_new(entry_free);
+
+    e = hash_get(cache, text);
+    if (e) {
+        hits++;
+        unlink_entry(e);
+        push_front(e);
+        *status = PARSE_OK;
+        return e->N ? node_ref(e->N) : NULL;
+    }
+
+    misses++;
+
+    N = parse_cmdline(text, status);
+    if (*status != PARSE_OK)
+        return N;
+
+    if (cache->count >= PCACHE_SIZE)
+        hash_remove(cache, tail->text);
+
+    e = malloc(sizeof(*e));
+    e->text = strdup(text);
+    e->N = N ? node_ref(N) : NULL;
+    push_front(e);
+    hash_put(cache, text, e);
+
+    return N;
+}
+
+
+void pcache_clear(void)
+{
+    if (cache)
+        hash_clear(cache);
+}
+
+
+void pcache_print(void)
+{
+    printf("hits: %lu  misses: %lu  entries: %zu/%d\n", hits, misses,
+           cache ? cache->count : (size_t)0, PCACHE_SIZE);
+}
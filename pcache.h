@@ -0,0 +1,14 @@
+#ifndef PCACHE_H
+#define PCACHE_H
+
+#include "parse.h"
+
+/* a bounded LRU cache of command trees keyed by the exact source text,
+ * for lines that are run again and again (history, $( ) in loops).
+ * The trees are immutable; the caller gets a reference of its own and
+ * gives it up with node_destroy() as usual. */
+Node *pcache_parse(const char *text, ParseStatus *status);
+void pcache_clear(void);
+void pcache_print(void);
+
+#endif
@@ -3,14 +3,18 @@
 #include <string.h>
 #include <unistd.h>
 #include <readline/readline.h>
-#include <fcntl.h>
-#include <sys/wait.h>
+#include <errno.h>
 #include <limits.h>
 #include <signal.h>
+#include <sys/stat.h>
 
-#include "builtin.h"
+#include "exec.h"
 #include "parse.h"
 #include "job_control.h"
+#include "pcache.h"
+#include "psshc.h"
+#include "queue.h"
+#include "vars.h"
 
 /*******************************************
  * Set to 1 to view the command line parse *
@@ -51,255 +55,218 @@ static char *build_prompt()
     return prompt;
 }
 
-/* return true if command is found, either:
- *   - a valid fully qualified path was supplied to an existing file
- *   - the executable file was found in the system's PATH
- * false is returned otherwise */
-static int command_found(const char *cmd)
+/* called by readline while it waits for keys: queued jobs start as
+ * slots free up even when nothing is typed */
+static int idle_hook(void)
 {
-    char *dir;
-    char *tmp;
-    char *PATH;
-    char *state;
-    char probe[PATH_MAX];
+    if (queue_drain()) {
+        rl_on_new_line();
+        rl_redisplay();
+    }
+
+    return 0;
+}
 
-    int ret = 0;
+/* reads one line at the prompt.  SIGCHLD is let through meanwhile so
+ * that background jobs are reaped (and reported) while the shell idles */
+static char *read_interactive(const char *prompt)
+{
+    sigset_t mask, prev;
+    char *line;
 
-    if (access(cmd, X_OK) == 0)
-        return 1;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_UNBLOCK, &mask, &prev);
 
-    PATH = strdup(getenv("PATH"));
+    line = readline(prompt);
 
-    for (tmp=PATH; ; tmp=NULL) {
-        dir = strtok_r(tmp, ":", &state);
-        if (!dir)
-            break;
+    sigprocmask(SIG_SETMASK, &prev, NULL);
 
-        strncpy(probe, dir, PATH_MAX-1);
-        strncat(probe, "/", PATH_MAX-1);
-        strncat(probe, cmd, PATH_MAX-1);
+    return line;
+}
 
-        if (access(probe, X_OK) == 0) {
-            ret = 1;
-            break;
-        }
+/* reads one line of a script fed on stdin, without the newline */
+static char *read_script_line()
+{
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+
+    n = getline(&line, &cap, stdin);
+    if (n < 0) {
+        free(line);
+        return NULL;
     }
 
-    free(PATH);
-    return ret;
+    if (n > 0 && line[n-1] == '\n')
+        line[n-1] = '\0';
+
+    return line;
 }
 
-/* Called upon receiving a successful parse.
- * This function is responsible for cycling through the
- * tasks, and forking, executing, etc as necessary to get
- * the job done! */
-void execute_tasks(Parse *P)
+/* runs a complete, parsed piece of source */
+static int run_tree(Node *N)
 {
-    if (P->ntasks <= 0)
-        return;
-    
-    // single builtin command handler - if it's a builtin, gets executed directly in the parent
-    if (P->ntasks == 1 && is_builtin(P->tasks[0].cmd)) {
-         if (!strcmp(P->tasks[0].cmd, "which"))
-              builtin_which(P->tasks[0]);
-         else
-              builtin_execute(P->tasks[0]);
-         return;
-    }
+#if DEBUG_PARSE
+    parse_debug(N);
+#endif
 
-    // Prepare for job creation
-    pid_t pids[P->ntasks];
-    int num_pids = 0;
-    pid_t pgid = 0;
-    int is_background = P->background;
-    
-    // Reconstruct command line from tasks
-    char cmdline[PATH_MAX * 2] = {0};
-    for (int i = 0; i < P->ntasks; i++) {
-        for (int j = 0; P->tasks[i].argv[j] != NULL; j++) {
-            if (j > 0 || i > 0) strcat(cmdline, " ");
-            strcat(cmdline, P->tasks[i].argv[j]);
-        }
-        if (i < P->ntasks - 1) strcat(cmdline, " |");
-    }
-    if (is_background) strcat(cmdline, " &");
-    
-    // pipeline execution for multiple commands | | |
-    int num_tasks = P->ntasks;
-    int num_pipes = num_tasks - 1;
-    int pipefds[2 * num_pipes];
-    
-    for (int i = 0; i < num_pipes; i++) {
-         if (pipe(pipefds + i*2) < 0) {
-              perror("pipe");
-              exit(EXIT_FAILURE);
-         }
+    exec_node(N);
+    node_destroy(&N);
+
+    return last_status;
+}
+
+/* parses and runs a complete piece of source given with -c */
+static int run_source(const char *text)
+{
+    ParseStatus status;
+    Node *N;
+
+    N = parse_cmdline(text, &status);
+    if (status != PARSE_OK) {
+        printf("pssh: invalid syntax\n");
+        return 2;
     }
-    
-    for (int i = 0; i < num_tasks; i++) {
-         if (!is_builtin(P->tasks[i].cmd) && !command_found(P->tasks[i].cmd)) {
-              printf("pssh: command not found: %s\n", P->tasks[i].cmd);
-              return;
-         }
-         
-         pid_t pid = fork();
-         if (pid < 0) {
-              perror("fork");
-              exit(EXIT_FAILURE);
-         }
-         
-         if (pid == 0) {
-              // Child process
-              
-              // Set up process group for first process in pipeline
-              if (i == 0) {
-                   pgid = getpid();
-              }
-              setpgid(0, pgid);
-              
-              // Set up pipes
-              if (i == 0) {
-                   if (P->infile) {
-                        int fd = open(P->infile, O_RDONLY);
-                        if (fd < 0) {
-                             perror("open infile");
-                             exit(EXIT_FAILURE);
-                        }
-                        if (dup2(fd, STDIN_FILENO) < 0) {
-                             perror("dup2 infile");
-                             exit(EXIT_FAILURE);
-                        }
-                        close(fd);
-                   }
-              }
-              if (i > 0) {
-                   if (dup2(pipefds[(i-1)*2], STDIN_FILENO) < 0) {
-                        perror("dup2");
-                        exit(EXIT_FAILURE);
-                   }
-              }
-              if (i == num_tasks - 1) {
-                   if (P->outfile) {
-                        int fd = open(P->outfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-                        if (fd < 0) {
-                             perror("open outfile");
-                             exit(EXIT_FAILURE);
-                        }
-                        if (dup2(fd, STDOUT_FILENO) < 0) {
-                             perror("dup2 outfile");
-                             exit(EXIT_FAILURE);
-                        }
-                        close(fd);
-                   }
-              }
-              if (i < num_tasks - 1) {
-                   if (dup2(pipefds[i*2 + 1], STDOUT_FILENO) < 0) {
-                        perror("dup2");
-                        exit(EXIT_FAILURE);
-                   }
-              }
-              
-              // Close all pipe fds in child
-              for (int j = 0; j < 2 * num_pipes; j++)
-                   close(pipefds[j]);
-              
-              // Reset signal handlers to default in child
-              signal(SIGINT, SIG_DFL);
-              signal(SIGQUIT, SIG_DFL);
-              signal(SIGTSTP, SIG_DFL);
-              signal(SIGTTIN, SIG_DFL);
-              signal(SIGTTOU, SIG_DFL);
-              signal(SIGCHLD, SIG_DFL);
-              
-              execvp(P->tasks[i].cmd, P->tasks[i].argv);
-              perror(P->tasks[i].cmd);
-              exit(EXIT_FAILURE);
-         } else {
-              // Parent process
-              pids[num_pids++] = pid;
-              
-              // Set up process group for first process
-              if (i == 0) {
-                   pgid = pid;
-              }
-              setpgid(pid, pgid);
-         }
+
+    return run_tree(N);
+}
+
+static int run_file(const char *fn)
+{
+    FILE *fp;
+    char *text = NULL;
+    size_t len = 0, n;
+    struct stat st;
+    ParseStatus status;
+    Node *N;
+    int have_st;
+
+    fp = fopen(fn, "r");
+    if (!fp) {
+        fprintf(stderr, "pssh: %s: %s\n", fn, strerror(errno));
+        return 127;
     }
-    
-    // Close all pipe fds in parent
-    for (int i = 0; i < 2 * num_pipes; i++)
-         close(pipefds[i]);
-    
-    // Create new job
-    int job_id = add_job(pids, num_pids, pgid, cmdline, is_background ? BG : FG);
-    
-    if (job_id < 0) {
-         // Failed to create job, kill all processes
-         for (int i = 0; i < num_pids; i++) {
-              kill(pids[i], SIGKILL);
-         }
-         return;
+
+    /* an unchanged script runs from its cached tree */
+    have_st = fstat(fileno(fp), &st) == 0;
+    if (have_st && (N = psshc_load(fn, &st))) {
+        fclose(fp);
+        return run_tree(N);
     }
-    
-    Job* job = find_job_by_job_id(job_id);
-    
-    if (!is_background) {
-         // Put job in foreground
-         put_job_in_foreground(job, 0);
-    } else {
-         // Put job in background
-         put_job_in_background(job, 0);
+
+    do {
+        text = realloc(text, len + 4096 + 1);
+        n = fread(text + len, 1, 4096, fp);
+        len += n;
+    } while (n > 0);
+    text[len] = '\0';
+    fclose(fp);
+
+    N = parse_cmdline(text, &status);
+    free(text);
+
+    if (status != PARSE_OK) {
+        printf("pssh: invalid syntax\n");
+        return 2;
     }
-    
-    set_fg_pgid(getpid());
+
+    /* before running it, as the script may well exit */
+    if (have_st && N)
+        psshc_store(fn, &st, N);
+
+    return run_tree(N);
 }
 
+/* usage:  pssh [-c string [name [arg ...]] | file [arg ...]]
+ *
+ * With no arguments commands are read from stdin, interactively when
+ * it is a terminal. */
 int main(int argc, char **argv)
 {
-    (void)argc;  
-    (void)argv;  
-    
-    char *cmdline;
-    Parse *P;
+    char *line, *prompt, *cmdline = NULL;
+    int interactive = argc == 1 && isatty(STDIN_FILENO);
+    ParseStatus status;
+    Node *N;
+
+    init_job_control(interactive);
+    vars_init();
+    shell_pid = getpid();
+
+    /* a script's queued commands run before it ends, however it ends */
+    if (!interactive)
+        atexit(queue_finish);
 
-    init_job_control();
+    if (argc > 2 && !strcmp(argv[1], "-c")) {
+        var_set_arg0(argc > 3 ? argv[3] : argv[0]);
+        var_set_positional(argv + 4, argc > 4 ? argc - 4 : 0);
+        exit(run_source(argv[2]));
+    }
+
+    if (argc > 1) {
+        var_set_arg0(argv[1]);
+        var_set_positional(argv + 2, argc - 2);
+        exit(run_file(argv[1]));
+    }
 
-    print_banner();
+    if (interactive) {
+        parse_aliases = 1;
+        rl_event_hook = idle_hook;
+        print_banner();
+    }
 
     while (1) {
-        set_fg_pgid(getpid());
-        
-        cleanup_completed_jobs();
-        
-        char *prompt = build_prompt();
-        cmdline = readline(prompt);
-        free(prompt);
-
-        if (!cmdline)       /* EOF */
-            exit(EXIT_SUCCESS);
-
-        P = parse_cmdline(cmdline);
-        free(cmdline);
+        if (interactive && !cmdline) {
+            set_fg_pgid(shell_pgid);
+            cleanup_completed_jobs();
+        }
+
+        if (interactive) {
+            prompt = cmdline ? strdup("> ") : build_prompt();
+            line = read_interactive(prompt);
+            free(prompt);
+        } else {
+            line = read_script_line();
+        }
+
+        if (!line) {        /* EOF */
+            if (cmdline)
+                printf("pssh: syntax error: unexpected end of file\n");
+            exit(cmdline ? 2 : last_status);
+        }
+
+        /* lines accumulate until they form complete commands */
+        if (cmdline) {
+            cmdline = realloc(cmdline, strlen(cmdline) + strlen(line) + 2);
+            strcat(cmdline, "\n");
+            strcat(cmdline, line);
+            free(line);
+        } else {
+            cmdline = line;
+        }
 
-        if (!P)
+        N = pcache_parse(cmdline, &status);
+        if (status == PARSE_INCOMPLETE)
             continue;
 
-        if (P->invalid_syntax) {
+        free(cmdline);
+        cmdline = NULL;
+
+        if (status == PARSE_ERROR) {
             printf("pssh: invalid syntax\n");
-            parse_destroy(&P);
+            last_status = 2;
             continue;
         }
 
 #if DEBUG_PARSE
-        parse_debug(P);
+        parse_debug(N);
 #endif
 
-        execute_tasks(P);
+        job_interrupted = 0;
+        exec_node(N);
 
-        parse_destroy(&P);
-        
-        set_fg_pgid(getpid());
+        node_destroy(&N);
     }
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
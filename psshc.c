@@ -0,0 +1,434 @@
+/* psshc.c
+ * the script cache.  A script's command tree is written out depth first
+ * into $XDG_CACHE_HOME/pssh/<hash of the path>.psshc (~/.cache/pssh if
+ * that is unset) behind a header naming the script, its mtime and its
+ * size.  Later runs mmap the file, check the header against a fresh
+ * stat() of the script and rebuild the tree straight from the mapping.
+ * A stale or damaged cache is simply parsed over and replaced.
+ *
+ * Encoding (native byte order, the cache never leaves the machine):
+ *   string  u32 length (NONE for NULL), bytes
+ *   vector  u32 count (NONE for NULL), strings
+ *   node    u32 count of the list, then per node: type, negate, word,
+ *           words, pipeline, cond, body, alt, case items
+ **********************************************************************/
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "psshc.h"
+
+#define PSSHC_MAGIC    "PSSHC\n"
+#define PSSHC_VERSION  3        /* bump with any change to the trees */
+#define NONE           UINT32_MAX
+
+typedef struct {
+    char *buf;
+    size_t len, cap;
+} Writer;
+
+typedef struct {
+    const char *p, *end;
+    int error;                  /* ran off the end, or a value out of range:
+                                 * the file is damaged */
+} Reader;
+
+
+/* path of the cache file for script; 0 if there is nowhere to put it */
+static int cache_path(const char *script, char *out, size_t size, int create)
+{
+    const char *xdg = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+    char base[PATH_MAX], dir[PATH_MAX + 8];
+    uint64_t h = 14695981039346656037ULL;
+    const char *s;
+
+    if (xdg && *xdg)
+        snprintf(base, sizeof(base), "%s", xdg);
+    else if (home && *home)
+        snprintf(base, sizeof(base), "%s/.cache", home);
+    else
+        return 0;
+
+    snprintf(dir, sizeof(dir), "%s/pssh", base);
+
+    if (create) {
+        mkdir(base, 0700);
+        mkdir(dir, 0700);
+    }
+
+    /* FNV-1a */
+    for (s=script; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 1099511628211ULL;
+    }
+
+    return snprintf(out, size, "%s/%016llx.psshc", dir,
+                    (unsigned long long)h) < (int)size;
+}
+
+
+/*** writing ***/
+
+static void put(Writer *W, const void *p, size_t n)
+{
+    if (W->len + n > W->cap) {
+        W->cap = (W->len + n) * 2;
+        W->buf = realloc(W->buf, W->cap);
+    }
+
+    memcpy(W->buf + W->len, p, n);
+    W->len += n;
+}
+
+
+static void put_u32(Writer *W, uint32_t v)
+{
+    put(W, &v, sizeof(v));
+}
+
+
+static void put_str(Writer *W, const char *s)
+{
+    if (!s) {
+        put_u32(W, NONE);
+        return;
+    }
+
+    put_u32(W, strlen(s));
+    put(W, s, strlen(s));
+}
+
+
+static void put_strv(Writer *W, char **v)
+{
+    uint32_t n;
+
+    if (!v) {
+        put_u32(W, NONE);
+        return;
+    }
+
+    for (n=0; v[n]; n++);
+    put_u32(W, n);
+    for (n=0; v[n]; n++)
+        put_str(W, v[n]);
+}
+
+
+static void put_nodes(Writer *W, Node *N);
+
+static void put_parse(Writer *W, Parse *P)
+{
+    Redir *R;
+    uint32_t n;
+    int i;
+
+    if (!P) {
+        put_u32(W, NONE);
+        return;
+    }
+
+    put_u32(W, P->ntasks);
+    put_u32(W, P->background);
+    put_str(W, P->text);
+
+    for (i=0; i<P->ntasks; i++) {
+        put_strv(W, P->tasks[i].argv);
+        put_nodes(W, P->tasks[i].body);
+
+        for (n=0, R=P->tasks[i].redirs; R; R=R->next)
+            n++;
+        put_u32(W, n);
+        for (R=P->tasks[i].redirs; R; R=R->next) {
+            put_u32(W, R->type);
+            put_u32(W, R->fd);
+            put_u32(W, R->quoted);
+            put_u32(W, R->strip_tabs);
+            put_str(W, R->word);
+        }
+    }
+}
+
+
+static void put_nodes(Writer *W, Node *N)
+{
+    CaseItem *C;
+    uint32_t n;
+    Node *M;
+
+    for (n=0, M=N; M; M=M->next)
+        n++;
+    put_u32(W, n);
+
+    for (; N; N=N->next) {
+        put_u32(W, N->type);
+        put_u32(W, N->negate);
+        put_str(W, N->word);
+        put_strv(W, N->words);
+        put_parse(W, N->P);
+        put_nodes(W, N->cond);
+        put_nodes(W, N->body);
+        put_nodes(W, N->alt);
+
+        for (n=0, C=N->items; C; C=C->next)
+            n++;
+        put_u32(W, n);
+        for (C=N->items; C; C=C->next) {
+            put_strv(W, C->patterns);
+            put_nodes(W, C->body);
+        }
+    }
+}
+
+
+static void put_header(Writer *W, const char *path, const struct stat *st)
+{
+    int64_t key[3] = { st->st_mtim.tv_sec, st->st_mtim.tv_nsec, st->st_size };
+
+    put(W, PSSHC_MAGIC, strlen(PSSHC_MAGIC));
+    put_u32(W, PSSHC_VERSION);
+    put(W, key, sizeof(key));
+    put_str(W, path);
+}
+
+
+void psshc_store(const char *path, const struct stat *st, Node *N)
+{
+    char real[PATH_MAX], file[PATH_MAX], tmp[PATH_MAX + 16];
+    Writer W = { NULL, 0, 0 };
+    ssize_t n;
+    size_t off;
+    int fd;
+
+    if (!realpath(path, real) || !cache_path(real, file, sizeof(file), 1))
+        return;
+
+    put_header(&W, real, st);
+    put_nodes(&W, N);
+
+    /* written aside and renamed, so a reader never sees half of it */
+    snprintf(tmp, sizeof(tmp), "%s.%d", file, (int)getpid());
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        free(W.buf);
+        return;
+    }
+
+    for (off=0; off<W.len; off+=n)
+        if ((n = write(fd, W.buf + off, W.len - off)) <= 0)
+            break;
+
+    close(fd);
+    free(W.buf);
+
+    if (off < W.len || rename(tmp, file) < 0)
+        unlink(tmp);
+}
+
+
+/*** reading ***/
+
+static const char *get(Reader *R, size_t n)
+{
+    const char *p = R->p;
+
+    if (R->error || (size_t)(R->end - R->p) < n) {
+        R->error = 1;
+        return NULL;
+    }
+
+    R->p += n;
+
+    return p;
+}
+
+
+static uint32_t get_u32(Reader *R)
+{
+    const char *p = get(R, sizeof(uint32_t));
+    uint32_t v = 0;
+
+    if (p)
+        memcpy(&v, p, sizeof(v));
+
+    return v;
+}
+
+
+static char *get_str(Reader *R)
+{
+    uint32_t n = get_u32(R);
+    const char *p;
+
+    if (n == NONE || R->error)
+        return NULL;
+
+    p = get(R, n);
+
+    return p ? strndup(p, n) : NULL;
+}
+
+
+static char **get_strv(Reader *R)
+{
+    uint32_t i, n = get_u32(R);
+    char **v;
+
+    if (n == NONE || R->error)
+        return NULL;
+
+    /* every string takes at least its length word */
+    if (n > (size_t)(R->end - R->p) / 4) {
+        R->error = 1;
+        return NULL;
+    }
+
+    /* after an error the rest are NULL, so v still ends at the first */
+    v = malloc((n + 1) * sizeof(*v));
+    for (i=0; i<n; i++)
+        v[i] = get_str(R);
+    v[n] = NULL;
+
+    return v;
+}
+
+
+static Node *get_nodes(Reader *R);
+
+static Parse *get_parse(Reader *R)
+{
+    uint32_t i, j, type, fd, n = get_u32(R);
+    Redir **tail;
+    Parse *P;
+
+    if (n == NONE || R->error || n > (size_t)(R->end - R->p))
+        return NULL;
+
+    P = malloc(sizeof(*P));
+    P->ntasks = n;
+    P->tasks = calloc(n ? n : 1, sizeof(*P->tasks));
+    P->background = get_u32(R);
+    P->text = get_str(R);
+
+    for (i=0; i<n && !R->error; i++) {
+        P->tasks[i].argv = get_strv(R);
+        if (!P->tasks[i].argv) {
+            R->error = 1;
+            break;
+        }
+        P->tasks[i].cmd = P->tasks[i].argv[0];
+        P->tasks[i].body = get_nodes(R);
+
+        tail = &P->tasks[i].redirs;
+        for (j=get_u32(R); j>0 && !R->error; j--) {
+            *tail = calloc(1, sizeof(**tail));
+            type = get_u32(R);
+            fd = get_u32(R);
+            if (type > REDIR_TEE || fd > INT_MAX)
+                R->error = 1;
+            (*tail)->type = R->error ? REDIR_IN : (RedirType)type;
+            (*tail)->fd = R->error ? 0 : (int)fd;
+            (*tail)->quoted = get_u32(R);
+            (*tail)->strip_tabs = get_u32(R);
+            (*tail)->word = get_str(R);
+            tail = &(*tail)->next;
+        }
+    }
+
+    return P;
+}
+
+
+static Node *get_nodes(Reader *R)
+{
+    uint32_t i, type, n = get_u32(R);
+    Node *head = NULL, **tail = &head, *N;
+    CaseItem **ctail;
+
+    for (; n>0 && !R->error; n--) {
+        N = calloc(1, sizeof(*N));
+        *tail = N;
+        tail = &N->next;
+
+        /* out of range, it would index the tables of node names */
+        type = get_u32(R);
+        if (type > NODE_FUNCDEF)
+            R->error = 1;
+        N->type = R->error ? NODE_PIPELINE : (NodeType)type;
+        N->negate = get_u32(R);
+        N->word = get_str(R);
+        N->words = get_strv(R);
+        N->P = get_parse(R);
+        N->cond = get_nodes(R);
+        N->body = get_nodes(R);
+        N->alt = get_nodes(R);
+
+        ctail = &N->items;
+        for (i=get_u32(R); i>0 && !R->error; i--) {
+            *ctail = calloc(1, sizeof(**ctail));
+            (*ctail)->patterns = get_strv(R);
+            if (!(*ctail)->patterns) {
+                (*ctail)->patterns = calloc(1, sizeof(char *));
+                R->error = 1;
+            }
+            (*ctail)->body = get_nodes(R);
+            ctail = &(*ctail)->next;
+        }
+    }
+
+    return head;
+}
+
+
+Node *psshc_load(const char *path, const struct stat *st)
+{
+    char real[PATH_MAX], file[PATH_MAX];
+    Writer H = { NULL, 0, 0 };
+    struct stat cst;
+    Reader R;
+    Node *N = NULL;
+    void *map;
+    int fd;
+
+    if (!realpath(path, real) || !cache_path(real, file, sizeof(file), 0))
+        return NULL;
+
+    fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &cst) < 0 || !cst.st_size) {
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    /* the header must be exactly the one we would write now */
+    put_header(&H, real, st);
+
+    if ((size_t)cst.st_size > H.len && !memcmp(map, H.buf, H.len)) {
+        R.p = (const char *)map + H.len;
+        R.end = (const char *)map + cst.st_size;
+        R.error = 0;
+
+        N = get_nodes(&R);
+        if (R.error || R.p != R.end)
+            node_destroy(&N);
+    }
+
+    free(H.buf);
+    munmap(map, cst.st_size);
+
+    return N;
+}
@@ -0,0 +1,20 @@
+#ifndef PSSHC_H
+#define PSSHC_H
+
+#include <sys/stat.h>
+
+#include "parse.h"
+
+/* the script cache: the parsed form of a script file, kept in a binary
+ * .psshc file keyed by the script's path, mtime and size so that later
+ * runs start executing without lexing or parsing it again */
+
+/* the tree for the script at path (as stat'ed in *st), or NULL if there
+ * is no up to date cache for it */
+Node *psshc_load(const char *path, const struct stat *st);
+
+/* writes the cache for a freshly parsed script; failures are silent,
+ * the script is simply parsed again next time */
+void psshc_store(const char *path, const struct stat *st, Node *N);
+
+#endif
@@ -0,0 +1,264 @@
+/* queue.c
+ * a task spooler in the shell.  queue puts a command in the job table
+ * as a QUEUED job, and queue_drain() starts queued jobs in the background
+ * while fewer than max of the jobs it started are still around.  It can
+ * also hold back while the load average is too high or available memory
+ * too low.  Draining happens before each pipeline the shell runs, while
+ * it idles at the prompt and in queue -w; a script that ends with jobs
+ * still queued runs them first.
+ *
+ * A queued job is launched from the words it was given, as they were
+ * expanded when it was queued, or from its text (queue -e) as "text &",
+ * or "( text ) &" if it is more than a pipeline of programs.  It gives
+ * up its queue entry first, so it usually gets its number back as a
+ * running job.
+ **********************************************************************/
+
+#define _GNU_SOURCE
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "exec.h"
+#include "expand.h"
+#include "job_control.h"
+#include "queue.h"
+
+static int queue_max;           /* 0: one per CPU */
+static double queue_load;       /* 0: no limit */
+static long queue_mem;          /* MB, 0: no limit */
+static long queue_seq;          /* of the last job queued */
+
+
+int queue_add(const char *text, char **argv, int prio)
+{
+    int job_id = add_job(NULL, 0, 0, (char *)text, QUEUED);
+    Job *J;
+    int n;
+
+    if (job_id < 0)
+        return -1;
+
+    J = find_job_by_job_id(job_id);
+    J->prio = prio;
+    J->qseq = ++queue_seq;
+
+    if (argv) {
+        for (n=0; argv[n]; n++)
+            ;
+        J->argv = malloc((n + 1) * sizeof(char *));
+        for (n=0; argv[n]; n++)
+            J->argv[n] = strdup(argv[n]);
+        J->argv[n] = NULL;
+    }
+
+    return job_id;
+}
+
+
+void queue_set_limits(int max, double load, long mem_mb)
+{
+    if (max >= 0)
+        queue_max = max;
+    if (load >= 0)
+        queue_load = load;
+    if (mem_mb >= 0)
+        queue_mem = mem_mb;
+}
+
+
+/* the queued job to start next: highest priority, then oldest */
+static Job *queue_next(void)
+{
+    Job *best = NULL;
+
+    for (int i = 0; i < num_jobs; i++) {
+        if (jobs[i].status != QUEUED)
+            continue;
+        if (!best || jobs[i].prio > best->prio ||
+            (jobs[i].prio == best->prio && jobs[i].qseq < best->qseq))
+            best = &jobs[i];
+    }
+
+    return best;
+}
+
+
+/* # of the jobs the queue started that are still in the table */
+static int queue_running(void)
+{
+    int n = 0;
+
+    for (int i = 0; i < num_jobs; i++)
+        if (jobs[i].qseq && jobs[i].status != QUEUED)
+            n++;
+
+    return n;
+}
+
+
+/* MemAvailable in MB, or -1 if the kernel does not say */
+static long mem_available(void)
+{
+    FILE *f = fopen("/proc/meminfo", "r");
+    char line[128];
+    long kb = -1;
+
+    if (!f)
+        return -1;
+
+    while (fgets(line, sizeof(line), f))
+        if (sscanf(line, "MemAvailable: %ld kB", &kb) == 1)
+            break;
+
+    fclose(f);
+
+    return kb < 0 ? -1 : kb / 1024;
+}
+
+
+/* the load or memory limit holds the queue back */
+static int queue_throttled(void)
+{
+    double load;
+    long mem;
+
+    if (queue_load > 0 && getloadavg(&load, 1) == 1 && load >= queue_load)
+        return 1;
+
+    if (queue_mem > 0 && (mem = mem_available()) >= 0 && mem < queue_mem)
+        return 1;
+
+    return 0;
+}
+
+
+/* runs argv, or text, as a background job and tags the job as the
+ * queue's */
+static void queue_launch(const char *text, char **argv, long qseq)
+{
+    int saved_status = last_status;
+    pid_t saved_bg = last_bg_pid;
+    Node *N = NULL;
+
+    last_bg_pid = 0;
+    if (!argv)
+        N = parse_job(text, 1);
+    if (argv || N) {
+        if (argv)
+            execute_argv(argv, text, 1);
+        else
+            exec_node(N);
+
+        /* listed as it was queued, not as it was wrapped */
+        for (int i = 0; last_bg_pid && i < num_jobs; i++) {
+            for (unsigned int j = 0; j < jobs[i].npids; j++) {
+                if (jobs[i].pids[j] == last_bg_pid) {
+                    jobs[i].qseq = qseq;
+                    free(jobs[i].name);
+                    jobs[i].name = strdup(text);
+                }
+            }
+        }
+    } else {
+        printf("pssh: queue: %s: invalid syntax\n", text);
+    }
+    node_destroy(&N);
+
+    last_status = saved_status;
+    last_bg_pid = saved_bg;
+}
+
+
+int queue_drain(void)
+{
+    static int draining;
+    sigset_t mask, prev;
+    int max, started = 0;
+    char *text, **argv;
+    long qseq;
+    Job *J;
+
+    /* run before every pipeline: nothing to do must cost nothing */
+    if (draining || !queue_next())
+        return 0;
+
+    /* also called from the prompt, where SIGCHLD is let through */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &prev);
+    draining = 1;
+
+    max = queue_max > 0 ? queue_max : batch_ncpus();
+
+    while ((J = queue_next()) && queue_running() < max && !queue_throttled()) {
+        text = strdup(J->name);
+        argv = J->argv;
+        J->argv = NULL;
+        qseq = J->qseq;
+        remove_job(J->job_id);
+
+        queue_launch(text, argv, qseq);
+        argv_free(argv);
+        free(text);
+        started++;
+    }
+
+    draining = 0;
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+
+    return started;
+}
+
+
+int queue_wait(void)
+{
+    struct timespec tick = { 1, 0 };
+    sigset_t waitmask;
+
+    sigprocmask(SIG_BLOCK, NULL, &waitmask);
+    sigdelset(&waitmask, SIGCHLD);
+
+    for (;;) {
+        queue_drain();
+
+        if (!queue_next() && !queue_running())
+            return 0;
+
+        /* woken by jobs ending; the tick is for the load and memory
+         * limits, which change on their own */
+        ppoll(NULL, 0, &tick, &waitmask);
+
+        if (job_interrupted)
+            return 130;
+    }
+}
+
+
+void queue_finish(void)
+{
+    if (getpid() == shell_pid && queue_next())
+        queue_wait();
+}
+
+
+void queue_print(void)
+{
+    int max = queue_max > 0 ? queue_max : batch_ncpus();
+
+    printf("queue: %d running of %d at most", queue_running(), max);
+    if (queue_load > 0)
+        printf(", load below %g", queue_load);
+    if (queue_mem > 0)
+        printf(", %ld MB available", queue_mem);
+    printf("\n");
+
+    for (int i = 0; i < num_jobs; i++)
+        if (jobs[i].status == QUEUED)
+            printf("[%d] %d %s\n", jobs[i].job_id, jobs[i].prio, jobs[i].name);
+}
@@ -0,0 +1,27 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+/* the job queue: commands waiting in the job table (as QUEUED jobs)
+ * for a slot, started in the background by priority and then in the
+ * order they were queued */
+
+/* queues a command: its expanded words argv (text is then just its
+ * name), or with argv NULL, the shell text; returns its job id, or -1 */
+int queue_add(const char *text, char **argv, int prio);
+
+/* starts what fits in the free slots; returns the # started */
+int queue_drain(void);
+
+/* waits until the queue is empty and the jobs it started are done;
+ * 0, or 130 if interrupted */
+int queue_wait(void);
+
+/* at the end of a script: runs what is still queued, and waits for it */
+void queue_finish(void);
+
+/* limits on draining: jobs at once (0: one per CPU), the 1-minute load
+ * average and the MB of memory available (0: no limit) */
+void queue_set_limits(int max, double load, long mem_mb);
+void queue_print(void);
+
+#endif
@@ -0,0 +1,798 @@
+/* run.c
+ * jobs in cgroups of their own.  Each job the shell launches with run
+ * (or every job, if PSSH_CGROUPS is set) gets a cgroup v2 group under
+ * pssh-<pid> in the shell's own group.  Its processes are created
+ * straight in the group with clone3(CLONE_INTO_CGROUP), or else put
+ * there by fork() and a write to cgroup.procs before they exec.  All
+ * that a job ever starts, grandchildren included, is then counted in
+ * the group's cpu.stat, memory.peak and io.stat.  Memory and CPU limits
+ * go into memory.max and cpu.max.
+ *
+ * The shell only enables controllers below pssh-<pid> that its own
+ * group already offers.  Where there is no cgroup v2 to write to, or
+ * the memory controller is not among them, --mem falls back to
+ * RLIMIT_AS in each process of the job.  --cpu has no rlimit to fall
+ * back to and is dropped with a warning.
+ *
+ * The scheduling options (--cpus, --nice, --sched, --ionice) are set by
+ * each process of a job as it starts, before it execs.  renice applies
+ * them to a job that already runs: to every thread of every process
+ * in its group, or of the processes in the job table if it has none.
+ *
+ * The pipes of a pipeline are sized here too, by run --pipe-size or
+ * else $PSSH_PIPESIZE: a size, max for /proc/sys/fs/pipe-max-size or
+ * auto.  A pipeline run with auto starts at the kernel's 64K; when it
+ * ends, the context switches of its processes per second of its run
+ * tell whether its pipes were too small for the data it moved, and
+ * then the next run of the same text gets pipes four times as large.
+ * --packet (or $PSSH_PIPEPACKET) makes them O_DIRECT packet pipes.
+ **********************************************************************/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sched.h>
+#include <linux/sched.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "run.h"
+#include "vars.h"
+
+static char *container;         /* our pssh-<pid>, or NULL */
+static int container_tried;
+static pid_t container_owner;
+static int have_memory, have_cpu;
+
+#define IOPRIO_CLASS_SHIFT  13
+#define IOPRIO_WHO_PROCESS  1
+#define IOPRIO_CLASS_RT     1
+#define IOPRIO_CLASS_BE     2
+#define IOPRIO_CLASS_IDLE   3
+
+#define PIPE_DEFAULT   65536
+#define PIPE_BUSY      1000    /* context switches a second: too small */
+#define PIPE_LEARNED   64
+
+static RunOpts pending;
+static int has_pending;
+
+/* the pipes of the job being launched */
+static long long job_pipe_size;
+static int job_packet, job_pipe_auto;
+
+/* auto sizes by the hash of the job text; set in signal handlers */
+static struct {
+    unsigned long hash;
+    int size;
+} learned[PIPE_LEARNED];
+
+/* the group of the job being launched */
+static char *job_cg;
+static int job_cg_fd = -1;      /* for CLONE_INTO_CGROUP */
+static int job_cg_procs = -1;   /* its cgroup.procs, for the fork path */
+static int job_rlimit_mem;      /* --mem must be an rlimit */
+static int clone3_works = 1;
+
+
+/* writes a short string to a file of a group */
+static int cg_write(const char *dir, const char *file, const char *value)
+{
+    char path[PATH_MAX];
+    int fd, ok;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    ok = write(fd, value, strlen(value)) == (ssize_t)strlen(value);
+    close(fd);
+
+    return ok ? 0 : -1;
+}
+
+
+/* reads a small file of a group; NULL if it is not there */
+static char *cg_read(const char *dir, const char *file, char *buf, size_t size)
+{
+    char path[PATH_MAX];
+    ssize_t n;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0)
+        return NULL;
+
+    buf[n] = '\0';
+    return buf;
+}
+
+
+/* at exit: the groups of jobs still around go too, if they are empty */
+static void container_cleanup(void)
+{
+    char path[PATH_MAX];
+    struct dirent *e;
+    DIR *d;
+
+    if (!container || getpid() != container_owner)
+        return;
+
+    if ((d = opendir(container))) {
+        while ((e = readdir(d))) {
+            if (!strncmp(e->d_name, "job-", 4)) {
+                snprintf(path, sizeof(path), "%s/%s", container, e->d_name);
+                rmdir(path);
+            }
+        }
+        closedir(d);
+    }
+
+    rmdir(container);
+}
+
+
+/* finds the shell's group in the cgroup2 mount and makes pssh-<pid>
+ * below it, once; NULL if there is no cgroup v2 we may write to */
+static const char *container_get(void)
+{
+    char line[PATH_MAX + 256], mnt[PATH_MAX] = "", own[PATH_MAX] = "";
+    char path[2 * PATH_MAX + 32], buf[256], *tok, *save;
+    FILE *f;
+
+    if (container_tried)
+        return container;
+    container_tried = 1;
+
+    /* field 5 of mountinfo is the mount point; the type follows " - " */
+    f = fopen("/proc/self/mountinfo", "r");
+    while (f && fgets(line, sizeof(line), f)) {
+        char *dash = strstr(line, " - cgroup2 ");
+        if (dash && sscanf(line, "%*s %*s %*s %*s %s", mnt) == 1)
+            break;
+        mnt[0] = '\0';
+    }
+    if (f)
+        fclose(f);
+
+    f = fopen("/proc/self/cgroup", "r");
+    while (f && fgets(line, sizeof(line), f)) {
+        if (!strncmp(line, "0::", 3)) {
+            line[strcspn(line, "\n")] = '\0';
+            snprintf(own, sizeof(own), "%s", line + 3);
+            break;
+        }
+    }
+    if (f)
+        fclose(f);
+
+    if (!mnt[0] || !own[0])
+        return NULL;
+
+    snprintf(path, sizeof(path), "%s%s/pssh-%d", mnt,
+             strcmp(own, "/") ? own : "", (int)getpid());
+    if (mkdir(path, 0755) < 0 && errno != EEXIST)
+        return NULL;
+
+    container = strdup(path);
+    container_owner = getpid();
+    atexit(container_cleanup);
+
+    /* hand down what the shell's group offers */
+    if (cg_read(container, "cgroup.controllers", buf, sizeof(buf))) {
+        for (tok = strtok_r(buf, " \n", &save); tok; tok = strtok_r(NULL, " \n", &save)) {
+            char enable[32];
+
+            if (strcmp(tok, "memory") && strcmp(tok, "cpu") && strcmp(tok, "io"))
+                continue;
+
+            snprintf(enable, sizeof(enable), "+%s", tok);
+            if (cg_write(container, "cgroup.subtree_control", enable) < 0)
+                continue;
+
+            if (!strcmp(tok, "memory"))
+                have_memory = 1;
+            else if (!strcmp(tok, "cpu"))
+                have_cpu = 1;
+        }
+    }
+
+    return container;
+}
+
+
+void run_opts_init(RunOpts *R)
+{
+    memset(R, 0, sizeof(*R));
+    R->sched = -1;
+    R->ioprio = -1;
+}
+
+
+/* a size such as 4096, 512K, 100M or 2G; -1 if invalid */
+static long long size_arg(const char *s)
+{
+    char *end;
+    double n = strtod(s, &end);
+
+    if (end == s || n < 0)
+        return -1;
+
+    switch (*end) {
+    case '\0': break;
+    case 'k': case 'K': n *= 1024; break;
+    case 'm': case 'M': n *= 1024 * 1024; break;
+    case 'g': case 'G': n *= 1024 * 1024 * 1024; break;
+    default: return -1;
+    }
+
+    return *end && end[1] ? -1 : (long long)n;
+}
+
+
+/* a CPU list such as 0-3,8 into set; -1 if it is malformed or empty */
+static int parse_cpus(const char *s, cpu_set_t *set)
+{
+    long a, b;
+    char *end;
+
+    CPU_ZERO(set);
+
+    while (*s) {
+        a = b = strtol(s, &end, 10);
+        if (end == s || a < 0)
+            return -1;
+
+        if (*end == '-') {
+            s = end + 1;
+            b = strtol(s, &end, 10);
+            if (end == s || b < a)
+                return -1;
+        }
+
+        if (b >= CPU_SETSIZE)
+            return -1;
+        for (; a <= b; a++)
+            CPU_SET(a, set);
+
+        if (*end == ',')
+            end++;
+        else if (*end)
+            return -1;
+        s = end;
+    }
+
+    return CPU_COUNT(set) ? 0 : -1;
+}
+
+
+int run_parse_opt(RunOpts *R, const char *opt, const char *arg)
+{
+    static const struct { const char *name; int class; } classes[] = {
+        { "idle", IOPRIO_CLASS_IDLE },
+        { "best-effort", IOPRIO_CLASS_BE }, { "be", IOPRIO_CLASS_BE },
+        { "realtime", IOPRIO_CLASS_RT },    { "rt", IOPRIO_CLASS_RT },
+    };
+    cpu_set_t set;
+    char *end;
+    long n;
+
+    if (!strcmp(opt, "--mem"))
+        return (R->mem = size_arg(arg)) < 0 ? -1 : 0;
+
+    if (!strcmp(opt, "--cpu"))
+        return (R->cpu = atof(arg)) <= 0 ? -1 : 0;
+
+    if (!strcmp(opt, "--cpus")) {
+        if (strlen(arg) >= sizeof(R->cpus) || parse_cpus(arg, &set) < 0)
+            return -1;
+        strcpy(R->cpus, arg);
+        return 0;
+    }
+
+    if (!strcmp(opt, "--nice")) {
+        n = strtol(arg, &end, 10);
+        if (end == arg || *end || n < -20 || n > 19)
+            return -1;
+        R->nice = n;
+        R->has_nice = 1;
+        return 0;
+    }
+
+    if (!strcmp(opt, "--pipe-size")) {
+        if (!strcmp(arg, "max"))
+            R->pipe_size = PIPE_SIZE_MAX;
+        else if (!strcmp(arg, "auto"))
+            R->pipe_size = PIPE_SIZE_AUTO;
+        else if ((R->pipe_size = size_arg(arg)) <= 0 || R->pipe_size > INT_MAX)
+            return -1;
+        return 0;
+    }
+
+    if (!strcmp(opt, "--sched")) {
+        if (!strcmp(arg, "other") || !strcmp(arg, "normal"))
+            R->sched = SCHED_OTHER;
+        else if (!strcmp(arg, "batch"))
+            R->sched = SCHED_BATCH;
+        else if (!strcmp(arg, "idle"))
+            R->sched = SCHED_IDLE;
+        else
+            return -1;
+        return 0;
+    }
+
+    /* class[:level], the level 0 (highest) to 7 */
+    if (!strcmp(opt, "--ionice")) {
+        size_t len = strcspn(arg, ":");
+
+        n = 4;
+        if (arg[len]) {
+            n = strtol(arg + len + 1, &end, 10);
+            if (end == arg + len + 1 || *end || n < 0 || n > 7)
+                return -1;
+        }
+
+        for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+            if (strlen(classes[i].name) == len && !strncmp(arg, classes[i].name, len)) {
+                if (classes[i].class == IOPRIO_CLASS_IDLE)
+                    n = 0;
+                R->ioprio = classes[i].class << IOPRIO_CLASS_SHIFT | n;
+                return 0;
+            }
+        }
+        return -1;
+    }
+
+    return 1;
+}
+
+
+int run_parse_flag(RunOpts *R, const char *opt)
+{
+    if (!strcmp(opt, "--packet")) {
+        R->packet = 1;
+        return 0;
+    }
+
+    return 1;
+}
+
+
+/* the scheduling options for one thread (0: the caller) */
+static int apply_task(const RunOpts *R, pid_t tid)
+{
+    struct sched_param sp = { 0 };
+    cpu_set_t set;
+    int ret = 0;
+
+    if (R->cpus[0] && (parse_cpus(R->cpus, &set) < 0 ||
+                       sched_setaffinity(tid, sizeof(set), &set) < 0))
+        ret = -1;
+
+    if (R->sched >= 0 && sched_setscheduler(tid, R->sched, &sp) < 0)
+        ret = -1;
+
+    if (R->has_nice && setpriority(PRIO_PROCESS, tid, R->nice) < 0)
+        ret = -1;
+
+    if (R->ioprio >= 0 && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, R->ioprio) < 0)
+        ret = -1;
+
+    return ret;
+}
+
+
+int run_apply_pid(const RunOpts *R, pid_t pid)
+{
+    char path[64];
+    struct dirent *e;
+    DIR *d;
+    int ret = 0;
+
+    if (!pid)
+        return apply_task(R, 0);
+
+    /* nice, affinity and the rest are per thread */
+    snprintf(path, sizeof(path), "/proc/%d/task", (int)pid);
+    d = opendir(path);
+    if (!d)
+        return apply_task(R, pid);
+
+    while ((e = readdir(d)))
+        if (e->d_name[0] != '.' && apply_task(R, atoi(e->d_name)) < 0)
+            ret = -1;
+    closedir(d);
+
+    return ret;
+}
+
+
+int run_apply_job(const RunOpts *R, Job *job)
+{
+    char value[64], *procs = NULL, *p;
+    size_t len = 0, cap = 0;
+    ssize_t n;
+    int fd, ret = 0;
+
+    if (R->mem > 0 || R->cpu > 0) {
+        if (!job->cgroup) {
+            printf("pssh: %%%d: no cgroup to set --mem or --cpu in\n", job->job_id);
+            ret = -1;
+        } else {
+            if (R->mem > 0) {
+                snprintf(value, sizeof(value), "%lld", R->mem);
+                if (cg_write(job->cgroup, "memory.max", value) < 0)
+                    ret = -1;
+            }
+            if (R->cpu > 0) {
+                snprintf(value, sizeof(value), "%lld 100000", (long long)(R->cpu * 100000));
+                if (cg_write(job->cgroup, "cpu.max", value) < 0)
+                    ret = -1;
+            }
+        }
+    }
+
+    if (!R->cpus[0] && !R->has_nice && R->sched < 0 && R->ioprio < 0)
+        return ret;
+
+    /* the group knows every process of the job, grandchildren too */
+    if (job->cgroup) {
+        char path[PATH_MAX];
+
+        snprintf(path, sizeof(path), "%s/cgroup.procs", job->cgroup);
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        for (;;) {
+            if (cap - len < 4096)
+                procs = realloc(procs, cap += 8192);
+            n = fd < 0 ? 0 : read(fd, procs + len, cap - len - 1);
+            if (n <= 0)
+                break;
+            len += n;
+        }
+        if (fd >= 0)
+            close(fd);
+        procs[len] = '\0';
+
+        for (p = strtok(procs, "\n"); p; p = strtok(NULL, "\n"))
+            if (run_apply_pid(R, atoi(p)) < 0)
+                ret = -1;
+        free(procs);
+        return ret;
+    }
+
+    for (unsigned int i = 0; i < job->npids; i++)
+        if (job->pids[i] > 0 && run_apply_pid(R, job->pids[i]) < 0)
+            ret = -1;
+
+    return ret;
+}
+
+
+int run_next(const RunOpts *R)
+{
+    container_get();
+
+    pending = *R;
+    if (pending.cpu > 0 && !have_cpu) {
+        printf("pssh: run: --cpu needs the cgroup v2 cpu controller; not limited\n");
+        pending.cpu = 0;
+    }
+
+    has_pending = 1;
+    return 0;
+}
+
+
+void run_clear(void)
+{
+    has_pending = 0;
+}
+
+
+static int pipe_max_size(void)
+{
+    static int max;
+    char buf[32];
+    int fd;
+    ssize_t n;
+
+    if (max)
+        return max;
+
+    max = 1048576;
+    fd = open("/proc/sys/fs/pipe-max-size", O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        n = read(fd, buf, sizeof(buf) - 1);
+        if (n > 0) {
+            buf[n] = '\0';
+            max = atoi(buf) > 0 ? atoi(buf) : max;
+        }
+        close(fd);
+    }
+
+    return max;
+}
+
+
+static unsigned long text_hash(const char *s)
+{
+    unsigned long h = 5381;
+
+    while (*s)
+        h = h * 33 + (unsigned char)*s++;
+    return h;
+}
+
+
+/* what the pipes of a job with this text are to be */
+static void pipes_prepare(const char *text)
+{
+    const char *v;
+    unsigned long h;
+    RunOpts R;
+
+    run_opts_init(&R);
+    if (has_pending)
+        R = pending;
+
+    if (!R.pipe_size && (v = var_get("PSSH_PIPESIZE")) && run_parse_opt(&R, "--pipe-size", v) < 0)
+        R.pipe_size = 0;
+    if (var_get("PSSH_PIPEPACKET"))
+        R.packet = 1;
+
+    job_packet = R.packet;
+    job_pipe_auto = R.pipe_size == PIPE_SIZE_AUTO;
+    job_pipe_size = R.pipe_size;
+
+    if (R.pipe_size == PIPE_SIZE_MAX) {
+        job_pipe_size = pipe_max_size();
+    } else if (job_pipe_auto) {
+        h = text_hash(text);
+        job_pipe_size = learned[h % PIPE_LEARNED].hash == h ? learned[h % PIPE_LEARNED].size : 0;
+    }
+}
+
+
+int run_pipe(int fds[2])
+{
+    if (pipe2(fds, job_packet ? O_DIRECT : 0) < 0)
+        return -1;
+
+    /* past pipe-max-size only root may go; anyone else gets the max */
+    if (job_pipe_size > 0 && fcntl(fds[1], F_SETPIPE_SZ, (int)job_pipe_size) < 0 && errno == EPERM)
+        fcntl(fds[1], F_SETPIPE_SZ, pipe_max_size());
+
+    return 0;
+}
+
+
+void run_prepare(const char *text)
+{
+    static unsigned long seq;
+    char path[PATH_MAX], value[64];
+    const char *base;
+
+    job_rlimit_mem = 0;
+    pipes_prepare(text);
+
+    if (!has_pending && !var_get("PSSH_CGROUPS"))
+        return;
+
+    if (has_pending && pending.mem > 0 && !have_memory)
+        job_rlimit_mem = 1;
+
+    base = container_get();
+    if (!base)
+        return;
+
+    snprintf(path, sizeof(path), "%s/job-%lu", base, ++seq);
+    if (mkdir(path, 0755) < 0)
+        return;
+
+    if (has_pending && pending.mem > 0 && have_memory) {
+        snprintf(value, sizeof(value), "%lld", pending.mem);
+        if (cg_write(path, "memory.max", value) < 0)
+            job_rlimit_mem = 1;
+    }
+
+    if (has_pending && pending.cpu > 0 && have_cpu) {
+        snprintf(value, sizeof(value), "%lld 100000", (long long)(pending.cpu * 100000));
+        cg_write(path, "cpu.max", value);
+    }
+
+    job_cg = strdup(path);
+    job_cg_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    snprintf(path, sizeof(path), "%s/cgroup.procs", job_cg);
+    job_cg_procs = open(path, O_WRONLY | O_CLOEXEC);
+}
+
+
+pid_t run_fork(void)
+{
+#if defined(SYS_clone3) && defined(CLONE_INTO_CGROUP)
+    struct clone_args args;
+    pid_t pid;
+
+    if (job_cg_fd >= 0 && clone3_works) {
+        memset(&args, 0, sizeof(args));
+        args.flags = CLONE_INTO_CGROUP;
+        args.exit_signal = SIGCHLD;
+        args.cgroup = job_cg_fd;
+
+        pid = syscall(SYS_clone3, &args, sizeof(args));
+        if (pid >= 0)
+            return pid;
+
+        /* an older kernel, or a group we may not clone into */
+        clone3_works = 0;
+    }
+#endif
+
+    return fork();
+}
+
+
+void run_child(void)
+{
+    struct rlimit rl;
+
+    /* forked rather than cloned into the group: join it before exec, so
+     * that whatever the command starts is born inside it */
+    if (job_cg_procs >= 0 && !clone3_works)
+        write(job_cg_procs, "0", 1);
+
+    if (job_rlimit_mem) {
+        rl.rlim_cur = rl.rlim_max = pending.mem;
+        setrlimit(RLIMIT_AS, &rl);
+    }
+
+    if (has_pending && run_apply_pid(&pending, 0) < 0)
+        fprintf(stderr, "pssh: run: %s\n", strerror(errno));
+
+    /* a subshell of the job keeps what it starts in the job's group */
+    has_pending = 0;
+    container = NULL;
+    container_tried = 1;
+}
+
+
+void run_started(Job *job)
+{
+    job->pipe_auto = job_pipe_auto;
+    job->cgroup = job_cg;
+    job_cg = NULL;
+    has_pending = 0;
+    run_abort();
+}
+
+
+void run_abort(void)
+{
+    if (job_cg) {
+        rmdir(job_cg);
+        free(job_cg);
+        job_cg = NULL;
+    }
+    if (job_cg_fd >= 0)
+        close(job_cg_fd);
+    if (job_cg_procs >= 0)
+        close(job_cg_procs);
+    job_cg_fd = job_cg_procs = -1;
+}
+
+
+/* a job run with auto pipes is done: were they large enough? */
+static void pipes_learn(Job *job)
+{
+    struct timespec now;
+    unsigned long h = text_hash(job->name);
+    double secs;
+    int size;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    secs = (now.tv_sec - job->started.tv_sec) + (now.tv_nsec - job->started.tv_nsec) / 1e9;
+
+    size = learned[h % PIPE_LEARNED].hash == h ? learned[h % PIPE_LEARNED].size : 0;
+    if (!size)
+        size = PIPE_DEFAULT;
+
+    /* too short a run to tell */
+    if (secs < 0.1 || job->csw < PIPE_BUSY * secs)
+        return;
+
+    size = size < pipe_max_size() / 4 ? size * 4 : pipe_max_size();
+    learned[h % PIPE_LEARNED].hash = h;
+    learned[h % PIPE_LEARNED].size = size;
+}
+
+
+void run_release(Job *job)
+{
+    if (job->pipe_auto) {
+        pipes_learn(job);
+        job->pipe_auto = 0;
+    }
+
+    if (!job->cgroup)
+        return;
+
+    /* fails while something the job left behind still runs in it */
+    rmdir(job->cgroup);
+    free(job->cgroup);
+    job->cgroup = NULL;
+}
+
+
+/* a byte count as 12.3M and the like */
+static void print_bytes(const char *label, long long n)
+{
+    const char *units = "BKMGT";
+    double v = n;
+
+    while (v >= 1024 && units[1]) {
+        v /= 1024;
+        units++;
+    }
+
+    printf("  %s %.*f%c", label, *units == 'B' ? 0 : 1, v, *units);
+}
+
+
+void run_print_usage(Job *job)
+{
+    char buf[4096], *line, *p;
+    long long usage = -1, user = 0, sys = 0, rbytes = 0, wbytes = 0, n;
+    int have_io = 0;
+
+    if (!job->cgroup)
+        return;
+
+    if (cg_read(job->cgroup, "cpu.stat", buf, sizeof(buf))) {
+        for (line = strtok(buf, "\n"); line; line = strtok(NULL, "\n")) {
+            sscanf(line, "usage_usec %lld", &usage);
+            sscanf(line, "user_usec %lld", &user);
+            sscanf(line, "system_usec %lld", &sys);
+        }
+    }
+
+    printf("    cpu %.2fs (user %.2fs, sys %.2fs)",
+           usage / 1e6, user / 1e6, sys / 1e6);
+
+    if (cg_read(job->cgroup, "memory.peak", buf, sizeof(buf)))
+        print_bytes("mem peak", atoll(buf));
+    else if (cg_read(job->cgroup, "memory.current", buf, sizeof(buf)))
+        print_bytes("mem", atoll(buf));
+
+    /* one line per device: "8:0 rbytes=1 wbytes=2 ..." */
+    if (cg_read(job->cgroup, "io.stat", buf, sizeof(buf))) {
+        for (line = strtok(buf, "\n"); line; line = strtok(NULL, "\n")) {
+            if ((p = strstr(line, "rbytes=")) && sscanf(p, "rbytes=%lld", &n) == 1)
+                rbytes += n;
+            if ((p = strstr(line, "wbytes=")) && sscanf(p, "wbytes=%lld", &n) == 1)
+                wbytes += n;
+        }
+        have_io = 1;
+    }
+
+    if (have_io) {
+        print_bytes("io read", rbytes);
+        print_bytes("written", wbytes);
+    }
+
+    printf("\n");
+}
@@ -0,0 +1,61 @@
+#ifndef RUN_H
+#define RUN_H
+
+#include "job_control.h"
+
+/* how a job is run: its cgroup v2 group, limits and scheduling.  The
+ * run builtin sets them for the next job; launch_pipeline() applies
+ * them, and renice to jobs already running */
+
+typedef struct {
+    long long mem;      /* --mem: bytes, 0 for no limit */
+    double cpu;         /* --cpu: CPUs' worth of time, 0 for no limit */
+    char cpus[256];     /* --cpus: a CPU list such as 0-3,8, or "" */
+    int nice;           /* --nice: the nice value, if has_nice */
+    int has_nice;
+    int sched;          /* --sched: a SCHED_* policy, or -1 */
+    int ioprio;         /* --ionice: an I/O priority, or -1 */
+    long long pipe_size; /* --pipe-size: bytes, a PIPE_SIZE_*, 0 as is */
+    int packet;         /* --packet: pipes in O_DIRECT packet mode */
+} RunOpts;
+
+#define PIPE_SIZE_MAX   -1   /* /proc/sys/fs/pipe-max-size */
+#define PIPE_SIZE_AUTO  -2   /* learned from earlier runs of the job */
+
+void run_opts_init(RunOpts *R);
+
+/* takes the option opt, with its argument arg, into R: 0, or -1 if arg
+ * is not valid for it and 1 if opt is not an option of run */
+int run_parse_opt(RunOpts *R, const char *opt, const char *arg);
+
+/* likewise for the options without an argument: 0, or 1 if not ours */
+int run_parse_flag(RunOpts *R, const char *opt);
+
+/* applies R to a running job: the scheduling options to every thread
+ * of every process in it, limits to its group; -1 if any of it failed */
+int run_apply_job(const RunOpts *R, Job *job);
+
+/* the same for one process (0: the caller) and its threads */
+int run_apply_pid(const RunOpts *R, pid_t pid);
+
+/* the next job launched is run so; 0, or -1 if an option cannot be
+ * applied at all (it is reported) */
+int run_next(const RunOpts *R);
+void run_clear(void);
+
+/* for launch_pipeline(): before, for and after its forks.  Its pipes
+ * come from run_pipe(), sized by run --pipe-size or $PSSH_PIPESIZE */
+void run_prepare(const char *text);
+int run_pipe(int fds[2]);
+pid_t run_fork(void);
+void run_child(void);
+void run_started(Job *job);
+void run_abort(void);
+
+/* a job is leaving the table: its group goes too; signal safe */
+void run_release(Job *job);
+
+/* CPU time, memory peak and IO of the job's group, for jobs -v */
+void run_print_usage(Job *job);
+
+#endif
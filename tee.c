@@ -0,0 +1,163 @@
+/* tee.c
+ * the copying behind |>.  The helper of a tee reads one pipe and hands
+ * all of it to several fds.  tee(2) duplicates what is in that pipe
+ * into a pipe per file without consuming it, and splice(2) moves those
+ * on into the files and the original on to where the output was going,
+ * so the data never leaves the kernel's pipe pages.  Where an fd does
+ * not take splice (a terminal, a file opened for append) that part is
+ * copied through a buffer instead.
+ **********************************************************************/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "tee.h"
+
+#define TEE_BUF  65536
+
+
+/* writes all of buf; -1 on an error */
+static int write_all(int fd, const char *buf, size_t len)
+{
+    ssize_t w;
+
+    while (len > 0) {
+        w = write(fd, buf, len);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return -1;
+        buf += w;
+        len -= w;
+    }
+
+    return 0;
+}
+
+
+/* moves len bytes from the pipe in to out (-1: just drops them) */
+static int move(int in, int out, size_t len)
+{
+    char buf[TEE_BUF];
+    ssize_t n;
+
+    while (len > 0) {
+        n = out < 0 ? -1 : splice(in, NULL, out, NULL, len, SPLICE_F_MOVE);
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n < 0 && (out < 0 || errno == EINVAL)) {
+            n = read(in, buf, len < sizeof(buf) ? len : sizeof(buf));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0 || (out >= 0 && write_all(out, buf, n) < 0))
+                return -1;
+        } else if (n <= 0) {
+            return -1;
+        }
+
+        len -= n;
+    }
+
+    return 0;
+}
+
+
+/* the same job through a buffer, for when the pipes cannot be had */
+static void copy_buffered(int in, int out, int *files, int n)
+{
+    char buf[TEE_BUF];
+    ssize_t len;
+    int k;
+
+    for (;;) {
+        len = read(in, buf, sizeof(buf));
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            return;
+
+        for (k=0; k<n; k++)
+            if (files[k] >= 0 && write_all(files[k], buf, len) < 0)
+                files[k] = -1;
+
+        if (write_all(out, buf, len) < 0)
+            return;
+    }
+}
+
+
+void tee_copy(int in, int out, int *files, int n)
+{
+    int mids[n][2];
+    int size = fcntl(in, F_GETPIPE_SZ);
+    ssize_t len, t;
+    int k, made, ok = size > 0;
+
+    /* a pipe per file, as large as in, so that each tee takes all */
+    for (made=0; ok && made<n; made++) {
+        if (pipe(mids[made]) < 0) {
+            ok = 0;
+            break;
+        }
+        ok = fcntl(mids[made][1], F_SETPIPE_SZ, size) >= size;
+    }
+
+    if (!ok) {
+        for (k=0; k<made; k++) {
+            close(mids[k][0]);
+            close(mids[k][1]);
+        }
+        copy_buffered(in, out, files, n);
+        return;
+    }
+
+    for (;;) {
+        len = -1;
+
+        for (k=0; k<n; k++) {
+            if (files[k] < 0)
+                continue;
+
+            do
+                t = tee(in, mids[k][1], len < 0 ? (size_t)size : (size_t)len, 0);
+            while (t < 0 && errno == EINTR);
+
+            /* the first one waits for data and says how much there is */
+            if (len < 0) {
+                if (t <= 0)
+                    goto done;
+                len = t;
+            }
+
+            if (t != len || move(mids[k][0], files[k], len) < 0) {
+                close(mids[k][0]);
+                close(mids[k][1]);
+                files[k] = -1;
+            }
+        }
+
+        /* no file left to copy to: the rest simply flows through */
+        if (len < 0) {
+            while ((t = splice(in, NULL, out, NULL, size, SPLICE_F_MOVE)) > 0 ||
+                   (t < 0 && errno == EINTR))
+                ;
+            if (t < 0 && errno == EINVAL)
+                copy_buffered(in, out, files, 0);
+            goto done;
+        }
+
+        if (move(in, out, len) < 0)
+            out = -1;
+    }
+
+done:
+    for (k=0; k<n; k++) {
+        if (files[k] >= 0) {
+            close(mids[k][0]);
+            close(mids[k][1]);
+        }
+    }
+}
@@ -0,0 +1,8 @@
+#ifndef TEE_H
+#define TEE_H
+
+/* copies all that comes down the pipe in, until EOF, to out and to each
+ * of the n files (those it fails to write to are set to -1) */
+void tee_copy(int in, int out, int *files, int n);
+
+#endif
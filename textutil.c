@@ -0,0 +1,988 @@
+/* textutil.c
+ * builtins for the bulk text stages of pipelines: count (wc), fgrep
+ * (grep -F), head and tail.  A regular file is mapped and handed over
+ * in large windows; a pipe or terminal is read in large blocks.  Both
+ * go by whole lines, so that a line never straddles two calls.  An
+ * option they don't have is left to the program of the same name.
+ *
+ * Newlines are counted, and fixed strings found, with SSE2 or AVX2
+ * compares, picked once by what the CPU has, and with a plain loop and
+ * memmem() elsewhere.  A single byte is found with memchr(), and tail
+ * finds its start with memrchr() from the end of a file, without
+ * reading what comes before.
+ **********************************************************************/
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define TEXT_X86
+#endif
+
+#include "builtin.h"
+#include "job_control.h"
+
+#define TEXT_BLOCK   (1 << 20)   /* read from a pipe at a time */
+#define TEXT_WINDOW  (64 << 20)  /* of a mapped file per call, between ^C checks */
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ  22
+#endif
+
+
+/* ------------------------------------------------------------------ */
+/* kernels                                                             */
+
+/* the # of c in p[0..n) */
+static size_t count_scalar(const char *p, size_t n, char c)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < n; i++)
+        count += p[i] == c;
+
+    return count;
+}
+
+/* where pat (of plen >= 2) first is in p[0..n), or NULL */
+static const char *find_scalar(const char *p, size_t n, const char *pat, size_t plen)
+{
+    return memmem(p, n, pat, plen);
+}
+
+#ifdef TEXT_X86
+/* counting: each compare leaves -1 in the bytes that match; subtracting
+ * those adds up to 255 matches per byte lane, which psadbw then sums.
+ *
+ * finding: a block is only compared with pat where both pat's first
+ * byte and, plen-1 further on, its last byte line up. */
+
+__attribute__((target("sse2")))
+static size_t count_sse2(const char *p, size_t n, char c)
+{
+    const __m128i needle = _mm_set1_epi8(c), zero = _mm_setzero_si128();
+    __m128i v, acc, sum = zero;
+    size_t i = 0, count;
+    int k;
+
+    while (n - i >= 16) {
+        acc = zero;
+        for (k = 0; k < 255 && n - i >= 16; k++, i += 16) {
+            v = _mm_loadu_si128((const __m128i *)(p + i));
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, needle));
+        }
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(acc, zero));
+    }
+
+    count = (size_t)_mm_cvtsi128_si64(sum) +
+            (size_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(sum, sum));
+
+    return count + count_scalar(p + i, n - i, c);
+}
+
+__attribute__((target("sse2")))
+static const char *find_sse2(const char *p, size_t n, const char *pat, size_t plen)
+{
+    const __m128i first = _mm_set1_epi8(pat[0]), last = _mm_set1_epi8(pat[plen-1]);
+    __m128i a, b;
+    unsigned mask;
+    size_t i;
+
+    for (i = 0; n >= plen - 1 + 16 && i <= n - (plen - 1) - 16; i += 16) {
+        a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i)), first);
+        b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i + plen - 1)), last);
+        for (mask = _mm_movemask_epi8(_mm_and_si128(a, b)); mask; mask &= mask - 1)
+            if (!memcmp(p + i + __builtin_ctz(mask) + 1, pat + 1, plen - 2))
+                return p + i + __builtin_ctz(mask);
+    }
+
+    return find_scalar(p + i, n - i, pat, plen);
+}
+
+__attribute__((target("avx2")))
+static size_t count_avx2(const char *p, size_t n, char c)
+{
+    const __m256i needle = _mm256_set1_epi8(c), zero = _mm256_setzero_si256();
+    __m256i v, acc, sum = zero;
+    size_t i = 0;
+    int k;
+
+    while (n - i >= 32) {
+        acc = zero;
+        for (k = 0; k < 255 && n - i >= 32; k++, i += 32) {
+            v = _mm256_loadu_si256((const __m256i *)(p + i));
+            acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, needle));
+        }
+        sum = _mm256_add_epi64(sum, _mm256_sad_epu8(acc, zero));
+    }
+
+    return (size_t)_mm256_extract_epi64(sum, 0) + (size_t)_mm256_extract_epi64(sum, 1) +
+           (size_t)_mm256_extract_epi64(sum, 2) + (size_t)_mm256_extract_epi64(sum, 3) +
+           count_scalar(p + i, n - i, c);
+}
+
+__attribute__((target("avx2")))
+static const char *find_avx2(const char *p, size_t n, const char *pat, size_t plen)
+{
+    const __m256i first = _mm256_set1_epi8(pat[0]), last = _mm256_set1_epi8(pat[plen-1]);
+    __m256i a, b;
+    unsigned mask;
+    size_t i;
+
+    for (i = 0; n >= plen - 1 + 32 && i <= n - (plen - 1) - 32; i += 32) {
+        a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + i)), first);
+        b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + i + plen - 1)),
+                              last);
+        for (mask = _mm256_movemask_epi8(_mm256_and_si256(a, b)); mask; mask &= mask - 1)
+            if (!memcmp(p + i + __builtin_ctz(mask) + 1, pat + 1, plen - 2))
+                return p + i + __builtin_ctz(mask);
+    }
+
+    return find_scalar(p + i, n - i, pat, plen);
+}
+#endif
+
+typedef struct {
+    const char *name;
+    size_t (*count)(const char *p, size_t n, char c);
+    const char *(*find)(const char *p, size_t n, const char *pat, size_t plen);
+} Kernels;
+
+static const Kernels kernels[] = {
+#ifdef TEXT_X86
+    { "avx2",   count_avx2,   find_avx2 },
+    { "sse2",   count_sse2,   find_sse2 },
+#endif
+    { "scalar", count_scalar, find_scalar },
+};
+
+static const Kernels *kernel;
+
+/* the best kernels the CPU can run, picked the first time; a name in
+ * PSSH_TEXT_KERNEL holds them back to one further down, to compare */
+static const Kernels *text_kernels(void)
+{
+    const char *want = getenv("PSSH_TEXT_KERNEL");
+    size_t i = 0, nkernels = sizeof(kernels) / sizeof(kernels[0]);
+
+    if (kernel)
+        return kernel;
+
+#ifdef TEXT_X86
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("avx2"))
+        i++;
+    if (!__builtin_cpu_supports("sse2"))
+        i++;
+#endif
+
+    kernel = &kernels[i];
+    for (; want && i < nkernels; i++)
+        if (!strcmp(want, kernels[i].name))
+            kernel = &kernels[i];
+
+    return kernel;
+}
+
+static size_t count_byte(const char *p, size_t n, char c)
+{
+    return text_kernels()->count(p, n, c);
+}
+
+
+/* ------------------------------------------------------------------ */
+/* input                                                               */
+
+/* takes a piece of input; returns -1 to go on, or how much of the piece
+ * it used before it had all it wanted */
+typedef ssize_t (*TextFn)(const char *buf, size_t len, void *arg);
+
+/* the pieces of a mapped file, each ending at a newline but the last;
+ * -1 if it could not be mapped */
+static int text_mapped(int fd, struct stat *st, TextFn fn, void *arg)
+{
+    off_t start = lseek(fd, 0, SEEK_CUR);
+    const char *map, *p, *end, *nl;
+    const char *page;
+    ssize_t used = -1;
+    size_t len, win;
+
+    if (start < 0 || start >= st->st_size)
+        return start < 0 ? -1 : 0;
+
+    map = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        return -1;
+    madvise((void *)map, st->st_size, MADV_SEQUENTIAL);
+
+    /* windows from a block up, so that head does not fault in much more
+     * than it reads; each is faulted in at once, which costs far less
+     * than a fault per page as it is read */
+    end = map + st->st_size;
+    for (p = map + start, win = TEXT_BLOCK;
+         p < end && used < 0 && !job_interrupted; p += len) {
+        len = (size_t)(end - p) < win ? (size_t)(end - p) : win;
+        if (win < TEXT_WINDOW)
+            win *= 2;
+        page = (const char *)((uintptr_t)p & ~(uintptr_t)(sysconf(_SC_PAGESIZE) - 1));
+        madvise((void *)page, p + len - page, MADV_POPULATE_READ);
+
+        if (p + len < end) {
+            nl = memrchr(p, '\n', len);
+            if (!nl)
+                nl = memchr(p + len, '\n', end - p - len);
+            len = nl ? (size_t)(nl + 1 - p) : (size_t)(end - p);
+        }
+        used = fn(p, len, arg);
+    }
+
+    /* as a file would be left by reading just that much */
+    lseek(fd, used < 0 ? (off_t)(p - map) : (off_t)(p - len - map) + used, SEEK_SET);
+
+    munmap((void *)map, st->st_size);
+    return 0;
+}
+
+/* hands all of fd to fn in pieces, each ending at a newline but the last
+ * (unless lines is 0), until fn has all it wants; -1 on a read error */
+static int text_each(int fd, int lines, TextFn fn, void *arg)
+{
+    struct stat st;
+    size_t cap = TEXT_BLOCK, len = 0, keep;
+    const char *nl;
+    char *buf;
+    ssize_t n;
+    int ret = 0;
+
+    if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        text_mapped(fd, &st, fn, arg) >= 0)
+        return 0;
+
+    buf = malloc(cap);
+
+    for (;;) {
+        if (job_interrupted) {
+            ret = 0;
+            break;
+        }
+
+        n = read(fd, buf + len, cap - len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            ret = -1;
+            break;
+        }
+
+        if (n == 0) {
+            if (len)
+                fn(buf, len, arg);
+            break;
+        }
+        len += n;
+
+        keep = 0;
+        if (lines) {
+            nl = memrchr(buf + len - n, '\n', n);
+            if (!nl) {
+                /* a line longer than the buffer: make room for it */
+                if (len == cap)
+                    buf = realloc(buf, cap *= 2);
+                continue;
+            }
+            keep = buf + len - (nl + 1);
+        }
+
+        if (fn(buf, len - keep, arg) >= 0)
+            break;
+
+        memmove(buf, buf + len - keep, keep);
+        len = keep;
+    }
+
+    free(buf);
+    return ret;
+}
+
+
+/* the files of a text builtin, or stdin; fn is run for each with the
+ * name of the file and its fd; returns 1 if any could not be opened */
+typedef void (*FileFn)(const char *name, int fd, void *arg);
+
+static int text_files(const char *cmd, char **files, FileFn fn, void *arg)
+{
+    int i, fd, status = 0;
+
+    if (!files[0]) {
+        fn("-", STDIN_FILENO, arg);
+        return 0;
+    }
+
+    for (i=0; files[i] && !job_interrupted; i++) {
+        if (!strcmp(files[i], "-")) {
+            fn(files[i], STDIN_FILENO, arg);
+            continue;
+        }
+
+        fd = open(files[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            fflush(stdout);
+            fprintf(stderr, "pssh: %s: %s: %s\n", cmd, files[i], strerror(errno));
+            status = 1;
+            continue;
+        }
+        fn(files[i], fd, arg);
+        close(fd);
+    }
+
+    return status;
+}
+
+static void read_error(const char *cmd, const char *name)
+{
+    fflush(stdout);
+    fprintf(stderr, "pssh: %s: %s: %s\n", cmd, strcmp(name, "-") ? name : "standard input",
+            strerror(errno));
+}
+
+
+/* N, NK, NM or NG (powers of 1024), for -n and -c; -1 if it is not */
+static long long count_arg(const char *s)
+{
+    char *end;
+    long long n;
+
+    errno = 0;
+    n = strtoll(s, &end, 10);
+    if (end == s || n < 0 || errno)
+        return -1;
+
+    switch (*end) {
+    case 'G': n <<= 10;  /* fall through */
+    case 'M': n <<= 10;  /* fall through */
+    case 'K': n <<= 10; end++;
+    }
+
+    return *end ? -1 : n;
+}
+
+
+/* ------------------------------------------------------------------ */
+/* count                                                               */
+
+typedef struct {
+    int lines, words, bytes;     /* what to count */
+    unsigned long long nl, nw, nc;
+    int in_word;
+    unsigned long long total[3];
+    int status;
+} Count;
+
+static ssize_t count_piece(const char *buf, size_t len, void *arg)
+{
+    Count *C = arg;
+
+    C->nc += len;
+    if (C->lines)
+        C->nl += count_byte(buf, len, '\n');
+
+    if (C->words) {
+        for (size_t i = 0; i < len; i++) {
+            int space = isspace((unsigned char)buf[i]);
+            C->nw += !space && !C->in_word;
+            C->in_word = !space;
+        }
+    }
+
+    return -1;
+}
+
+static void count_print(Count *C, unsigned long long nl, unsigned long long nw,
+                        unsigned long long nc, const char *name)
+{
+    const char *sep = "";
+
+    if (C->lines) {
+        printf("%llu", nl);
+        sep = " ";
+    }
+    if (C->words) {
+        printf("%s%llu", sep, nw);
+        sep = " ";
+    }
+    if (C->bytes)
+        printf("%s%llu", sep, nc);
+
+    if (name)
+        printf(" %s", name);
+    putchar('\n');
+}
+
+static void count_file(const char *name, int fd, void *arg)
+{
+    Count *C = arg;
+    struct stat st;
+
+    C->nl = C->nw = C->nc = 0;
+    C->in_word = 0;
+
+    /* a byte count alone is the size of a regular file */
+    if (!C->lines && !C->words &&
+        !fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+        off_t at = lseek(fd, 0, SEEK_CUR);
+        C->nc = at >= 0 && at < st.st_size ? st.st_size - at : 0;
+        lseek(fd, 0, SEEK_END);
+    } else if (text_each(fd, 0, count_piece, C) < 0) {
+        read_error("count", name);
+        C->status = 1;
+    }
+
+    count_print(C, C->nl, C->nw, C->nc, strcmp(name, "-") ? name : NULL);
+    C->total[0] += C->nl;
+    C->total[1] += C->nw;
+    C->total[2] += C->nc;
+}
+
+
+/*
+ * builtin_count - implements count [-lwc] [file ...]
+ *
+ * Counts lines (the default), words and bytes as wc does, each figure
+ * followed by the file's name, and a total for more than one file.
+ * With -v it says which kernels count and search.
+ */
+int builtin_count(Task T)
+{
+    Count C = { 0 };
+    const char *o;
+    int i, nfiles;
+
+    if ((i = builtin_job(T)) >= 0)
+        return i;
+
+    for (i=1; T.argv[i] && T.argv[i][0] == '-' && T.argv[i][1]; i++) {
+        if (!strcmp(T.argv[i], "--")) {
+            i++;
+            break;
+        }
+        for (o = T.argv[i] + 1; *o; o++) {
+            if (*o == 'l')
+                C.lines = 1;
+            else if (*o == 'w')
+                C.words = 1;
+            else if (*o == 'c')
+                C.bytes = 1;
+            else if (*o == 'v') {
+                printf("count: %s\n", text_kernels()->name);
+                return 0;
+            } else {
+                fprintf(stderr, "Usage: count [-lwc] [file ...]\n");
+                return 1;
+            }
+        }
+    }
+
+    if (!C.lines && !C.words && !C.bytes)
+        C.lines = 1;
+
+    C.status = text_files("count", T.argv + i, count_file, &C);
+
+    for (nfiles=0; T.argv[i+nfiles]; nfiles++)
+        ;
+    if (nfiles > 1)
+        count_print(&C, C.total[0], C.total[1], C.total[2], "total");
+
+    fflush(stdout);
+    return C.status;
+}
+
+
+/* ------------------------------------------------------------------ */
+/* fgrep                                                               */
+
+typedef struct {
+    const char *pat;
+    size_t plen;
+    int count, invert, quiet, number, names;
+    const char *name;
+    unsigned long long line;     /* the # of the line buf starts at */
+    unsigned long long matches;
+    int found;
+} Fgrep;
+
+/* a line of output, with the file's name and the line's # as asked */
+static void fgrep_line(Fgrep *G, unsigned long long line, const char *p, const char *end)
+{
+    if (G->names)
+        printf("%s:", G->name);
+    if (G->number)
+        printf("%llu:", line);
+    fwrite(p, 1, end - p, stdout);
+    if (end[-1] != '\n')
+        putchar('\n');
+}
+
+/* the lines p[0..len), the first of them line G->line, for -v */
+static void fgrep_lines(Fgrep *G, const char *p, size_t len)
+{
+    const char *end = p + len, *nl;
+    unsigned long long line = G->line;
+
+    if (!G->number && !G->names) {
+        fwrite(p, 1, len, stdout);
+        if (len && end[-1] != '\n')
+            putchar('\n');
+        return;
+    }
+
+    for (; p < end; p = nl, line++) {
+        nl = memchr(p, '\n', end - p);
+        nl = nl ? nl + 1 : end;
+        fgrep_line(G, line, p, nl);
+    }
+}
+
+/* where the next match of the pattern in p[0..len) is, or NULL */
+static const char *fgrep_find(Fgrep *G, const char *p, size_t len)
+{
+    if (G->plen == 1)
+        return memchr(p, *G->pat, len);
+    return text_kernels()->find(p, len, G->pat, G->plen);
+}
+
+static ssize_t fgrep_piece(const char *buf, size_t len, void *arg)
+{
+    Fgrep *G = arg;
+    const char *p = buf, *end = buf + len, *m, *start, *nl;
+
+    while (p < end) {
+        /* the empty pattern is in every line */
+        m = G->plen ? fgrep_find(G, p, end - p) : p;
+
+        if (!m) {
+            if (G->invert) {
+                G->matches += count_byte(p, end - p, '\n') + (end[-1] != '\n');
+                if (!G->count && !G->quiet)
+                    fgrep_lines(G, p, end - p);
+            }
+            G->line += count_byte(p, end - p, '\n');
+            break;
+        }
+
+        /* the line the match is in, and the lines before it that have none */
+        start = memrchr(p, '\n', m - p);
+        start = start ? start + 1 : p;
+        nl = memchr(m, '\n', end - m);
+        nl = nl ? nl + 1 : end;
+
+        if (G->invert) {
+            if (start > p) {
+                G->matches += count_byte(p, start - p, '\n');
+                if (!G->count && !G->quiet)
+                    fgrep_lines(G, p, start - p);
+            }
+        } else {
+            G->matches++;
+        }
+
+        if (G->number || G->invert)
+            G->line += count_byte(p, start - p, '\n');
+
+        if (G->quiet && G->matches)
+            return 0;
+
+        if (!G->invert && !G->count)
+            fgrep_line(G, G->line, start, nl);
+
+        G->line++;
+        p = nl;
+    }
+
+    if (G->quiet && G->matches)
+        return 0;
+
+    return -1;
+}
+
+static void fgrep_file(const char *name, int fd, void *arg)
+{
+    Fgrep *G = arg;
+
+    G->name = strcmp(name, "-") ? name : "(standard input)";
+    G->line = 1;
+    G->matches = 0;
+
+    if (text_each(fd, 1, fgrep_piece, G) < 0) {
+        read_error("fgrep", name);
+        return;
+    }
+
+    if (G->count && !G->quiet) {
+        if (G->names)
+            printf("%s:", G->name);
+        printf("%llu\n", G->matches);
+    }
+
+    G->found |= G->matches > 0;
+}
+
+
+/*
+ * builtin_fgrep - implements fgrep [-cnqvhH] [-e] pattern [file ...]
+ *
+ * Prints the lines that have the fixed string pattern in them, as
+ * grep -F does; exits with 0 if any line was found, 1 if none and 2 if
+ * a file could not be read.  Any other option is left to the fgrep
+ * program.
+ */
+int builtin_fgrep(Task T)
+{
+    Fgrep G = { 0 };
+    const char *o;
+    int i, status, names = -1;
+
+    if ((status = builtin_job(T)) >= 0)
+        return status;
+
+    for (i=1; T.argv[i] && T.argv[i][0] == '-' && T.argv[i][1]; i++) {
+        if (!strcmp(T.argv[i], "--")) {
+            i++;
+            break;
+        }
+        if (!strcmp(T.argv[i], "-e") && T.argv[i+1]) {
+            i++;
+            break;
+        }
+        for (o = T.argv[i] + 1; *o; o++) {
+            switch (*o) {
+            case 'c': G.count = 1; break;
+            case 'n': G.number = 1; break;
+            case 'q': G.quiet = 1; break;
+            case 'v': G.invert = 1; break;
+            case 'h': names = 0; break;
+            case 'H': names = 1; break;
+            case 'F': break;
+            default:
+                if ((status = builtin_program(T)) >= 0)
+                    return status;
+                fprintf(stderr, "Usage: fgrep [-cnqvhH] [-e] pattern [file ...]\n");
+                return 2;
+            }
+        }
+    }
+
+    if (!T.argv[i]) {
+        fprintf(stderr, "Usage: fgrep [-cnqvhH] [-e] pattern [file ...]\n");
+        return 2;
+    }
+
+    G.pat = T.argv[i++];
+    G.plen = strlen(G.pat);
+    G.names = names >= 0 ? names : T.argv[i] && T.argv[i+1];
+
+    status = text_files("fgrep", T.argv + i, fgrep_file, &G);
+
+    fflush(stdout);
+    if (job_interrupted)
+        return 130;
+    return status ? 2 : !G.found;
+}
+
+
+/* ------------------------------------------------------------------ */
+/* head and tail                                                       */
+
+typedef struct {
+    long long n;
+    int bytes;          /* -c: n is bytes, else lines */
+    int from;           /* tail -n +N: from the Nth on */
+    int headers;        /* ==> name <== before each file */
+    int nfile;
+} Ends;
+
+static ssize_t head_piece(const char *buf, size_t len, void *arg)
+{
+    Ends *E = arg;
+    const char *p = buf, *end = buf + len, *nl;
+
+    if (E->bytes) {
+        if ((long long)len > E->n)
+            len = E->n;
+    } else {
+        while (E->n > 0 && (nl = memchr(p, '\n', end - p))) {
+            p = nl + 1;
+            E->n--;
+        }
+        if (E->n > 0)
+            p = end;
+        len = p - buf;
+    }
+
+    fwrite(buf, 1, len, stdout);
+    if (E->bytes)
+        E->n -= len;
+
+    return E->n > 0 ? -1 : (ssize_t)len;
+}
+
+static void ends_header(Ends *E, const char *name)
+{
+    if (E->headers)
+        printf("%s==> %s <==\n", E->nfile++ ? "\n" : "",
+               strcmp(name, "-") ? name : "standard input");
+}
+
+static void head_file(const char *name, int fd, void *arg)
+{
+    Ends E = *(Ends *)arg;
+
+    ends_header(arg, name);
+    if (E.n > 0 && text_each(fd, !E.bytes, head_piece, &E) < 0)
+        read_error("head", name);
+}
+
+
+/* tail -n +N / -c +N: everything but the first N-1 */
+static ssize_t tail_from_piece(const char *buf, size_t len, void *arg)
+{
+    Ends *E = arg;
+    const char *p = buf, *end = buf + len, *nl;
+
+    if (E->bytes) {
+        if (E->n > (long long)len) {
+            E->n -= len;
+            return -1;
+        }
+        p += E->n;
+        E->n = 0;
+    } else {
+        while (E->n > 0 && p < end && (nl = memchr(p, '\n', end - p))) {
+            p = nl + 1;
+            E->n--;
+        }
+        if (E->n > 0)
+            return -1;
+    }
+
+    fwrite(p, 1, end - p, stdout);
+    return -1;
+}
+
+/* where the last n lines of p[0..len) start (all of it if fewer) */
+static const char *tail_start(const char *p, size_t len, long long n)
+{
+    const char *end = p + len, *nl;
+
+    if (n == 0)
+        return end;
+
+    /* a final newline ends the last line; it does not start another */
+    if (len && end[-1] == '\n')
+        end--;
+
+    for (; n > 0; n--) {
+        nl = memrchr(p, '\n', end - p);
+        if (!nl)
+            return p;
+        end = nl;
+    }
+
+    return end + 1;
+}
+
+/* the last n lines or bytes of something that cannot be mapped: what is
+ * read is kept until more than twice as much as is needed has come, and
+ * then cut to what is needed */
+static int tail_stream(int fd, Ends *E)
+{
+    size_t cap = 2 * TEXT_BLOCK, len = 0, trim_at = 2 * TEXT_BLOCK;
+    const char *start;
+    char *buf = malloc(cap);
+    ssize_t n;
+
+    for (;;) {
+        if (job_interrupted) {
+            free(buf);
+            return 0;
+        }
+
+        if (len == cap)
+            buf = realloc(buf, cap *= 2);
+
+        n = read(fd, buf + len, cap - len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            free(buf);
+            return -1;
+        }
+        len += n;
+
+        if (n == 0 || len >= trim_at) {
+            if (E->bytes)
+                start = buf + len - ((long long)len < E->n ? (long long)len : E->n);
+            else
+                start = tail_start(buf, len, E->n);
+
+            memmove(buf, start, buf + len - start);
+            len = buf + len - start;
+            trim_at = len * 2 > 2 * TEXT_BLOCK ? len * 2 : 2 * TEXT_BLOCK;
+        }
+
+        if (n == 0)
+            break;
+    }
+
+    fwrite(buf, 1, len, stdout);
+    free(buf);
+    return 0;
+}
+
+static void tail_file(const char *name, int fd, void *arg)
+{
+    Ends E = *(Ends *)arg;
+    struct stat st;
+    const char *map, *start;
+    off_t at;
+    int ret = 0;
+
+    ends_header(arg, name);
+
+    if (E.from) {
+        ret = text_each(fd, !E.bytes, tail_from_piece, &E);
+    } else if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0 &&
+               (at = lseek(fd, 0, SEEK_CUR)) >= 0 && at < st.st_size &&
+               (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED) {
+        /* from the end back: only the pages of the tail are read */
+        if (E.bytes)
+            start = map + (st.st_size - at > E.n ? st.st_size - E.n : at);
+        else
+            start = tail_start(map + at, st.st_size - at, E.n);
+        fwrite(start, 1, map + st.st_size - start, stdout);
+        munmap((void *)map, st.st_size);
+        lseek(fd, 0, SEEK_END);
+    } else if (E.n > 0) {
+        ret = tail_stream(fd, &E);
+    }
+
+    if (ret < 0)
+        read_error("tail", name);
+}
+
+
+/* the options of head and tail: [-n N] [-c N] [-N] [-q|-v] */
+static int ends_opts(Task T, Ends *E, int *argi)
+{
+    const char *arg;
+    int i, headers = -1;
+
+    E->n = 10;
+
+    for (i=1; T.argv[i] && T.argv[i][0] == '-' && T.argv[i][1]; i++) {
+        if (!strcmp(T.argv[i], "--")) {
+            i++;
+            break;
+        }
+
+        if (!strcmp(T.argv[i], "-q")) {
+            headers = 0;
+            continue;
+        }
+        if (!strcmp(T.argv[i], "-v")) {
+            headers = 1;
+            continue;
+        }
+
+        /* -n N, -nN, -c N, -cN, or -N for -n N */
+        if (isdigit((unsigned char)T.argv[i][1])) {
+            arg = T.argv[i] + 1;
+            E->bytes = 0;
+        } else if (T.argv[i][1] == 'n' || T.argv[i][1] == 'c') {
+            E->bytes = T.argv[i][1] == 'c';
+            arg = T.argv[i][2] ? T.argv[i] + 2 : T.argv[++i];
+        } else {
+            return -1;
+        }
+
+        if (!arg)
+            return -1;
+
+        E->from = *arg == '+';
+        if (E->from)
+            arg++;
+        if ((E->n = count_arg(arg)) < 0)
+            return -1;
+    }
+
+    *argi = i;
+    E->headers = headers >= 0 ? headers : T.argv[i] && T.argv[i+1];
+    return 0;
+}
+
+
+/*
+ * builtin_head - implements head [-n N | -c N | -N] [-qv] [file ...]
+ *
+ * Other options, and -n -N, are left to the head program.
+ */
+int builtin_head(Task T)
+{
+    Ends E = { 0 };
+    int i, status;
+
+    if ((status = builtin_job(T)) >= 0)
+        return status;
+
+    if (ends_opts(T, &E, &i) < 0 || E.from) {
+        if ((status = builtin_program(T)) >= 0)
+            return status;
+        fprintf(stderr, "Usage: head [-n N | -c N | -N] [-qv] [file ...]\n");
+        return 1;
+    }
+
+    status = text_files("head", T.argv + i, head_file, &E);
+
+    fflush(stdout);
+    return job_interrupted ? 130 : status;
+}
+
+
+/*
+ * builtin_tail - implements tail [-n [+]N | -c [+]N | -N] [-qv] [file ...]
+ *
+ * Other options, -f and -F among them, are left to the tail program.
+ */
+int builtin_tail(Task T)
+{
+    Ends E = { 0 };
+    int i, status;
+
+    if ((status = builtin_job(T)) >= 0)
+        return status;
+
+    if (ends_opts(T, &E, &i) < 0) {
+        if ((status = builtin_program(T)) >= 0)
+            return status;
+        fprintf(stderr, "Usage: tail [-n [+]N | -c [+]N | -N] [-qv] [file ...]\n");
+        return 1;
+    }
+
+    /* +0 is the same as +1 */
+    if (E.from && E.n > 0)
+        E.n--;
+
+    status = text_files("tail", T.argv + i, tail_file, &E);
+
+    fflush(stdout);
+    return job_interrupted ? 130 : status;
+}
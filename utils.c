@@ -0,0 +1,888 @@
+/* utils.c
+ * the small utilities scripts run most, as builtins: echo, printf,
+ * true, false, test and [, pwd, basename, dirname and sleep.  Each
+ * takes the arguments of its coreutils namesake and behaves the same,
+ * without a fork and exec per call.  Output goes through stdout, so
+ * that they can also produce a $( ) without a fork; errors go to
+ * stderr and leave what was being printed alone.
+ **********************************************************************/
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "builtin.h"
+#include "job_control.h"
+
+
+/* one backslash escape of echo -e, printf or %b at s (just past the
+ * backslash); the character is put in *c, and the # of characters used
+ * returned.  *c is -1 for \c (no more output).  octal0 is for echo and
+ * %b, whose octal escapes are \0NNN */
+static int escape(const char *s, int octal0, int *c)
+{
+    int n = 0, max = 3, v = 0;
+
+    switch (*s) {
+    case 'a': *c = '\a'; return 1;
+    case 'b': *c = '\b'; return 1;
+    case 'c': *c = -1;   return 1;
+    case 'e': *c = 033;  return 1;
+    case 'f': *c = '\f'; return 1;
+    case 'n': *c = '\n'; return 1;
+    case 'r': *c = '\r'; return 1;
+    case 't': *c = '\t'; return 1;
+    case 'v': *c = '\v'; return 1;
+    case '\\': *c = '\\'; return 1;
+
+    case 'x':
+        while (n < 2 && isxdigit((unsigned char)s[1+n])) {
+            v = v * 16 + (isdigit((unsigned char)s[1+n]) ? s[1+n] - '0' :
+                          tolower((unsigned char)s[1+n]) - 'a' + 10);
+            n++;
+        }
+        if (!n)
+            break;
+        *c = v;
+        return n + 1;
+
+    case '0': case '1': case '2': case '3':
+    case '4': case '5': case '6': case '7':
+        if (octal0 && *s != '0')
+            break;
+        if (octal0)
+            s++;
+        while (n < max && s[n] >= '0' && s[n] <= '7')
+            v = v * 8 + s[n++] - '0';
+        *c = v & 0xff;
+        return n + !!octal0;
+    }
+
+    /* not an escape: the backslash stands for itself */
+    *c = '\\';
+    return 0;
+}
+
+
+/* s with its escapes done onto stdout; 0 if a \c stopped it */
+static int put_escaped(const char *s, int octal0)
+{
+    int c;
+
+    for (; *s; s++) {
+        if (*s != '\\' || !s[1]) {
+            putchar(*s);
+            continue;
+        }
+
+        s += escape(s + 1, octal0, &c);
+        if (c < 0)
+            return 0;
+        putchar(c);
+    }
+
+    return 1;
+}
+
+
+/*
+ * builtin_echo - implements echo [-neE] [arg ...]
+ */
+int builtin_echo(Task T)
+{
+    int i, newline = 1, escapes = 0;
+    const char *o;
+
+    /* options only if every letter is one of them, as with coreutils */
+    for (i=1; T.argv[i] && T.argv[i][0] == '-' && T.argv[i][1]; i++) {
+        if (strspn(T.argv[i] + 1, "neE") != strlen(T.argv[i] + 1))
+            break;
+        for (o = T.argv[i] + 1; *o; o++) {
+            if (*o == 'n')
+                newline = 0;
+            else
+                escapes = *o == 'e';
+        }
+    }
+
+    for (; T.argv[i]; i++) {
+        if (escapes) {
+            if (!put_escaped(T.argv[i], 1))
+                return 0;
+        } else {
+            fputs(T.argv[i], stdout);
+        }
+        if (T.argv[i+1])
+            putchar(' ');
+    }
+
+    if (newline)
+        putchar('\n');
+
+    return 0;
+}
+
+
+int builtin_true(Task T)
+{
+    (void)T;
+    return 0;
+}
+
+
+int builtin_false(Task T)
+{
+    (void)T;
+    return 1;
+}
+
+
+/* printf: a numeric argument, with 'c standing for the code of c; a
+ * bad one is reported and counts as 0 (or as much as was a number) */
+static int printf_status;
+
+static void num_check(const char *arg, const char *end)
+{
+    if (errno == ERANGE) {
+        fprintf(stderr, "pssh: printf: %s: %s\n", arg, strerror(ERANGE));
+        printf_status = 1;
+    } else if (end == arg || *end) {
+        fprintf(stderr, "pssh: printf: %s: %s\n", arg,
+                end == arg ? "expected a numeric value" : "value not completely converted");
+        printf_status = 1;
+    }
+}
+
+static intmax_t arg_int(const char *arg)
+{
+    char *end;
+    intmax_t v;
+
+    if (!arg)
+        return 0;
+    if (*arg == '\'' || *arg == '"')
+        return (unsigned char)arg[1];
+
+    errno = 0;
+    v = strtoimax(arg, &end, 0);
+    num_check(arg, end);
+    return v;
+}
+
+static uintmax_t arg_uint(const char *arg)
+{
+    char *end;
+    uintmax_t v;
+
+    if (!arg)
+        return 0;
+    if (*arg == '\'' || *arg == '"')
+        return (unsigned char)arg[1];
+
+    errno = 0;
+    v = strchr(arg, '-') ? (uintmax_t)strtoimax(arg, &end, 0) : strtoumax(arg, &end, 0);
+    num_check(arg, end);
+    return v;
+}
+
+static long double arg_float(const char *arg)
+{
+    char *end;
+    long double v;
+
+    if (!arg)
+        return 0;
+    if (*arg == '\'' || *arg == '"')
+        return (unsigned char)arg[1];
+
+    errno = 0;
+    v = strtold(arg, &end);
+    num_check(arg, end);
+    return v;
+}
+
+
+/* one pass over the format, taking args from *ap; returns 0 if a \c
+ * ended all output */
+static int printf_pass(const char *fmt, char ***ap)
+{
+    char spec[64], *p;
+    const char *f, *arg;
+    int c, n, star[2], nstar;
+
+    for (f = fmt; *f; f++) {
+        if (*f == '\\' && f[1]) {
+            f += escape(f + 1, 0, &c);
+            if (c < 0)
+                return 0;
+            putchar(c);
+            continue;
+        }
+
+        if (*f != '%') {
+            putchar(*f);
+            continue;
+        }
+
+        if (f[1] == '%') {
+            putchar('%');
+            f++;
+            continue;
+        }
+
+        /* %[flags][width][.precision]conversion, * taking an arg */
+        p = spec;
+        *p++ = *f++;
+        nstar = 0;
+        while (*f && strchr("-+ #0'", *f) && p - spec < 20)
+            *p++ = *f++;
+        for (n = 0; n < 2; n++) {
+            if (n && *f == '.')
+                *p++ = *f++;
+            else if (n)
+                break;
+            if (*f == '*') {
+                star[nstar++] = (int)arg_int(**ap ? *(*ap)++ : NULL);
+                *p++ = *f++;
+            } else {
+                while (isdigit((unsigned char)*f) && p - spec < 40)
+                    *p++ = *f++;
+            }
+        }
+
+        /* length modifiers mean nothing here */
+        while (*f && strchr("hlLqjzt", *f))
+            f++;
+
+        if (!*f) {
+            fprintf(stderr, "pssh: printf: %s: missing conversion\n", fmt);
+            printf_status = 1;
+            return 1;
+        }
+
+        arg = **ap ? *(*ap)++ : NULL;
+
+        switch (*f) {
+        case 'd': case 'i':
+            strcpy(p, "jd");
+            p[1] = *f;
+            if (nstar == 2)
+                printf(spec, star[0], star[1], arg_int(arg));
+            else if (nstar == 1)
+                printf(spec, star[0], arg_int(arg));
+            else
+                printf(spec, arg_int(arg));
+            break;
+
+        case 'o': case 'u': case 'x': case 'X':
+            p[0] = 'j';
+            p[1] = *f;
+            p[2] = '\0';
+            if (nstar == 2)
+                printf(spec, star[0], star[1], arg_uint(arg));
+            else if (nstar == 1)
+                printf(spec, star[0], arg_uint(arg));
+            else
+                printf(spec, arg_uint(arg));
+            break;
+
+        case 'e': case 'E': case 'f': case 'F':
+        case 'g': case 'G': case 'a': case 'A':
+            p[0] = 'L';
+            p[1] = *f;
+            p[2] = '\0';
+            if (nstar == 2)
+                printf(spec, star[0], star[1], arg_float(arg));
+            else if (nstar == 1)
+                printf(spec, star[0], arg_float(arg));
+            else
+                printf(spec, arg_float(arg));
+            break;
+
+        case 'c':
+        case 's':
+        case 'b':
+            /* %b: the argument's escapes are done, as with echo -e */
+            if (*f == 'b') {
+                if (arg && !put_escaped(arg, 1))
+                    return 0;
+                break;
+            }
+            p[0] = *f;
+            p[1] = '\0';
+            if (*f == 'c') {
+                c = arg ? (unsigned char)*arg : 0;
+                if (nstar == 1)
+                    printf(spec, star[0], c);
+                else if (nstar == 2)
+                    printf(spec, star[0], star[1], c);
+                else
+                    printf(spec, c);
+                break;
+            }
+            if (nstar == 2)
+                printf(spec, star[0], star[1], arg ? arg : "");
+            else if (nstar == 1)
+                printf(spec, star[0], arg ? arg : "");
+            else
+                printf(spec, arg ? arg : "");
+            break;
+
+        default:
+            fprintf(stderr, "pssh: printf: %%%c: invalid conversion\n", *f);
+            printf_status = 1;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+/*
+ * builtin_printf - implements printf format [arg ...]
+ *
+ * The format is used again for as long as args are left.
+ */
+int builtin_printf(Task T)
+{
+    char **ap, **before;
+
+    /* as with coreutils, -- before the format is skipped */
+    if (T.argv[1] && !strcmp(T.argv[1], "--"))
+        T.argv++;
+
+    if (!T.argv[1]) {
+        fprintf(stderr, "Usage: printf format [arg ...]\n");
+        return 1;
+    }
+
+    printf_status = 0;
+    ap = T.argv + 2;
+
+    do {
+        before = ap;
+        if (!printf_pass(T.argv[1], &ap))
+            break;
+    } while (*ap && ap != before);
+
+    return printf_status;
+}
+
+
+/* test: 0 true, 1 false, 2 an error (reported) */
+#define TEST_ERROR  2
+
+static char **targ;        /* the words left to parse */
+static int tnargs;
+static int terror;
+static const char *tname;  /* test or [ */
+
+static int test_fail(const char *fmt, const char *what)
+{
+    if (!terror) {
+        fprintf(stderr, "pssh: %s: ", tname);
+        fprintf(stderr, fmt, what);
+        fputc('\n', stderr);
+    }
+    terror = 1;
+    return 0;
+}
+
+static int test_int(const char *s, long long *v)
+{
+    char *end;
+
+    while (isspace((unsigned char)*s))
+        s++;
+    errno = 0;
+    *v = strtoll(s, &end, 10);
+    while (end != s && isspace((unsigned char)*end))
+        end++;
+    if (end == s || *end || errno)
+        return test_fail("%s: integer expression expected", s);
+
+    return 1;
+}
+
+static int is_unary(const char *op)
+{
+    return op[0] == '-' && op[1] && !op[2] && strchr("bcdefgGhLkOprsStuwxnz", op[1]);
+}
+
+static int is_binary(const char *op)
+{
+    static const char *ops[] = {
+        "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+        "-nt", "-ot", "-ef", NULL
+    };
+
+    for (int i = 0; ops[i]; i++)
+        if (!strcmp(op, ops[i]))
+            return 1;
+    return 0;
+}
+
+static int test_unary(char op, const char *arg)
+{
+    struct stat st;
+    long long fd;
+
+    switch (op) {
+    case 'n': return *arg != '\0';
+    case 'z': return *arg == '\0';
+    case 't': return test_int(arg, &fd) && isatty(fd);
+    case 'h': case 'L': return !lstat(arg, &st) && S_ISLNK(st.st_mode);
+    case 'r': return !access(arg, R_OK);
+    case 'w': return !access(arg, W_OK);
+    case 'x': return !access(arg, X_OK);
+    }
+
+    if (stat(arg, &st) < 0)
+        return 0;
+
+    switch (op) {
+    case 'b': return S_ISBLK(st.st_mode);
+    case 'c': return S_ISCHR(st.st_mode);
+    case 'd': return S_ISDIR(st.st_mode);
+    case 'e': return 1;
+    case 'f': return S_ISREG(st.st_mode);
+    case 'g': return (st.st_mode & S_ISGID) != 0;
+    case 'G': return st.st_gid == getegid();
+    case 'k': return (st.st_mode & S_ISVTX) != 0;
+    case 'O': return st.st_uid == geteuid();
+    case 'p': return S_ISFIFO(st.st_mode);
+    case 's': return st.st_size > 0;
+    case 'S': return S_ISSOCK(st.st_mode);
+    case 'u': return (st.st_mode & S_ISUID) != 0;
+    }
+
+    return 0;
+}
+
+static int test_binary(const char *a, const char *op, const char *b)
+{
+    struct stat sa, sb;
+    long long x, y;
+    int ha, hb;
+
+    if (!strcmp(op, "=") || !strcmp(op, "=="))
+        return !strcmp(a, b);
+    if (!strcmp(op, "!="))
+        return strcmp(a, b) != 0;
+    if (!strcmp(op, "<"))
+        return strcoll(a, b) < 0;
+    if (!strcmp(op, ">"))
+        return strcoll(a, b) > 0;
+
+    if (op[1] == 'n' && op[2] == 't') {
+        ha = !stat(a, &sa);
+        hb = !stat(b, &sb);
+        return ha && (!hb || sa.st_mtim.tv_sec > sb.st_mtim.tv_sec ||
+                      (sa.st_mtim.tv_sec == sb.st_mtim.tv_sec &&
+                       sa.st_mtim.tv_nsec > sb.st_mtim.tv_nsec));
+    }
+    if (op[1] == 'o' && op[2] == 't') {
+        ha = !stat(a, &sa);
+        hb = !stat(b, &sb);
+        return hb && (!ha || sa.st_mtim.tv_sec < sb.st_mtim.tv_sec ||
+                      (sa.st_mtim.tv_sec == sb.st_mtim.tv_sec &&
+                       sa.st_mtim.tv_nsec < sb.st_mtim.tv_nsec));
+    }
+    if (op[1] == 'e' && op[2] == 'f')
+        return !stat(a, &sa) && !stat(b, &sb) &&
+               sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+
+    if (!test_int(a, &x) || !test_int(b, &y))
+        return 0;
+
+    if (!strcmp(op, "-eq")) return x == y;
+    if (!strcmp(op, "-ne")) return x != y;
+    if (!strcmp(op, "-lt")) return x < y;
+    if (!strcmp(op, "-le")) return x <= y;
+    if (!strcmp(op, "-gt")) return x > y;
+    return x >= y;
+}
+
+
+static int test_or(void);
+
+static const char *tnext(void)
+{
+    if (!tnargs)
+        return NULL;
+    tnargs--;
+    return *targ++;
+}
+
+/* primary: ( expr ), unary-op arg, arg binary-op arg, or a string */
+static int test_primary(void)
+{
+    const char *a = tnext(), *op;
+    int r;
+
+    if (!a)
+        return test_fail("%sargument expected", "");
+
+    if (!strcmp(a, "(")) {
+        r = test_or();
+        if (!(a = tnext()) || strcmp(a, ")"))
+            return test_fail("%s expected", "')'");
+        return r;
+    }
+
+    if (tnargs >= 2 && is_binary(targ[0])) {
+        op = tnext();
+        return test_binary(a, op, tnext());
+    }
+
+    if (is_unary(a) && tnargs >= 1)
+        return test_unary(a[1], tnext());
+
+    return *a != '\0';
+}
+
+static int test_not(void)
+{
+    if (tnargs && !strcmp(*targ, "!")) {
+        tnext();
+        return !test_not();
+    }
+    return test_primary();
+}
+
+static int test_and(void)
+{
+    int r = test_not();
+
+    while (tnargs && !strcmp(*targ, "-a")) {
+        tnext();
+        r = test_not() && r;
+    }
+    return r;
+}
+
+static int test_or(void)
+{
+    int r = test_and();
+
+    while (tnargs && !strcmp(*targ, "-o")) {
+        tnext();
+        r = test_and() || r;
+    }
+    return r;
+}
+
+/* the POSIX rules for up to four args, the grammar beyond */
+static int test_eval(char **argv, int argc)
+{
+    switch (argc) {
+    case 0:
+        return 0;
+    case 1:
+        return *argv[0] != '\0';
+    case 2:
+        if (!strcmp(argv[0], "!"))
+            return *argv[1] == '\0';
+        if (is_unary(argv[0]))
+            return test_unary(argv[0][1], argv[1]);
+        return test_fail("%s: unary operator expected", argv[0]);
+    case 3:
+        if (is_binary(argv[1]))
+            return test_binary(argv[0], argv[1], argv[2]);
+        if (!strcmp(argv[1], "-a"))
+            return *argv[0] && *argv[2];
+        if (!strcmp(argv[1], "-o"))
+            return *argv[0] || *argv[2];
+        if (!strcmp(argv[0], "!"))
+            return !test_eval(argv + 1, 2);
+        if (!strcmp(argv[0], "(") && !strcmp(argv[2], ")"))
+            return *argv[1] != '\0';
+        break;
+    case 4:
+        if (!strcmp(argv[0], "!"))
+            return !test_eval(argv + 1, 3);
+        if (!strcmp(argv[0], "(") && !strcmp(argv[3], ")"))
+            return test_eval(argv + 1, 2);
+        break;
+    }
+
+    targ = argv;
+    tnargs = argc;
+    argc = test_or();
+    if (tnargs)
+        test_fail("%s: unexpected argument", *targ);
+    return argc;
+}
+
+
+/*
+ * builtin_test - implements test expr and [ expr ]
+ */
+int builtin_test(Task T)
+{
+    int argc, r;
+
+    for (argc=0; T.argv[argc]; argc++)
+        ;
+
+    tname = T.argv[0];
+    terror = 0;
+
+    if (!strcmp(T.argv[0], "[")) {
+        if (strcmp(T.argv[argc-1], "]")) {
+            fprintf(stderr, "pssh: [: missing ']'\n");
+            return TEST_ERROR;
+        }
+        argc--;
+    }
+
+    r = test_eval(T.argv + 1, argc - 1);
+
+    return terror ? TEST_ERROR : !r;
+}
+
+
+/*
+ * builtin_pwd - implements pwd [-L | -P]
+ *
+ * -P (the default, as with coreutils) resolves every symlink; -L gives
+ * $PWD if it names the current directory.
+ */
+int builtin_pwd(Task T)
+{
+    const char *pwd = getenv("PWD");
+    struct stat a, b;
+    char *cwd;
+    int logical = 0, i;
+
+    for (i=1; T.argv[i]; i++) {
+        if (!strcmp(T.argv[i], "-L"))
+            logical = 1;
+        else if (!strcmp(T.argv[i], "-P"))
+            logical = 0;
+        else {
+            fprintf(stderr, "pssh: pwd: %s: invalid option\n", T.argv[i]);
+            return 1;
+        }
+    }
+
+    if (logical && pwd && *pwd == '/' && !strstr(pwd, "/./") && !strstr(pwd, "/../") &&
+        !stat(pwd, &a) && !stat(".", &b) && a.st_dev == b.st_dev && a.st_ino == b.st_ino) {
+        puts(pwd);
+        return 0;
+    }
+
+    cwd = getcwd(NULL, 0);
+    if (!cwd) {
+        fprintf(stderr, "pssh: pwd: %s\n", strerror(errno));
+        return 1;
+    }
+    puts(cwd);
+    free(cwd);
+
+    return 0;
+}
+
+
+/* the last component of path, without trailing slashes and suffix */
+static void put_basename(const char *path, const char *suffix, char end)
+{
+    size_t len = strlen(path), start, slen;
+
+    while (len > 1 && path[len-1] == '/')
+        len--;
+
+    start = len;
+    while (start > 0 && path[start-1] != '/')
+        start--;
+
+    /* "/" stays "/" */
+    if (start == len && len) {
+        start = len - 1;
+    } else if (suffix && (slen = strlen(suffix)) < len - start &&
+               !strncmp(path + len - slen, suffix, slen)) {
+        len -= slen;
+    }
+
+    fwrite(path + start, 1, len - start, stdout);
+    putchar(end);
+}
+
+
+/*
+ * builtin_basename - implements
+ *   basename name [suffix]
+ *   basename [-a] [-s suffix] [-z] name ...
+ */
+int builtin_basename(Task T)
+{
+    const char *suffix = NULL;
+    char end = '\n';
+    int i, multiple = 0;
+
+    for (i=1; T.argv[i] && T.argv[i][0] == '-' && T.argv[i][1]; i++) {
+        if (!strcmp(T.argv[i], "--")) {
+            i++;
+            break;
+        } else if (!strcmp(T.argv[i], "-a")) {
+            multiple = 1;
+        } else if (!strcmp(T.argv[i], "-z")) {
+            end = '\0';
+        } else if (!strcmp(T.argv[i], "-s") && T.argv[i+1]) {
+            suffix = T.argv[++i];
+            multiple = 1;
+        } else {
+            fprintf(stderr, "pssh: basename: %s: invalid option\n", T.argv[i]);
+            return 1;
+        }
+    }
+
+    if (!T.argv[i]) {
+        fprintf(stderr, "Usage: basename name [suffix]\n"
+                        "       basename [-a] [-s suffix] [-z] name ...\n");
+        return 1;
+    }
+
+    if (!multiple) {
+        if (T.argv[i+1] && T.argv[i+2]) {
+            fprintf(stderr, "pssh: basename: %s: extra operand\n", T.argv[i+2]);
+            return 1;
+        }
+        put_basename(T.argv[i], T.argv[i+1], end);
+        return 0;
+    }
+
+    for (; T.argv[i]; i++)
+        put_basename(T.argv[i], suffix, end);
+
+    return 0;
+}
+
+
+/*
+ * builtin_dirname - implements dirname [-z] name ...
+ */
+int builtin_dirname(Task T)
+{
+    char end = '\n';
+    size_t len;
+    const char *path;
+    int i = 1;
+
+    if (T.argv[i] && !strcmp(T.argv[i], "-z")) {
+        end = '\0';
+        i++;
+    }
+    if (T.argv[i] && !strcmp(T.argv[i], "--"))
+        i++;
+
+    if (!T.argv[i]) {
+        fprintf(stderr, "Usage: dirname [-z] name ...\n");
+        return 1;
+    }
+
+    for (; T.argv[i]; i++) {
+        path = T.argv[i];
+        len = strlen(path);
+
+        /* strip trailing slashes, the last component, then its slashes */
+        while (len > 1 && path[len-1] == '/')
+            len--;
+        while (len > 0 && path[len-1] != '/')
+            len--;
+        while (len > 1 && path[len-1] == '/')
+            len--;
+
+        if (!len)
+            putchar('.');
+        else
+            fwrite(path, 1, len, stdout);
+        putchar(end);
+    }
+
+    return 0;
+}
+
+
+/*
+ * builtin_sleep - implements sleep number[smhd] ...
+ *
+ * Sleeps for the sum of the times given, fractions and inf included;
+ * ^C ends it.  At an interactive prompt it is a job of its own, so that
+ * ^Z stops it; elsewhere jobs that end meanwhile are reaped as it waits.
+ */
+int builtin_sleep(Task T)
+{
+    struct timespec ts, now, until;
+    sigset_t waitmask;
+    double total = 0, n;
+    char *end;
+    int i, status;
+
+    if (!T.argv[1]) {
+        fprintf(stderr, "Usage: sleep number[smhd] ...\n");
+        return 1;
+    }
+
+    for (i=1; T.argv[i]; i++) {
+        n = strtod(T.argv[i], &end);
+        if (end == T.argv[i] || n < 0 || (*end && end[1]) || !strchr("smhd", *end)) {
+            fprintf(stderr, "pssh: sleep: %s: invalid time interval\n", T.argv[i]);
+            return 1;
+        }
+        switch (*end) {
+        case 'm': n *= 60; break;
+        case 'h': n *= 60 * 60; break;
+        case 'd': n *= 24 * 60 * 60; break;
+        }
+        total += n;
+    }
+
+    if ((status = builtin_job(T)) >= 0)
+        return status;
+
+    fflush(stdout);
+
+    sigprocmask(SIG_BLOCK, NULL, &waitmask);
+    sigdelset(&waitmask, SIGCHLD);
+
+    /* in pieces, so that inf and the like fit in a time_t */
+    while (total > 0 && !job_interrupted) {
+        n = total > 1e9 ? 1e9 : total;
+        total -= n;
+
+        clock_gettime(CLOCK_MONOTONIC, &until);
+        until.tv_sec += (time_t)n;
+        until.tv_nsec += (long)((n - (time_t)n) * 1e9);
+        if (until.tv_nsec >= 1000000000) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
+        }
+
+        /* SIGCHLD is let through, and wakes it early to reap */
+        while (!job_interrupted) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            ts.tv_sec = until.tv_sec - now.tv_sec;
+            ts.tv_nsec = until.tv_nsec - now.tv_nsec;
+            if (ts.tv_nsec < 0) {
+                ts.tv_sec--;
+                ts.tv_nsec += 1000000000;
+            }
+            if (ts.tv_sec < 0)
+                break;
+            ppoll(NULL, 0, &ts, &waitmask);
+        }
+    }
+
+    return job_interrupted ? 130 : 0;
+}
@@ -0,0 +1,320 @@
+/* vars.c
+ * shell variables: a hash table of name -> value, with the exported
+ * ones mirrored into the environment so that exec'd children see them
+ *
+ **********************************************************************/
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "vars.h"
+
+extern char **environ;
+
+static HashTable *vars;
+
+static char *arg0;
+static char **posargs;
+static int nposargs;
+
+
+static void var_free(void *p)
+{
+    Var *v = p;
+    int i;
+
+    for (i=0; i<v->nelems; i++)
+        free(v->elems[i]);
+    free(v->elems);
+    free(v->value);
+    free(v);
+}
+
+
+/**
+ * Import the environment as exported shell variables
+ */
+void vars_init(void)
+{
+    char **env, *eq, *name;
+
+    vars = hash_new(var_free);
+
+    for (env=environ; *env; env++) {
+        eq = strchr(*env, '=');
+        if (!eq || !var_name_valid(*env, eq - *env))
+            continue;
+
+        name = strndup(*env, eq - *env);
+        var_set(name, eq + 1);
+        var_export(name);
+        free(name);
+    }
+}
+
+
+/**
+ * Returns 1 if the first len bytes of name form a valid identifier
+ */
+int var_name_valid(const char *name, size_t len)
+{
+    size_t i;
+
+    if (!len || !(isalpha((unsigned char)name[0]) || name[0] == '_'))
+        return 0;
+
+    for (i=1; i<len; i++)
+        if (!(isalnum((unsigned char)name[i]) || name[i] == '_'))
+            return 0;
+
+    return 1;
+}
+
+
+const char *var_get(const char *name)
+{
+    Var *v = hash_get(vars, name);
+
+    if (v && v->flags & VAR_ARRAY)
+        return v->nelems ? v->elems[0] : NULL;
+
+    return v ? v->value : NULL;
+}
+
+
+static Var *var_new(const char *name)
+{
+    Var *v = malloc(sizeof(*v));
+
+    v->value = NULL;
+    v->flags = 0;
+    v->elems = NULL;
+    v->nelems = 0;
+    hash_put(vars, name, v);
+
+    return v;
+}
+
+
+void var_set(const char *name, const char *value)
+{
+    Var *v = hash_get(vars, name);
+
+    if (!v) {
+        v = var_new(name);
+        v->value = strdup(value);
+        return;
+    }
+
+    if (v->flags & VAR_ARRAY) {
+        var_set_elem(name, 0, value);
+        return;
+    }
+
+    if (strcmp(v->value, value)) {
+        free(v->value);
+        v->value = strdup(value);
+    }
+
+    if (v->flags & VAR_EXPORT)
+        setenv(name, value, 1);
+}
+
+
+void var_set_int(const char *name, long long value)
+{
+    char buf[32];
+
+    snprintf(buf, sizeof(buf), "%lld", value);
+    var_set(name, buf);
+}
+
+
+void var_unset(const char *name)
+{
+    Var *v = hash_get(vars, name);
+
+    if (!v)
+        return;
+
+    if (v->flags & VAR_EXPORT)
+        unsetenv(name);
+
+    hash_remove(vars, name);
+}
+
+
+void var_export(const char *name)
+{
+    Var *v = hash_get(vars, name);
+
+    if (!v) {
+        var_set(name, "");
+        v = hash_get(vars, name);
+    }
+
+    /* arrays have no place in the environment */
+    if (v->flags & VAR_ARRAY)
+        return;
+
+    v->flags |= VAR_EXPORT;
+    setenv(name, v->value, 1);
+}
+
+
+/**
+ * Makes name an array holding copies of elems[0..n)
+ */
+void var_set_array(const char *name, char **elems, int n)
+{
+    Var *v;
+    int i;
+
+    var_unset(name);
+    v = var_new(name);
+    v->flags = VAR_ARRAY;
+    v->elems = malloc((n + 1) * sizeof(*v->elems));
+    for (i=0; i<n; i++)
+        v->elems[i] = strdup(elems[i]);
+    v->nelems = n;
+}
+
+
+/**
+ * Sets element i of an array, turning a scalar into one; the elements
+ * in between become empty strings
+ */
+void var_set_elem(const char *name, int i, const char *value)
+{
+    Var *v = hash_get(vars, name);
+
+    if (!v)
+        v = var_new(name);
+
+    if (!(v->flags & VAR_ARRAY)) {
+        if (v->flags & VAR_EXPORT)
+            unsetenv(name);
+        v->flags = VAR_ARRAY;
+        if (v->value) {
+            v->elems = malloc(sizeof(*v->elems));
+            v->elems[v->nelems++] = v->value;
+            v->value = NULL;
+        }
+    }
+
+    if (i >= v->nelems) {
+        v->elems = realloc(v->elems, (i + 1) * sizeof(*v->elems));
+        while (v->nelems <= i)
+            v->elems[v->nelems++] = strdup("");
+    }
+
+    free(v->elems[i]);
+    v->elems[i] = strdup(value);
+}
+
+
+/**
+ * Returns element i of name, counting from the end if i is negative,
+ * or NULL if there is no such element
+ */
+const char *var_get_elem(const char *name, int i)
+{
+    Var *v = hash_get(vars, name);
+    int n;
+
+    if (!v)
+        return NULL;
+
+    if (!(v->flags & VAR_ARRAY))
+        return i == 0 || i == -1 ? v->value : NULL;
+
+    n = v->nelems;
+    if (i < 0)
+        i += n;
+
+    return i >= 0 && i < n ? v->elems[i] : NULL;
+}
+
+
+/**
+ * Returns the elements of name and their number in *n; NULL (with *n
+ * set to 0) if it is unset
+ */
+char **var_get_array(const char *name, int *n)
+{
+    Var *v = hash_get(vars, name);
+
+    *n = 0;
+
+    if (!v)
+        return NULL;
+
+    if (!(v->flags & VAR_ARRAY)) {
+        *n = 1;
+        return &v->value;
+    }
+
+    *n = v->nelems;
+
+    return v->elems;
+}
+
+
+void var_set_arg0(const char *name)
+{
+    free(arg0);
+    arg0 = strdup(name);
+}
+
+
+void var_set_positional(char **args, int n)
+{
+    int i;
+
+    for (i=0; i<nposargs; i++)
+        free(posargs[i]);
+    free(posargs);
+
+    posargs = malloc((n + 1) * sizeof(*posargs));
+    for (i=0; i<n; i++)
+        posargs[i] = strdup(args[i]);
+    posargs[n] = NULL;
+    nposargs = n;
+}
+
+
+/**
+ * Exchanges the positional parameters with *args / *n, e.g. to give a
+ * function its own and to put the caller's back afterwards
+ */
+void var_swap_positional(char ***args, int *n)
+{
+    char **a = posargs;
+    int k = nposargs;
+
+    posargs = *args;
+    nposargs = *n;
+    *args = a;
+    *n = k;
+}
+
+
+/**
+ * Returns $i, or NULL if there are fewer than i parameters
+ */
+const char *var_positional(int i)
+{
+    if (i == 0)
+        return arg0 ? arg0 : "pssh";
+
+    return i <= nposargs ? posargs[i-1] : NULL;
+}
+
+
+int var_npositional(void)
+{
+    return nposargs;
+}
@@ -0,0 +1,38 @@
+#ifndef VARS_H
+#define VARS_H
+
+#include <stddef.h>
+
+#define VAR_EXPORT  0x1   /* mirrored into the environment of children */
+#define VAR_ARRAY   0x2   /* an indexed array: elems holds the values */
+
+typedef struct {
+    char *value;
+    int flags;
+    char **elems;
+    int nelems;
+} Var;
+
+void vars_init(void);
+const char *var_get(const char *name);
+void var_set(const char *name, const char *value);
+void var_set_int(const char *name, long long value);
+void var_unset(const char *name);
+void var_export(const char *name);
+int var_name_valid(const char *name, size_t len);
+
+/* indexed arrays; $name alone is element 0 and a scalar is taken as an
+ * array of one element */
+void var_set_array(const char *name, char **elems, int n);
+void var_set_elem(const char *name, int i, const char *value);
+const char *var_get_elem(const char *name, int i);
+char **var_get_array(const char *name, int *n);
+
+/* positional parameters: $0 and $1 .. $n */
+void var_set_arg0(const char *arg0);
+void var_set_positional(char **args, int n);
+void var_swap_positional(char ***args, int *n);
+const char *var_positional(int i);
+int var_npositional(void);
+
+#endif